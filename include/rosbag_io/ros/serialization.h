@@ -42,6 +42,7 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <iterator>
 
 #include <boost/array.hpp>
 #include <boost/call_traits.hpp>
@@ -50,6 +51,7 @@
 #include <boost/mpl/or.hpp>
 #include <boost/mpl/not.hpp>
 
+#include <cstdint>
 #include <cstring>
 
 #define ROS_NEW_SERIALIZATION_API 1
@@ -175,6 +177,22 @@ inline uint32_t serializationLength(const T& t)
   return Serializer<T>::serializedLength(t);
 }
 
+struct GatherStream;
+
+/**
+ * \brief Serialize a run of raw bytes.  Stream here should normally be a ros::serialization::OStream
+ */
+template<typename Stream>
+inline void serializeBlob(Stream& stream, const void* data, uint32_t len)
+{
+  memcpy(stream.advance(len), data, len);
+}
+
+/**
+ * \brief serializeBlob version for GatherStream, which may reference the bytes instead of copying them
+ */
+inline void serializeBlob(GatherStream& stream, const void* data, uint32_t len);
+
 #define ROS_CREATE_SIMPLE_SERIALIZER(Type) \
   template<> struct Serializer<Type> \
   { \
@@ -245,7 +263,7 @@ struct Serializer<std::basic_string<char, std::char_traits<char>, ContainerAlloc
 
     if (len > 0)
     {
-      memcpy(stream.advance(static_cast<uint32_t>(len)), str.data(), len);
+      serializeBlob(stream, str.data(), static_cast<uint32_t>(len));
     }
   }
 
@@ -256,7 +274,7 @@ struct Serializer<std::basic_string<char, std::char_traits<char>, ContainerAlloc
     stream.next(len);
     if (len > 0)
     {
-      str = StringType(reinterpret_cast<char*>(stream.advance(len)), len);
+      str.assign(reinterpret_cast<char*>(stream.advance(len)), len);
     }
     else
     {
@@ -322,6 +340,71 @@ struct Serializer<ros::Duration>
   }
 };
 
+/**
+ * \brief Random access iterator yielding the Ts stored in a byte buffer, whatever its alignment.
+ *
+ * Each element is read with memcpy, which compiles to a plain load where the target allows
+ * unaligned access, so the buffer never has to be accessed through a T pointer.
+ */
+template<typename T>
+class SimpleBytesIterator
+{
+public:
+  typedef std::random_access_iterator_tag iterator_category;
+  typedef T value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const T* pointer;
+  typedef T reference;
+
+  explicit SimpleBytesIterator(const uint8_t* pos) : pos_(pos) {}
+
+  T operator*() const
+  {
+    T t;
+    memcpy(static_cast<void*>(&t), pos_, sizeof(T));
+    return t;
+  }
+  T operator[](difference_type n) const { return *(*this + n); }
+
+  SimpleBytesIterator& operator++() { pos_ += sizeof(T); return *this; }
+  SimpleBytesIterator operator++(int) { SimpleBytesIterator it(*this); ++*this; return it; }
+  SimpleBytesIterator& operator--() { pos_ -= sizeof(T); return *this; }
+  SimpleBytesIterator operator--(int) { SimpleBytesIterator it(*this); --*this; return it; }
+  SimpleBytesIterator& operator+=(difference_type n) { pos_ += n * static_cast<difference_type>(sizeof(T)); return *this; }
+  SimpleBytesIterator& operator-=(difference_type n) { return *this += -n; }
+  SimpleBytesIterator operator+(difference_type n) const { SimpleBytesIterator it(*this); return it += n; }
+  SimpleBytesIterator operator-(difference_type n) const { SimpleBytesIterator it(*this); return it -= n; }
+  difference_type operator-(const SimpleBytesIterator& o) const
+  {
+    return (pos_ - o.pos_) / static_cast<difference_type>(sizeof(T));
+  }
+
+  bool operator==(const SimpleBytesIterator& o) const { return pos_ == o.pos_; }
+  bool operator!=(const SimpleBytesIterator& o) const { return pos_ != o.pos_; }
+  bool operator<(const SimpleBytesIterator& o) const { return pos_ < o.pos_; }
+  bool operator>(const SimpleBytesIterator& o) const { return pos_ > o.pos_; }
+  bool operator<=(const SimpleBytesIterator& o) const { return pos_ <= o.pos_; }
+  bool operator>=(const SimpleBytesIterator& o) const { return pos_ >= o.pos_; }
+
+private:
+  const uint8_t* pos_;
+};
+
+/**
+ * \brief Fill a vector of simple types straight from the stream bytes.
+ *
+ * resize() value-initializes (zero-fills) every element only for a memcpy to overwrite it.  A
+ * range assign instead copy-constructs the elements from the source into uninitialized storage,
+ * so every byte is touched once and the existing capacity of the vector is reused.  The same path
+ * serves aligned and unaligned sources.
+ */
+template<typename T, class Allocator>
+inline void assignSimpleVector(std::vector<T, Allocator>& v, const uint8_t* data, uint32_t len)
+{
+  SimpleBytesIterator<T> first(data);
+  v.assign(first, first + len);
+}
+
 /**
  * \brief Vector serializer.  Default implementation does nothing
  */
@@ -397,7 +480,7 @@ struct VectorSerializer<T, ContainerAllocator, typename boost::enable_if<mt::IsS
     if (!v.empty())
     {
       const uint32_t data_len = len * static_cast<uint32_t>(sizeof(T));
-      memcpy(stream.advance(data_len), &v.front(), data_len);
+      serializeBlob(stream, &v.front(), data_len);
     }
   }
 
@@ -406,13 +489,9 @@ struct VectorSerializer<T, ContainerAllocator, typename boost::enable_if<mt::IsS
   {
     uint32_t len;
     stream.next(len);
-    v.resize(len);
 
-    if (len > 0)
-    {
-      const uint32_t data_len = static_cast<uint32_t>(sizeof(T)) * len;
-      memcpy(static_cast<void*>(&v.front()), stream.advance(data_len), data_len);
-    }
+    const uint32_t data_len = static_cast<uint32_t>(sizeof(T)) * len;
+    assignSimpleVector(v, stream.advance(data_len), len);
   }
 
   inline static uint32_t serializedLength(const VecType& v)
@@ -564,7 +643,7 @@ struct ArraySerializer<T, N, typename boost::enable_if<mt::IsSimple<T> >::type>
   inline static void write(Stream& stream, const ArrayType& v)
   {
     const uint32_t data_len = N * sizeof(T);
-    memcpy(stream.advance(data_len), &v.front(), data_len);
+    serializeBlob(stream, &v.front(), data_len);
   }
 
   template<typename Stream>
@@ -800,6 +879,129 @@ private:
   uint32_t count_;
 };
 
+/**
+ * \brief Gather stream
+ *
+ * GatherStream serializes into a list of segments instead of one contiguous buffer.  Fields are
+ * copied into a small scratch area as with OStream, but byte runs of at least min_reference_size
+ * (the payload of a uint8[] for instance) are referenced in place, so they can be handed to
+ * writev() or a compressor straight from the message's own memory.
+ *
+ * The segments are only valid as long as the serialized message is alive and unmodified, and until
+ * the stream is cleared or written to again.
+ */
+struct GatherStream
+{
+  static const StreamType stream_type = stream_types::Output;
+
+  explicit GatherStream(uint32_t min_reference_size = 4096)
+  : length_(0)
+  , min_reference_size_(min_reference_size)
+  {}
+
+  /**
+   * \brief Serialize an item to this gather stream
+   */
+  template<typename T>
+  ROS_FORCE_INLINE void next(const T& t)
+  {
+    serialize(*this, t);
+  }
+
+  template<typename T>
+  ROS_FORCE_INLINE GatherStream& operator<<(const T& t)
+  {
+    serialize(*this, t);
+    return *this;
+  }
+
+  /**
+   * \brief Reserves len bytes of scratch space and returns a pointer to them.  The pointer is
+   * invalidated by the next call to advance().
+   */
+  inline uint8_t* advance(uint32_t len)
+  {
+    uint32_t offset = static_cast<uint32_t>(scratch_.size());
+    scratch_.resize(offset + len);
+
+    // Extend the previous segment when it also lives in the scratch area
+    if (!pieces_.empty() && pieces_.back().data == 0 && pieces_.back().offset + pieces_.back().size == offset)
+      pieces_.back().size += len;
+    else
+    {
+      Piece piece = { 0, offset, len };
+      pieces_.push_back(piece);
+    }
+
+    length_ += len;
+    return scratch_.data() + offset;
+  }
+
+  /**
+   * \brief Appends len bytes at data, by reference if the run is large enough, by copy otherwise
+   */
+  inline void reference(const uint8_t* data, uint32_t len)
+  {
+    if (len < min_reference_size_)
+    {
+      if (len > 0)
+        memcpy(advance(len), data, len);
+      return;
+    }
+
+    Piece piece = { data, 0, len };
+    pieces_.push_back(piece);
+    length_ += len;
+  }
+
+  /**
+   * \brief Get the total serialized length of everything written to this stream
+   */
+  inline uint32_t getLength() const { return length_; }
+
+  /**
+   * \brief Resolve everything written so far into a list of segments
+   */
+  inline void getSegments(std::vector<SerializedSegment>& segments) const
+  {
+    segments.resize(pieces_.size());
+    for (size_t i = 0; i < pieces_.size(); ++i)
+    {
+      segments[i].data = pieces_[i].data ? pieces_[i].data : scratch_.data() + pieces_[i].offset;
+      segments[i].size = pieces_[i].size;
+    }
+  }
+
+  /**
+   * \brief Forget everything written so far, keeping the allocated scratch space
+   */
+  inline void clear()
+  {
+    scratch_.clear();
+    pieces_.clear();
+    length_ = 0;
+  }
+
+private:
+  //! Either a reference to external bytes (data != 0) or an offset into scratch_
+  struct Piece
+  {
+    const uint8_t* data;
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  std::vector<uint8_t> scratch_;
+  std::vector<Piece> pieces_;
+  uint32_t length_;
+  uint32_t min_reference_size_;
+};
+
+inline void serializeBlob(GatherStream& stream, const void* data, uint32_t len)
+{
+  stream.reference(static_cast<const uint8_t*>(data), len);
+}
+
 /**
  * \brief Serialize a message
  */
@@ -38,6 +38,18 @@ namespace rosbag_io
 namespace ros
 {
 
+/**
+ * \brief A contiguous run of serialized bytes, as produced by a serialization::GatherStream.
+ *
+ * The segment does not own its data: it points either into the gather stream's scratch space or
+ * straight into the memory of the message that was serialized.
+ */
+struct SerializedSegment
+{
+  const uint8_t* data;
+  uint32_t size;
+};
+
 class ROSCPP_SERIALIZATION_DECL SerializedMessage
 {
 public:
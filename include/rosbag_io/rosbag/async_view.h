@@ -0,0 +1,294 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_ASYNC_VIEW_H
+#define ROSBAG_ASYNC_VIEW_H
+
+// The coroutine interface needs a C++20 compiler; the rest of the library only needs C++17
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+  #if __has_include(<coroutine>)
+    #define ROSBAG_HAS_COROUTINES 1
+  #endif
+#endif
+
+#ifdef ROSBAG_HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "rosbag_io/rosbag/buffer.h"
+#include "rosbag_io/rosbag/chunk_loader.h"
+#include "rosbag_io/rosbag/chunk_reader.h"
+#include "rosbag_io/rosbag/message_instance.h"
+#include "rosbag_io/rosbag/macros.h"
+#include "rosbag_io/rosbag/view.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! Awaits the load of a chunk by a ChunkLoader
+/*!
+ * co_await returns the decompressed records of the chunk, or rethrows the error of its load.  A
+ * chunk still held by anybody is returned without suspending; otherwise the coroutine is resumed on
+ * a thread of the loader.
+ */
+class ChunkAwaitable
+{
+public:
+    ChunkAwaitable(ChunkLoader& loader, Bag const& bag, uint64_t chunk_pos)
+        : loader_(&loader), bag_(&bag), chunk_pos_(chunk_pos) { }
+
+    bool await_ready() {
+        chunk_ = loader_->find(*bag_, chunk_pos_);
+        return chunk_ != NULL;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        loader_->load(*bag_, chunk_pos_, [this, handle](boost::shared_ptr<Buffer> const& chunk, std::exception_ptr const& error) {
+            chunk_ = chunk;
+            error_ = error;
+            handle.resume();
+        });
+    }
+
+    boost::shared_ptr<Buffer> await_resume() {
+        if (error_)
+            std::rethrow_exception(error_);
+        return chunk_;
+    }
+
+private:
+    ChunkLoader*              loader_;
+    Bag const*                bag_;
+    uint64_t                  chunk_pos_;
+    boost::shared_ptr<Buffer> chunk_;
+    std::exception_ptr        error_;
+};
+
+//! Load the chunk at chunk_pos of a bag, see ChunkAwaitable
+inline ChunkAwaitable loadChunk(ChunkLoader& loader, Bag const& bag, uint64_t chunk_pos) {
+    return ChunkAwaitable(loader, bag, chunk_pos);
+}
+
+//! A message read asynchronously, pinning the decompressed chunk that holds its payload
+struct AsyncMessage
+{
+    AsyncMessage(MessageInstance const& message, boost::shared_ptr<Buffer> const& chunk, uint8_t const* data, uint32_t data_size)
+        : message(message), chunk(chunk), data(data), data_size(data_size) { }
+
+    //! Deserialize the payload, returning a NULL pointer if the message is not of the type
+    template<class T>
+    boost::shared_ptr<T> instantiate() const { return message.instantiate<T>(data, data_size); }
+
+    MessageInstance           message;
+    boost::shared_ptr<Buffer> chunk;
+    uint8_t const*            data;        //!< valid as long as the message is
+    uint32_t                  data_size;
+};
+
+//! A position in a view whose messages are read without blocking the caller
+/*!
+ * co_await next() returns a pointer to the next message, valid until next() is awaited again, or
+ * NULL after the last one.  Walking the view only touches its index; when a message is in another
+ * chunk than the previous one, the coroutine is suspended while the loader reads the chunk.
+ *
+ * The view, the loader and the cursor must outlive the awaits.  Can throw BagFormatException and
+ * BagIOException from co_await.
+ */
+class ViewCursor
+{
+public:
+    class NextAwaitable
+    {
+    public:
+        explicit NextAwaitable(ViewCursor& cursor) : cursor_(&cursor) { }
+
+        bool await_ready() {
+            ViewCursor& c = *cursor_;
+            c.current_ = boost::none;
+            if (c.started_ && c.position_ != c.view_->end())
+                ++c.position_;
+            c.started_ = true;
+            if (c.position_ == c.view_->end())
+                return true;
+
+            IndexEntry const& index_entry = c.position_->getIndexEntry();
+            if (c.chunk_ && c.chunk_bag_ == &c.position_->getBag() && c.chunk_pos_ == index_entry.chunk_pos)
+                return true;
+
+            load_.emplace(*c.loader_, c.position_->getBag(), index_entry.chunk_pos);
+            return load_->await_ready();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            load_->await_suspend(handle);
+        }
+
+        AsyncMessage const* await_resume() {
+            ViewCursor& c = *cursor_;
+            if (c.position_ == c.view_->end())
+                return NULL;
+
+            MessageInstance const& m = *c.position_;
+            if (load_) {
+                c.chunk_     = load_->await_resume();
+                c.chunk_bag_ = &m.getBag();
+                c.chunk_pos_ = m.getIndexEntry().chunk_pos;
+            }
+
+            uint8_t const* data;
+            uint32_t       data_size;
+            ChunkReader::locateMessageData(c.chunk_->getData(), c.chunk_->getSize(), m.getIndexEntry().offset, data, data_size);
+            c.current_.emplace(m, c.chunk_, data, data_size);
+            return &*c.current_;
+        }
+
+    private:
+        ViewCursor*                     cursor_;
+        boost::optional<ChunkAwaitable> load_;
+    };
+
+    ViewCursor(View& view, ChunkLoader& loader)
+        : view_(&view), loader_(&loader), position_(view.begin()), started_(false), chunk_bag_(NULL), chunk_pos_(0) { }
+
+    NextAwaitable next() { return NextAwaitable(*this); }
+
+private:
+    friend class NextAwaitable;
+
+    View*                         view_;
+    ChunkLoader*                  loader_;
+    View::iterator                position_;
+    bool                          started_;
+
+    boost::shared_ptr<Buffer>     chunk_;       //!< the chunk of the last message
+    Bag const*                    chunk_bag_;
+    uint64_t                      chunk_pos_;
+    boost::optional<AsyncMessage> current_;
+};
+
+//! A coroutine producing values with co_yield, which its consumer awaits one at a time
+/*!
+ * co_await next() runs the generator until it yields, and returns a pointer to the value, valid
+ * until next() is awaited again, or NULL once the generator returns.  The generator starts when
+ * first awaited, and may suspend on other awaits in between yields: the consumer is resumed on
+ * whichever thread the generator yields from.  Exceptions of the generator are rethrown by next().
+ */
+template<class T>
+class AsyncGenerator
+{
+public:
+    struct promise_type
+    {
+        T const*                value = NULL;
+        std::coroutine_handle<> consumer;
+        std::exception_ptr      error;
+
+        //! Resumes the consumer when the generator yields or ends
+        struct Yield
+        {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                return handle.promise().consumer;
+            }
+            void await_resume() noexcept { }
+        };
+
+        AsyncGenerator      get_return_object()       { return AsyncGenerator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+        Yield               final_suspend()   noexcept { value = NULL; return Yield(); }
+        Yield               yield_value(T const& v) noexcept { value = &v; return Yield(); }
+        void                return_void() { }
+        void                unhandled_exception() { error = std::current_exception(); }
+    };
+
+    class NextAwaitable
+    {
+    public:
+        explicit NextAwaitable(std::coroutine_handle<promise_type> handle) : handle_(handle) { }
+
+        bool await_ready() { return !handle_ || handle_.done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) {
+            handle_.promise().consumer = consumer;
+            return handle_;
+        }
+
+        T const* await_resume() {
+            if (!handle_ || handle_.done()) {
+                if (handle_ && handle_.promise().error)
+                    std::rethrow_exception(std::exchange(handle_.promise().error, std::exception_ptr()));
+                return NULL;
+            }
+            return handle_.promise().value;
+        }
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    AsyncGenerator(AsyncGenerator&& other) noexcept : handle_(std::exchange(other.handle_, NULL)) { }
+    ~AsyncGenerator() {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    NextAwaitable next() { return NextAwaitable(handle_); }
+
+private:
+    explicit AsyncGenerator(std::coroutine_handle<promise_type> handle) : handle_(handle) { }
+    AsyncGenerator(AsyncGenerator const&);
+    AsyncGenerator& operator=(AsyncGenerator const&);
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+//! Generate the messages of a view, loading their chunks with a loader
+inline AsyncGenerator<AsyncMessage> readMessages(View& view, ChunkLoader& loader) {
+    ViewCursor cursor(view, loader);
+    while (AsyncMessage const* m = co_await cursor.next())
+        co_yield *m;
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif // ROSBAG_HAS_COROUTINES
+
+#endif
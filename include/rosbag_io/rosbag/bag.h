@@ -37,11 +37,15 @@
 
 #include "rosbag_io/rosbag/macros.h"
 
+#include "rosbag_io/rosbag/bag_index.h"
 #include "rosbag_io/rosbag/buffer.h"
+#include "rosbag_io/rosbag/chunk_cache.h"
 #include "rosbag_io/rosbag/chunked_file.h"
 #include "rosbag_io/rosbag/constants.h"
 #include "rosbag_io/rosbag/encryptor.h"
 #include "rosbag_io/rosbag/exceptions.h"
+#include "rosbag_io/rosbag/record_header.h"
+#include "rosbag_io/rosbag/shared_chunk_cache.h"
 #include "rosbag_io/rosbag/structures.h"
 
 #include "rosbag_io/ros/header.h"
@@ -83,17 +87,19 @@ namespace bagmode
     {
         Write   = 1,
         Read    = 2,
-        Append  = 4
+        Append  = 4     //!< Append to a bag; without Read, its message index is neither loaded nor kept
     };
 }
 typedef bagmode::BagMode BagMode;
 
+class ChunkReader;
 class MessageInstance;
 class View;
 class Query;
 
 class ROSBAG_STORAGE_DECL Bag
 {
+    friend class ChunkReader;
     friend class MessageInstance;
     friend class View;
 
@@ -122,6 +128,9 @@ public:
      * \param filename The bag file to open
      * \param mode     The mode to use (either read, write or append)
      *
+     * Appending without reading only loads the connections and chunks of the bag, not the index of
+     * its messages, so opening a long bag to append to it does not read the whole file.
+     *
      * Can throw BagException
      */
     void open(std::string const& filename, uint32_t mode = bagmode::Read);
@@ -139,6 +148,16 @@ public:
     CompressionType getCompression() const;                       //!< Get the compression method to use for writing chunks
     void            setChunkThreshold(uint32_t chunk_threshold);  //!< Set the threshold for creating new chunks
     uint32_t        getChunkThreshold() const;                    //!< Get the threshold for creating new chunks
+    void            setChunkCacheSize(uint64_t size);             //!< Set the bytes of decompressed chunks to keep for reading, 0 by default
+    uint64_t        getChunkCacheSize() const;                    //!< Get the bytes of decompressed chunks to keep for reading
+
+    //! Set a cache of decompressed chunks shared with other processes, or NULL for none
+    /*!
+     * Chunks not found in the chunk cache are looked for in the shared cache before being decompressed,
+     * and stored there once decompressed.  Several bags can use the same SharedChunkCache.
+     */
+    void setSharedChunkCache(boost::shared_ptr<SharedChunkCache> const& cache);
+    boost::shared_ptr<SharedChunkCache> getSharedChunkCache() const;
 
     //! Set encryptor of the bag file
     /*!
@@ -228,6 +247,9 @@ private:
 
     void startReadingVersion102();
     void startReadingVersion200();
+    void readIndexVersion200();
+    void readConnectionIndexesVersion200();
+    void startReadingSharedVersion200(std::string const& filename);
 
     // Writing
     
@@ -259,6 +281,7 @@ private:
 
     ros::Header readMessageDataHeader(IndexEntry const& index_entry);
     uint32_t    readMessageDataSize(IndexEntry const& index_entry) const;
+    void        readMessageData(IndexEntry const& index_entry, uint8_t const*& data, uint32_t& data_size) const;  //!< data is valid until the next read
 
     template<typename Stream>
     void readMessageDataIntoStream(IndexEntry const& index_entry, Stream& stream) const;
@@ -272,8 +295,10 @@ private:
     // Record header I/O
 
     void writeHeader(ros::M_string const& fields);
+    void writeHeader(RecordHeader const& header);
     void writeDataLength(uint32_t data_len);
     void appendHeaderToBuffer(Buffer& buf, ros::M_string const& fields);
+    void appendHeaderToBuffer(Buffer& buf, RecordHeader const& header);
     void appendDataLengthToBuffer(Buffer& buf, uint32_t data_len);
 
     void readHeaderFromBuffer(Buffer& buffer, uint32_t offset, ros::Header& header, uint32_t& data_size, uint32_t& bytes_read) const;
@@ -326,18 +351,18 @@ private:
     ChunkInfo curr_chunk_info_;
     uint64_t  curr_chunk_data_pos_;
 
-    std::map<std::string, uint32_t>                topic_connection_ids_;
-    std::map<ros::M_string, uint32_t>              header_connection_ids_;
-    std::map<uint32_t, ConnectionInfo*>            connections_;
+    boost::shared_ptr<BagIndex>                    index_;   //!< shared with the other readers of the file, see BagIndexRegistry
 
-    std::vector<ChunkInfo>                         chunks_;
-
-    std::map<uint32_t, std::multiset<IndexEntry> > connection_indexes_;
     std::map<uint32_t, std::multiset<IndexEntry> > curr_chunk_connection_indexes_;
 
     mutable Buffer   header_buffer_;           //!< reusable buffer in which to assemble the record header before writing to file
     mutable Buffer   record_buffer_;           //!< reusable buffer in which to assemble the record data before writing to file
 
+    RecordHeader     record_header_;           //!< reusable record header, encoded in place
+
+    ros::serialization::GatherStream      record_stream_;    //!< reusable stream in which to serialize messages before writing to file
+    std::vector<ros::SerializedSegment>   record_segments_;  //!< segments of the last message serialized into record_stream_
+
     mutable Buffer   chunk_buffer_;            //!< reusable buffer to read chunk into
     mutable Buffer   decompress_buffer_;       //!< reusable buffer to decompress chunks into
 
@@ -347,6 +372,11 @@ private:
 
     mutable uint64_t decompressed_chunk_;      //!< position of decompressed chunk
 
+    mutable ChunkCache chunk_cache_;           //!< recently decompressed chunks, other than the current one
+
+    boost::shared_ptr<SharedChunkCache> shared_chunk_cache_;   //!< decompressed chunks shared with other processes
+    mutable uint64_t file_id_;                 //!< identity of the file in the shared chunk cache, 0 until needed
+
     // Active encryptor
     boost::shared_ptr<rosbag::EncryptorBase> encryptor_;
 };
@@ -397,30 +427,11 @@ bool Bag::readField(ros::M_string const& fields, std::string const& field_name,
 
 template<typename Stream>
 void Bag::readMessageDataIntoStream(IndexEntry const& index_entry, Stream& stream) const {
-    ros::Header header;
+    uint8_t const* data;
     uint32_t data_size;
-    uint32_t bytes_read;
-    switch (version_)
-    {
-    case 200:
-    {
-        decompressChunk(index_entry.chunk_pos);
-        readMessageDataHeaderFromBuffer(*current_buffer_, index_entry.offset, header, data_size, bytes_read);
-        if (data_size > 0)
-            memcpy(stream.advance(data_size), current_buffer_->getData() + index_entry.offset + bytes_read, data_size);
-        break;
-    }
-    case 102:
-    {
-        readMessageDataRecord102(index_entry.chunk_pos, header);
-        data_size = record_buffer_.getSize();
-        if (data_size > 0)
-            memcpy(stream.advance(data_size), record_buffer_.getData(), data_size);
-        break;
-    }
-    default:
-        throw BagFormatException((boost::format("Unhandled version: %1%") % version_).str());
-    }
+    readMessageData(index_entry, data, data_size);
+    if (data_size > 0)
+        memcpy(stream.advance(data_size), data, data_size);
 }
 
 template<class T>
@@ -441,8 +452,8 @@ boost::shared_ptr<T> Bag::instantiateBuffer(IndexEntry const& index_entry) const
         uint32_t connection_id;
         readField(*header.getValues(), CONNECTION_FIELD_NAME, true, &connection_id);
 
-        std::map<uint32_t, ConnectionInfo*>::const_iterator connection_iter = connections_.find(connection_id);
-        if (connection_iter == connections_.end())
+        std::map<uint32_t, ConnectionInfo*>::const_iterator connection_iter = index_->connections.find(connection_id);
+        if (connection_iter == index_->connections.end())
             throw BagFormatException((boost::format("Unknown connection ID: %1%") % connection_id).str());
         ConnectionInfo* connection_info = connection_iter->second;
 
@@ -473,13 +484,13 @@ boost::shared_ptr<T> Bag::instantiateBuffer(IndexEntry const& index_entry) const
         readField(fields, LATCHING_FIELD_NAME, false, latching);
         readField(fields, CALLERID_FIELD_NAME, false, callerid);
 
-        std::map<std::string, uint32_t>::const_iterator topic_conn_id_iter = topic_connection_ids_.find(topic);
-        if (topic_conn_id_iter == topic_connection_ids_.end())
+        std::map<std::string, uint32_t>::const_iterator topic_conn_id_iter = index_->topic_connection_ids.find(topic);
+        if (topic_conn_id_iter == index_->topic_connection_ids.end())
             throw BagFormatException((boost::format("Unknown topic: %1%") % topic).str());
         uint32_t connection_id = topic_conn_id_iter->second;
 
-        std::map<uint32_t, ConnectionInfo*>::const_iterator connection_iter = connections_.find(connection_id);
-        if (connection_iter == connections_.end())
+        std::map<uint32_t, ConnectionInfo*>::const_iterator connection_iter = index_->connections.find(connection_id);
+        if (connection_iter == index_->connections.end())
             throw BagFormatException((boost::format("Unknown connection ID: %1%") % connection_id).str());
         ConnectionInfo* connection_info = connection_iter->second;
 
@@ -525,14 +536,14 @@ void Bag::doWrite(std::string const& topic, ros::Time const& time, T const& msg,
     if (!connection_header) {
         // No connection header: we'll manufacture one, and store by topic
 
-        std::map<std::string, uint32_t>::iterator topic_connection_ids_iter = topic_connection_ids_.find(topic);
-        if (topic_connection_ids_iter == topic_connection_ids_.end()) {
-            conn_id = connections_.size();
-            topic_connection_ids_[topic] = conn_id;
+        std::map<std::string, uint32_t>::iterator topic_connection_ids_iter = index_->topic_connection_ids.find(topic);
+        if (topic_connection_ids_iter == index_->topic_connection_ids.end()) {
+            conn_id = index_->connections.size();
+            index_->topic_connection_ids[topic] = conn_id;
         }
         else {
             conn_id = topic_connection_ids_iter->second;
-            connection_info = connections_[conn_id];
+            connection_info = index_->connections[conn_id];
         }
     }
     else {
@@ -545,14 +556,14 @@ void Bag::doWrite(std::string const& topic, ros::Time const& time, T const& msg,
         ros::M_string connection_header_copy(*connection_header);
         connection_header_copy["topic"] = topic;
 
-        std::map<ros::M_string, uint32_t>::iterator header_connection_ids_iter = header_connection_ids_.find(connection_header_copy);
-        if (header_connection_ids_iter == header_connection_ids_.end()) {
-            conn_id = connections_.size();
-            header_connection_ids_[connection_header_copy] = conn_id;
+        std::map<ros::M_string, uint32_t>::iterator header_connection_ids_iter = index_->header_connection_ids.find(connection_header_copy);
+        if (header_connection_ids_iter == index_->header_connection_ids.end()) {
+            conn_id = index_->connections.size();
+            index_->header_connection_ids[connection_header_copy] = conn_id;
         }
         else {
             conn_id = header_connection_ids_iter->second;
-            connection_info = connections_[conn_id];
+            connection_info = index_->connections[conn_id];
         }
     }
 
@@ -582,10 +593,11 @@ void Bag::doWrite(std::string const& topic, ros::Time const& time, T const& msg,
                 (*connection_info->header)["md5sum"]             = connection_info->md5sum;
                 (*connection_info->header)["message_definition"] = connection_info->msg_def;
             }
-            connections_[conn_id] = connection_info;
+            index_->connections[conn_id] = connection_info;
             // No need to encrypt connection records in chunks
             writeConnectionRecord(connection_info, false);
-            appendConnectionRecordToBuffer(outgoing_chunk_buffer_, connection_info);
+            if (mode_ & bagmode::Read)
+                appendConnectionRecordToBuffer(outgoing_chunk_buffer_, connection_info);
         }
 
         // Add to topic indexes
@@ -597,8 +609,8 @@ void Bag::doWrite(std::string const& topic, ros::Time const& time, T const& msg,
         std::multiset<IndexEntry>& chunk_connection_index = curr_chunk_connection_indexes_[connection_info->id];
         chunk_connection_index.insert(chunk_connection_index.end(), index_entry);
 
-        if (mode_ != BagMode::Write) {
-          std::multiset<IndexEntry>& connection_index = connection_indexes_[connection_info->id];
+        if (mode_ & bagmode::Read) {
+          std::multiset<IndexEntry>& connection_index = index_->connection_indexes[connection_info->id];
           connection_index.insert(connection_index.end(), index_entry);
         }
 
@@ -623,20 +635,17 @@ void Bag::doWrite(std::string const& topic, ros::Time const& time, T const& msg,
 
 template<class T>
 void Bag::writeMessageDataRecord(uint32_t conn_id, ros::Time const& time, T const& msg) {
-    ros::M_string header;
-    header[OP_FIELD_NAME]         = toHeaderString(&OP_MSG_DATA);
-    header[CONNECTION_FIELD_NAME] = toHeaderString(&conn_id);
-    header[TIME_FIELD_NAME]       = toHeaderString(&time);
-
-    // Assemble message in memory first, because we need to write its length
-    uint32_t msg_ser_len = ros::serialization::serializationLength(msg);
-
-    record_buffer_.setSize(msg_ser_len);
-    
-    ros::serialization::OStream s(record_buffer_.getData(), msg_ser_len);
-
-    // todo: serialize into the outgoing_chunk_buffer & remove record_buffer_
-    ros::serialization::serialize(s, msg);
+    record_header_.clear();
+    record_header_.add(CONNECTION_FIELD_NAME, &conn_id);
+    record_header_.add(OP_FIELD_NAME,         &OP_MSG_DATA);
+    record_header_.add(TIME_FIELD_NAME,       &time);
+
+    // Assemble message in memory first, because we need to write its length.  Large byte
+    // runs (e.g. uint8[] payloads) are only referenced, and go from the message to the file directly
+    record_stream_.clear();
+    ros::serialization::serialize(record_stream_, msg);
+    record_stream_.getSegments(record_segments_);
+    uint32_t msg_ser_len = record_stream_.getLength();
 
     // We do an extra seek here since writing our data record may
     // have indirectly moved our file-pointer if it was a
@@ -644,17 +653,22 @@ void Bag::writeMessageDataRecord(uint32_t conn_id, ros::Time const& time, T cons
     seek(0, std::ios::end);
     file_size_ = file_.getOffset();
 
-    writeHeader(header);
+    writeHeader(record_header_);
     writeDataLength(msg_ser_len);
-    write((char*) record_buffer_.getData(), msg_ser_len);
-    
-    // todo: use better abstraction than appendHeaderToBuffer
-    appendHeaderToBuffer(outgoing_chunk_buffer_, header);
-    appendDataLengthToBuffer(outgoing_chunk_buffer_, msg_ser_len);
-
-    uint32_t offset = outgoing_chunk_buffer_.getSize();
-    outgoing_chunk_buffer_.setSize(outgoing_chunk_buffer_.getSize() + msg_ser_len);
-    memcpy(outgoing_chunk_buffer_.getData() + offset, record_buffer_.getData(), msg_ser_len);
+    file_.writev(record_segments_.data(), record_segments_.size());
+
+    // The outgoing chunk is only ever read back when the bag can also be read from
+    if (mode_ & bagmode::Read) {
+        appendHeaderToBuffer(outgoing_chunk_buffer_, record_header_);
+        appendDataLengthToBuffer(outgoing_chunk_buffer_, msg_ser_len);
+
+        uint32_t offset = outgoing_chunk_buffer_.getSize();
+        outgoing_chunk_buffer_.setSize(outgoing_chunk_buffer_.getSize() + msg_ser_len);
+        for (ros::SerializedSegment const& segment : record_segments_) {
+            memcpy(outgoing_chunk_buffer_.getData() + offset, segment.data, segment.size);
+            offset += segment.size;
+        }
+    }
     
     // Update the current chunk time range
     if (time > curr_chunk_info_.end_time)
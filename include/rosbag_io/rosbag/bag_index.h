@@ -0,0 +1,117 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_BAG_INDEX_H
+#define ROSBAG_BAG_INDEX_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "rosbag_io/ros/header.h"
+#include "rosbag_io/rosbag/macros.h"
+#include "rosbag_io/rosbag/structures.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! The connections, chunks and message index of a bag
+/*!
+ * A bag being written owns its index.  The index of a bag opened for reading does not change once
+ * read, and is shared through the BagIndexRegistry by every Bag with the same file open.
+ */
+struct ROSBAG_STORAGE_DECL BagIndex
+{
+    BagIndex();
+    ~BagIndex();   //!< deletes the connections
+
+    std::map<std::string, uint32_t>                topic_connection_ids;
+    std::map<ros::M_string, uint32_t>              header_connection_ids;
+    std::map<uint32_t, ConnectionInfo*>            connections;
+
+    std::vector<ChunkInfo>                         chunks;
+
+    std::map<uint32_t, std::multiset<IndexEntry> > connection_indexes;
+
+    // The file header the index was read with
+    uint64_t index_data_pos;
+    uint32_t connection_count;
+    uint32_t chunk_count;
+
+private:
+    BagIndex(BagIndex const&);
+    BagIndex& operator=(BagIndex const&);
+};
+
+//! Process-wide registry of the indexes of the bags open for reading
+/*!
+ * Opening a version 2.0 bag for reading first looks for the index of the same file here, and only
+ * reads the index from the file if none is registered.  The file is identified by its canonical
+ * path, size and modification time, and its file header must still match the index.  An index
+ * is freed with the last Bag using it.
+ */
+class ROSBAG_STORAGE_DECL BagIndexRegistry
+{
+public:
+    //! The identity of a bag file
+    struct Key
+    {
+        std::string path;
+        uint64_t    size;
+        int64_t     mtime;
+
+        bool operator<(Key const& other) const;
+    };
+
+    //! Get the identity of a file, returning false if it can not be determined
+    static bool getKey(std::string const& filename, Key& key);
+
+    //! Get the index registered for a file, or NULL
+    static boost::shared_ptr<BagIndex> find(Key const& key);
+
+    //! Register the index of a file, for as long as a Bag uses it
+    static void add(Key const& key, boost::shared_ptr<BagIndex> const& index);
+
+    static void   setEnabled(bool enabled);   //!< Set whether bags opened from now on share indexes, true by default
+    static bool   isEnabled();
+    static size_t getSize();                  //!< Get the number of indexes in use
+};
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
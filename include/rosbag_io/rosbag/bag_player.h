@@ -35,7 +35,17 @@
 #ifndef ROSBAG_BAG_PLAYER_H
 #define ROSBAG_BAG_PLAYER_H
 
+#include <exception>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include <boost/bind/bind.hpp>
+
 #include "rosbag_io/rosbag/bag.h"
+#include "rosbag_io/rosbag/callback_executor.h"
+#include "rosbag_io/rosbag/playback_clock.h"
+#include "rosbag_io/rosbag/playback_scheduler.h"
 #include "rosbag_io/rosbag/view.h"
 
 namespace rosbag_io
@@ -44,11 +54,51 @@ namespace rosbag
 {
 
 
+/* The messages instantiated for one delivery, by type, so that the
+   callbacks of a topic taking the same type share a single instance */
+class SharedMessages
+{
+public:
+    template<class T>
+    boost::shared_ptr<const T> get() const {
+        for (const auto& message : messages_)
+            if (*message.first == typeid(T))
+                return boost::static_pointer_cast<const T>(message.second);
+        return boost::shared_ptr<const T>();
+    }
+
+    template<class T>
+    void put(const boost::shared_ptr<const T> &message) {
+        messages_.push_back(std::make_pair(&typeid(T), boost::shared_ptr<const void>(message)));
+    }
+
+    void clear() {
+        messages_.clear();
+    }
+
+private:
+    std::vector<std::pair<const std::type_info*, boost::shared_ptr<const void> > > messages_;
+};
+
 // A helper struct
 struct BagCallback
 {
     virtual ~BagCallback() {};
-    virtual void call(MessageInstance m) = 0;
+
+    /* Call the callback on the playback thread, with the instance in
+       shared if there is one */
+    virtual void call(const MessageInstance &m, SharedMessages &shared) = 0;
+
+    /* Read the message, and return the call to make later on another
+       thread.  Returns an empty function if the callback can only be
+       called on the playback thread. */
+    virtual boost::function<void ()> bind(const MessageInstance &m, SharedMessages &shared) = 0;
+
+    /* Like bind, for a message already read as size bytes at data.  If
+       instantiate is not set, the bytes are copied and deserialized
+       when the call is made, by each callback. */
+    virtual boost::function<void ()> bind(const MessageInstance &m, const uint8_t *data, uint32_t size,
+                                          bool instantiate, SharedMessages &shared) = 0;
 };
 
 // A helper class for the callbacks
@@ -62,11 +112,54 @@ public:
         cb_(cb)
     {}
 
-    void call(MessageInstance m) {
-        cb_(m.instantiate<T>());
+    void call(const MessageInstance &m, SharedMessages &shared) {
+        cb_(instantiate(m, shared));
+    }
+
+    boost::function<void ()> bind(const MessageInstance &m, SharedMessages &shared) {
+        return boost::bind(cb_, instantiate(m, shared));
+    }
+
+    boost::function<void ()> bind(const MessageInstance &m, const uint8_t *data, uint32_t size,
+                                  bool instantiate, SharedMessages &shared) {
+        if (!m.isType<T>())
+            return boost::bind(cb_, boost::shared_ptr<const T>());
+
+        if (instantiate) {
+            boost::shared_ptr<const T> p = shared.get<T>();
+            if (!p) {
+                p = deserialize(data, size, m.getConnectionHeader());
+                shared.put(p);
+            }
+            return boost::bind(cb_, p);
+        }
+
+        boost::shared_ptr<std::vector<uint8_t> > copy = boost::make_shared<std::vector<uint8_t> >(data, data + size);
+        return boost::bind(&BagCallbackT::call_serialized, cb_, copy, m.getConnectionHeader());
+    }
+
+    /* Deserialize a message of the type from size bytes at data */
+    static boost::shared_ptr<const T> deserialize(const uint8_t *data, uint32_t size,
+                                                  const boost::shared_ptr<ros::M_string> &connection_header) {
+        return deserializeMessage<T>(data, size, connection_header);
     }
 
 private:
+    static boost::shared_ptr<const T> instantiate(const MessageInstance &m, SharedMessages &shared) {
+        boost::shared_ptr<const T> p = shared.get<T>();
+        if (!p) {
+            p = m.instantiate<T>();
+            if (p)
+                shared.put(p);
+        }
+        return p;
+    }
+
+    static void call_serialized(const Callback &cb, const boost::shared_ptr<std::vector<uint8_t> > &data,
+                                const boost::shared_ptr<ros::M_string> &connection_header) {
+        cb(deserialize(data->data(), data->size(), connection_header));
+    }
+
     Callback cb_;
 };
 
@@ -80,14 +173,161 @@ public:
         cb_(cb)
     {}
 
-    void call(MessageInstance m) {
+    void call(const MessageInstance &m, SharedMessages &) {
         cb_(m);
     }
 
+    /* The message instance reads from the bag, which is only safe on the
+       playback thread */
+    boost::function<void ()> bind(const MessageInstance &, SharedMessages &) {
+        return boost::function<void ()>();
+    }
+
+    boost::function<void ()> bind(const MessageInstance &, const uint8_t *, uint32_t, bool, SharedMessages &) {
+        return boost::function<void ()>();
+    }
+
 private:
     Callback cb_;
 };
 
+/* A contiguous run of values, as handed to batch callbacks.  The
+   values are only valid during the call. */
+template<class T>
+class BagSpan
+{
+public:
+    BagSpan(const T *data, size_t size) :
+        data_(data), size_(size)
+    {}
+
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + size_; }
+    const T &operator[](size_t i) const { return data_[i]; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+private:
+    const T *data_;
+    size_t size_;
+};
+
+// A helper struct for the callbacks taking batches
+struct BagBatchCallback
+{
+    virtual ~BagBatchCallback() {};
+
+    /* Add a message to the batch, read as size bytes at data */
+    virtual void add(const MessageInstance &m, const uint8_t *data, uint32_t size) = 0;
+
+    /* Get the number of messages in the batch */
+    virtual size_t size() const = 0;
+
+    /* Check if the messages read from the bag when used, in which case
+       the batch is only handed over on the playback thread */
+    virtual bool reads_bag() const = 0;
+
+    /* Take the messages of the batch, and return the call that hands
+       them to the callback */
+    virtual boost::function<void ()> take() = 0;
+};
+
+// A helper class for the callbacks taking batches
+template<class T>
+class BagBatchCallbackT : public BagBatchCallback
+{
+public:
+    typedef boost::shared_ptr<const T> MessagePtr;
+    typedef boost::function<void (const BagSpan<MessagePtr>&)> Callback;
+
+    BagBatchCallbackT(Callback cb) :
+        cb_(cb)
+    {}
+
+    void add(const MessageInstance &m, const uint8_t *data, uint32_t size) {
+        if (m.isType<T>())
+            batch_.push_back(BagCallbackT<T>::deserialize(data, size, m.getConnectionHeader()));
+        else
+            batch_.push_back(MessagePtr());
+    }
+
+    size_t size() const {
+        return batch_.size();
+    }
+
+    bool reads_bag() const {
+        return false;
+    }
+
+    boost::function<void ()> take() {
+        boost::shared_ptr<std::vector<MessagePtr> > batch = boost::make_shared<std::vector<MessagePtr> >();
+        batch->swap(batch_);
+        batch_.reserve(batch->size());
+        return boost::bind(&BagBatchCallbackT::call, cb_, batch);
+    }
+
+private:
+    static void call(const Callback &cb, const boost::shared_ptr<std::vector<MessagePtr> > &batch) {
+        cb(BagSpan<MessagePtr>(batch->data(), batch->size()));
+    }
+
+    Callback cb_;
+    std::vector<MessagePtr> batch_;
+};
+
+template<>
+class BagBatchCallbackT<MessageInstance> : public BagBatchCallback
+{
+public:
+    typedef boost::function<void (const BagSpan<MessageInstance>&)> Callback;
+
+    BagBatchCallbackT(Callback cb) :
+        cb_(cb)
+    {}
+
+    /* The message instances read from the bag when used */
+    void add(const MessageInstance &m, const uint8_t *, uint32_t) {
+        batch_.push_back(m);
+    }
+
+    size_t size() const {
+        return batch_.size();
+    }
+
+    bool reads_bag() const {
+        return true;
+    }
+
+    boost::function<void ()> take() {
+        boost::shared_ptr<std::vector<MessageInstance> > batch = boost::make_shared<std::vector<MessageInstance> >();
+        batch->swap(batch_);
+        batch_.reserve(batch->size());
+        return boost::bind(&BagBatchCallbackT::call, cb_, batch);
+    }
+
+private:
+    static void call(const Callback &cb, const boost::shared_ptr<std::vector<MessageInstance> > &batch) {
+        cb(BagSpan<MessageInstance>(batch->data(), batch->size()));
+    }
+
+    Callback cb_;
+    std::vector<MessageInstance> batch_;
+};
+
+/* The throughput of an unpaced playback */
+struct ROSBAG_STORAGE_DECL PlaybackThroughput
+{
+    PlaybackThroughput() : messages(0), bytes(0), batches(0), seconds(0.0) {}
+
+    double get_messages_per_second() const;
+    double get_bytes_per_second() const;
+
+    uint64_t messages;   /* messages delivered */
+    uint64_t bytes;      /* serialized bytes of the messages delivered */
+    uint64_t batches;    /* calls made to batch callbacks */
+    double seconds;      /* wall time from the start of playback until the last callback returned */
+};
+
 
 /* A class for playing back bag files at an API level. It supports
    relatime, as well as accelerated and slowed playback. */
@@ -97,12 +337,31 @@ public:
   /* Constructor expecting the filename of a bag */
   BagPlayer(const std::string &filename);
 
-  /* Register a callback for a specific topic and type */
+  /* Play another bag along with the first one, such as the recording
+   * of another sensor of the same drive.  Its messages are played at
+   * their recorded time plus offset, merged in time with the messages
+   * of the other bags; MessageInstance::getTime() still returns the
+   * recorded time.  The start and end times grow to cover the bag.
+   * When several bags are played, each is read ahead on a thread of
+   * its own, by the read-ahead horizon or 100 ms if none is set. */
+  void add_bag(const std::string &filename, const ros::Duration &offset = ros::Duration(0));
+
+  /* Register a callback for a specific topic and type.  A topic can
+   * have several callbacks, called in the order they were registered;
+   * callbacks taking the same type share a single instance of each
+   * message. */
   template<class T>
   void register_callback(const std::string &topic,
                          typename BagCallbackT<T>::Callback f);
 
-  /* Unregister a callback for a topic already registered */
+  /* Register a callback taking the messages of a topic in batches.
+   * Batch callbacks are only called by start_play_unpaced; a topic can
+   * have several. */
+  template<class T>
+  void register_batch_callback(const std::string &topic,
+                               typename BagBatchCallbackT<T>::Callback f);
+
+  /* Unregister the callbacks for a topic already registered */
   void unregister_callback(const std::string &topic);
 
   /* Set the time in the bag to start.  
@@ -114,16 +373,105 @@ public:
   void set_end(const ros::Time &end);
 
   /* Set the speed to playback.  1.0 is the default. 
-   * 2.0 would be twice as fast, 0.5 is half realtime.  */
+   * 2.0 would be twice as fast, 0.5 is half realtime.
+   * Can be changed during playback.  */
   void set_playback_speed(double scale);
 
+  /* The transport controls below can be called from any thread while
+   * start_play runs.  Messages already queued for a callback group are
+   * still delivered after a seek or a stop. */
+
+  /* Hold playback before the next message, until resume */
+  void pause();
+
+  /* Continue playback from where it was paused */
+  void resume();
+
+  /* Check if playback is paused */
+  bool is_paused();
+
+  /* While paused, play the next message */
+  void step();
+
+  /* Continue playback from the first message at or after time.  The
+   * position is found in the index, whatever the distance. */
+  void seek(const ros::Time &time);
+
+  /* Start over from the start time when the end is reached */
+  void set_loop(bool loop);
+
+  /* Make start_play return before the end.  A message waiting for room
+   * in a full callback group queue is dropped. */
+  void stop();
+
+  /* Keep up to size bytes of decompressed chunks, so that loops and
+   * seeks back to recent positions do not decompress them again.  0,
+   * the default, only keeps the current chunk. */
+  void set_chunk_cache_size(uint64_t size);
+
+  /* Run the callbacks of a topic on the thread of a callback group,
+   * rather than on the playback thread, so that slow callbacks do not
+   * delay the other topics.  Topics of the same group share a thread,
+   * and are called in playback order.  Up to queue_size messages wait
+   * for the thread; when the queue is full, the policy either blocks
+   * playback or drops a message.  The settings of the last call for a
+   * group apply.  Callbacks taking a MessageInstance always run on the
+   * playback thread. */
+  void set_callback_group(const std::string &topic, const std::string &group,
+                          uint32_t queue_size = 100,
+                          OverflowPolicy policy = overflow::Block);
+
+  /* Get the queue counters of each callback group, as of the end of
+     the last playback */
+  std::map<std::string, CallbackQueueStats> get_queue_stats() const;
+
+  /* Read messages ahead of playback on a thread of their own, up to
+   * horizon (in bag time) ahead of the message being played, so that
+   * chunk decompression does not delay delivery.  If instantiate is
+   * set the messages are also deserialized ahead; otherwise they are
+   * deserialized when delivered, on the thread of their callback.
+   * The reader thread has a file handle of its own; callbacks taking a
+   * MessageInstance still read from the bag when called.  A zero
+   * horizon, the default, disables read-ahead.  Read-ahead needs a
+   * version 2.0 bag, and is ignored for older bags. */
+  void set_read_ahead(const ros::Duration &horizon, bool instantiate = true);
+
+  /* Let a clock decide when messages are due in start_play, instead of
+   * the wall clock and the playback speed.  A SimulatedClock drives
+   * ros::Time at any rate, a LockStepClock follows the ticks of a
+   * simulator; the playback speed does not apply then.  An empty
+   * clock, the default, paces on the wall clock. */
+  void set_clock(const boost::shared_ptr<PlaybackClock> &clock);
+
+  /* Set how long before each message the player stops sleeping and
+   * spins on the clock.  Longer tails are more accurate, and use more
+   * CPU.  100 us is the default. */
+  void set_spin_tail(const ros::WallDuration &tail);
+
   /* Start playback of the bag file using the parameters previously
      set */
   void start_play();
   
+  /* Play every message between the start and end times as fast as
+   * possible, ignoring the playback speed and the transport controls
+   * other than stop.  A reader thread reads and deserializes messages
+   * ahead of the callbacks, which are called on the calling thread (or
+   * the thread of their callback group) in the order of the bag for
+   * each topic.  Batch callbacks get up to batch_size messages at a
+   * time; messages of other topics may be delivered while a batch
+   * fills.  Older bags are read on the calling thread instead, without
+   * the reader thread. */
+  void start_play_unpaced(uint32_t batch_size = 256);
+
+  /* Get the throughput of the last unpaced playback */
+  const PlaybackThroughput &get_throughput() const;
+
   /* Get the current time of the playback */
   ros::Time get_time();
 
+  /* Get how late messages were delivered during the last playback */
+  const LatenessHistogram &get_lateness() const;
+
   // Destructor
   virtual ~BagPlayer();
   
@@ -132,20 +480,109 @@ public:
   Bag bag;
   
 private:
-    ros::Time real_time(const ros::Time &msg_time);
+    class ReadAhead;
+    class Source;
+
+    int64_t deadline(const ros::Time &msg_time) const;
+    ros::Time bag_time(int64_t now) const;
+    void anchor(const ros::Time &time);
+    bool wait_for(const ros::Time &msg_time);
+
+    /* A callback of a connection, with the thread to call it on */
+    struct Subscriber
+    {
+        BagCallback *cb;
+        CallbackExecutor *executor;
+    };
+
+    /* A batch callback, with the thread to hand its batches to */
+    struct BatchSubscriber
+    {
+        BagBatchCallback *cb;
+        CallbackExecutor *executor;
+        uint64_t bytes;   /* serialized bytes of the current batch */
+    };
+
+    /* The callbacks of a connection, resolved once before playback */
+    struct Dispatch
+    {
+        std::vector<Subscriber> subscribers;
+        std::vector<size_t> batches;   /* indexes of the batch subscribers */
+    };
+
+    /* A message of the view, with the callbacks to deliver it to */
+    struct PendingMessage
+    {
+        PendingMessage(const MessageInstance &m, const Dispatch *d) : message(m), dispatch(d) {}
+
+        MessageInstance message;
+        const Dispatch *dispatch;
+        std::vector<boost::function<void ()> > calls;   /* bound calls of the subscribers, if the message was read ahead */
+    };
 
-    std::map<std::string, boost::shared_ptr<BagCallback> > cbs_;
+    void deliver(PendingMessage &pending, SharedMessages &shared);
+
+    void build_dispatch(View &view, const std::map<std::string, CallbackExecutor*> &topic_executors,
+                        std::vector<Dispatch> &dispatch, std::vector<BatchSubscriber> &batches);
+    void open_sources(const std::vector<std::string> &topics,
+                      const std::map<std::string, CallbackExecutor*> &topic_executors,
+                      bool chunk_readers, std::vector<boost::shared_ptr<Source> > &sources,
+                      std::vector<BatchSubscriber> &batches);
+
+    typedef std::map<std::string, boost::shared_ptr<CallbackExecutor> > Executors;
+    void start_executors(Executors &executors, std::map<std::string, CallbackExecutor*> &topic_executors);
+    void drain_executors(const Executors &executors, std::exception_ptr &error);
+
+    struct CallbackGroup
+    {
+        uint32_t queue_size;
+        OverflowPolicy policy;
+    };
+
+    std::vector<boost::shared_ptr<Bag> > extra_bags_;   /* bags added after the first one */
+    std::vector<ros::Duration> extra_offsets_;
+    std::map<std::string, std::vector<boost::shared_ptr<BagCallback> > > cbs_;
+    std::map<std::string, std::vector<boost::shared_ptr<BagBatchCallback> > > batch_cbs_;
+    std::map<std::string, std::string> topic_groups_;
+    std::map<std::string, CallbackGroup> groups_;
+    std::map<std::string, CallbackQueueStats> queue_stats_;
     ros::Time bag_start_;
     ros::Time bag_end_;
     ros::Time last_message_time_;
     double playback_speed_;
-    ros::Time play_start_;
+    PlaybackScheduler scheduler_;
+    boost::shared_ptr<PlaybackClock> clock_;
+    ros::Duration read_ahead_;
+    bool read_ahead_instantiate_;
+    uint64_t chunk_cache_size_;
+    PlaybackThroughput throughput_;
+
+    /* The transport state, shared with the controlling threads */
+    boost::mutex control_mutex_;
+    boost::condition_variable control_changed_;
+    bool paused_;
+    bool stop_requested_;
+    bool seek_requested_;
+    ros::Time seek_time_;
+    uint32_t steps_;
+    bool loop_;
+    std::vector<CallbackExecutor*> running_executors_;  /* executors of the current playback, for stop */
+    ros::Time paused_at_;    /* bag time at which playback is paused */
+    ros::Time clock_time_;   /* bag time the clock was last brought to */
+    ros::Time anchor_time_;  /* bag time played at anchor_wall_ */
+    int64_t anchor_wall_;
 };
 
 template<class T>
 void BagPlayer::register_callback(const std::string &topic,
         typename BagCallbackT<T>::Callback cb) {
-    cbs_[topic] = boost::make_shared<BagCallbackT<T> >(cb);
+    cbs_[topic].push_back(boost::make_shared<BagCallbackT<T> >(cb));
+}
+
+template<class T>
+void BagPlayer::register_batch_callback(const std::string &topic,
+        typename BagBatchCallbackT<T>::Callback cb) {
+    batch_cbs_[topic].push_back(boost::make_shared<BagBatchCallbackT<T> >(cb));
 }
 
 }
@@ -0,0 +1,271 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_BAG_SERVICE_H
+#define ROSBAG_BAG_SERVICE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "rosbag_io/ros/header.h"
+#include "rosbag_io/ros/serialization.h"
+#include "rosbag_io/ros/time.h"
+#include "rosbag_io/rosbag/bag.h"
+#include "rosbag_io/rosbag/buffer.h"
+#include "rosbag_io/rosbag/macros.h"
+#include "rosbag_io/rosbag/shared_chunk_cache.h"
+#include "rosbag_io/rosbag/structures.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! Serves the messages of bags to the processes of the host over a Unix domain socket
+/*!
+ * The server opens each bag once, on the first query for it, and keeps it open with its index, so
+ * queries from short-lived processes neither read the index nor open the bag themselves.  A query
+ * names a bag, topics and a time range, and is answered chunk by chunk on a thread of its own.
+ *
+ * With a SharedChunkCache, the server decompresses each chunk into the cache, unless it is there
+ * already, and the client copies it from the cache instead of receiving its messages through the
+ * socket.  Without one, or when the chunk has been evicted before the client found it, the
+ * payloads of the messages are sent through the socket.
+ */
+class ROSBAG_STORAGE_DECL BagServer
+{
+public:
+    //! Listen on socket_path, replacing any socket there
+    /*!
+     * Can throw BagIOException
+     */
+    explicit BagServer(std::string const& socket_path, boost::shared_ptr<SharedChunkCache> const& cache = boost::shared_ptr<SharedChunkCache>());
+    ~BagServer();
+
+    //! Stop listening and abort the queries being served, waiting for them to finish
+    void stop();
+
+    std::string getSocketPath()  const;
+    size_t      getBagCount()    const;   //!< Get the number of bags kept open
+    uint64_t    getQueryCount()  const;   //!< Get the number of queries served or being served
+
+    //! Close the bags no query is being served from
+    void closeBags();
+
+private:
+    BagServer(BagServer const&);
+    BagServer& operator=(BagServer const&);
+
+    void accept();
+    void serve(int fd);
+    boost::shared_ptr<Bag> getBag(std::string const& filename);
+
+private:
+    std::string                                     socket_path_;
+    boost::shared_ptr<SharedChunkCache>             cache_;
+    int                                             listen_fd_;
+    boost::thread                                   accept_thread_;
+
+    mutable boost::mutex                            mutex_;
+    boost::condition_variable                       served_;
+    bool                                            stopping_;
+    std::map<std::string, boost::shared_ptr<Bag> >  bags_;
+    std::set<int>                                   clients_;       //!< sockets of the queries being served
+    uint64_t                                        query_count_;
+};
+
+//! Connects to a BagServer on behalf of the RemoteViews of a process
+class ROSBAG_STORAGE_DECL BagClient
+{
+public:
+    explicit BagClient(std::string const& socket_path);
+
+    std::string getSocketPath() const;
+
+    //! Get the shared chunk cache called name, opening it on first use
+    /*!
+     * The cache is never created: a server only names caches it has open.
+     *
+     * Can throw BagException, if the cache has been removed since
+     */
+    boost::shared_ptr<SharedChunkCache> getCache(std::string const& name);
+
+private:
+    std::string                                                  socket_path_;
+    boost::mutex                                                 mutex_;
+    std::map<std::string, boost::shared_ptr<SharedChunkCache> >  caches_;
+};
+
+//! A message received from a BagServer
+class ROSBAG_STORAGE_DECL RemoteMessage
+{
+public:
+    RemoteMessage(ConnectionInfo const* connection_info, ros::Time const& time,
+                  boost::shared_ptr<Buffer const> const& buffer, uint8_t const* data, uint32_t data_size);
+
+    ros::Time   const& getTime()              const;
+    std::string const& getTopic()             const;
+    std::string const& getDataType()          const;
+    std::string const& getMD5Sum()            const;
+    std::string const& getMessageDefinition() const;
+    ConnectionInfo const* getConnectionInfo() const;
+    boost::shared_ptr<ros::M_string> getConnectionHeader() const;
+
+    uint8_t const* getData() const;   //!< Get the serialized message, valid as long as the message
+    uint32_t       size()    const;   //!< Get the size of the serialized message
+
+    //! Test whether the message is of the template type
+    template<class T>
+    bool isType() const;
+
+    //! Deserialize the message, returning a NULL pointer if it is not of the template type
+    template<class T>
+    boost::shared_ptr<T> instantiate() const;
+
+private:
+    ConnectionInfo const*           connection_info_;
+    ros::Time                       time_;
+    boost::shared_ptr<Buffer const> buffer_;   //!< holds the data
+    uint8_t const*                  data_;
+    uint32_t                        data_size_;
+};
+
+//! The messages of a bag on topics and in a time range, queried from a BagServer
+/*!
+ * Like a View, but served by another process.  The messages come in time order, a chunk at a time:
+ * the server only reads a chunk once the client has iterated over the previous one.  The view can
+ * be iterated over only once.
+ */
+class ROSBAG_STORAGE_DECL RemoteView
+{
+public:
+    //! A single-pass iterator over the messages of a RemoteView
+    class ROSBAG_STORAGE_DECL iterator : public boost::iterator_facade<iterator,
+                                                   RemoteMessage const,
+                                                   boost::single_pass_traversal_tag>
+    {
+    public:
+        iterator();
+
+    private:
+        friend class RemoteView;
+        friend class boost::iterator_core_access;
+
+        explicit iterator(RemoteView* view);
+
+        bool equal(iterator const& other) const;
+        void increment();
+        RemoteMessage const& dereference() const;
+
+    private:
+        RemoteView* view_;
+    };
+
+    //! Query the messages of filename, as opened by the server
+    /*!
+     * \param client     The client connecting to the server
+     * \param filename   The bag, a path the server can open
+     * \param topics     The topics of the messages, or all if empty
+     * \param start_time The beginning of the time range of the messages
+     * \param end_time   The end of the time range of the messages
+     *
+     * Can throw BagException, BagIOException
+     */
+    RemoteView(BagClient& client, std::string const& filename, std::vector<std::string> const& topics = std::vector<std::string>(),
+               ros::Time const& start_time = ros::TIME_MIN, ros::Time const& end_time = ros::TIME_MAX);
+    ~RemoteView();
+
+    iterator begin();
+    iterator end();
+
+    uint64_t size() const;                //!< Get the number of messages queried
+    uint32_t getSharedChunks() const;     //!< Get the number of chunks copied from the shared chunk cache so far
+    uint32_t getSentChunks()   const;     //!< Get the number of chunks whose messages were sent through the socket so far
+
+private:
+    RemoteView(RemoteView const&);
+    RemoteView& operator=(RemoteView const&);
+
+    bool next();
+    void readChunk();
+
+    void     receive(void* data, size_t size);
+    uint32_t receiveUInt32();
+    uint64_t receiveUInt64();
+    std::string receiveString();
+    void     send(void const* data, size_t size);
+
+private:
+    BagClient*                                          client_;
+    int                                                 fd_;
+    std::vector<uint8_t>                                receive_buffer_;
+    size_t                                              receive_pos_;
+    size_t                                              receive_end_;
+
+    uint64_t                                            file_id_;
+    boost::shared_ptr<SharedChunkCache>                 cache_;
+    std::map<uint32_t, boost::shared_ptr<ConnectionInfo> > connections_;
+    uint64_t                                            size_;
+    uint32_t                                            shared_chunks_;
+    uint32_t                                            sent_chunks_;
+
+    std::vector<RemoteMessage>                          messages_;   //!< the messages of the current chunk
+    size_t                                              current_;
+    bool                                                done_;
+};
+
+template<class T>
+bool RemoteMessage::isType() const {
+    char const* md5sum = ros::message_traits::MD5Sum<T>::value();
+    return md5sum == std::string("*") || md5sum == getMD5Sum();
+}
+
+template<class T>
+boost::shared_ptr<T> RemoteMessage::instantiate() const {
+    if (!isType<T>())
+        return boost::shared_ptr<T>();
+
+    return deserializeMessage<T>(data_, data_size_, getConnectionHeader());
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -0,0 +1,139 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_BULK_EXTRACTOR_H
+#define ROSBAG_BULK_EXTRACTOR_H
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "rosbag_io/ros/time.h"
+#include "rosbag_io/rosbag/macros.h"
+#include "rosbag_io/rosbag/structures.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+class Bag;
+class Buffer;
+class View;
+
+//! Copies the serialized payloads of the messages of a view into one contiguous buffer
+/*!
+ * Payload i occupies the bytes [getOffsets()[i], getOffsets()[i + 1]) of the buffer, in the order
+ * of the view, and getTimes()[i] is its receipt time.  To extract a topic in a time range, use a
+ * view with a TopicQuery and that range.
+ *
+ * Construction reads the index of the view and the header of each of its chunks, which bounds
+ * the size of the payloads.  Extraction then decompresses each chunk once, in parallel with one
+ * ChunkReader per thread, and copies each payload exactly once, straight into its final place.
+ */
+class ROSBAG_STORAGE_DECL BulkExtractor
+{
+public:
+    //! Read the index of a view
+    /*!
+     * \param view         The messages to extract.  Its bags must be version 2.0 bags opened for reading.
+     * \param thread_count The number of decompression threads, 0 to use one per hardware thread
+     *
+     * Can throw BagException, BagFormatException, BagIOException
+     */
+    explicit BulkExtractor(View& view, uint32_t thread_count = 0);
+    ~BulkExtractor();
+
+    uint32_t getMessageCount() const;   //!< Get the number of messages to extract
+    uint64_t getMaxDataSize()  const;   //!< Get an upper bound on the total payload size: the decompressed size of the chunks involved
+
+    //! Extract the payloads into a buffer owned by the caller
+    /*!
+     * Returns the number of bytes used.  The buffer is large enough if it holds getMaxDataSize() bytes.
+     *
+     * Can throw BagException if the buffer is too small, BagFormatException, BagIOException
+     */
+    uint64_t extract(uint8_t* buffer, uint64_t capacity);
+
+    //! Extract the payloads into a buffer allocated by the extractor
+    /*!
+     * The buffer reserves getMaxDataSize() bytes of address space, backed by huge pages where the
+     * system supports them; only the pages actually used are committed.  It lives as long as the
+     * extractor.  Returns the number of bytes used.
+     *
+     * Can throw BagException, BagFormatException, BagIOException
+     */
+    uint64_t extract();
+
+    uint8_t const*                getData()     const;   //!< Get the buffer of the last extraction
+    uint64_t                      getDataSize() const;   //!< Get the number of bytes used by the last extraction
+    std::vector<uint64_t> const&  getOffsets()  const;   //!< Get the offset of each payload, plus the end of the last one
+    std::vector<ros::Time> const& getTimes()    const;   //!< Get the receipt time of each message
+
+private:
+    BulkExtractor(BulkExtractor const&);
+    BulkExtractor& operator=(BulkExtractor const&);
+
+    //! The messages of the view stored in one chunk
+    struct Chunk
+    {
+        Bag const*              bag;
+        uint64_t                chunk_pos;
+        std::vector<uint32_t>   messages;       //!< index of each message in the view, ascending
+        std::vector<IndexEntry> entries;
+
+        boost::shared_ptr<Buffer>   buffer;     //!< decompressed chunk, kept until its payloads are copied
+        std::vector<uint8_t const*> data;       //!< location of each payload in buffer
+        size_t                      copied;     //!< number of payloads copied into place
+    };
+
+    void freeBuffer();
+
+private:
+    uint32_t                thread_count_;
+    std::vector<Chunk>      chunks_;
+    uint64_t                max_data_size_;
+
+    std::vector<uint64_t>   offsets_;
+    std::vector<ros::Time>  times_;
+
+    uint8_t*                data_;
+    uint64_t                data_size_;
+
+    uint8_t*                allocation_;        //!< buffer allocated by extract()
+    uint64_t                allocation_size_;
+};
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
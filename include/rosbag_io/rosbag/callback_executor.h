@@ -0,0 +1,135 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_CALLBACK_EXECUTOR_H
+#define ROSBAG_CALLBACK_EXECUTOR_H
+
+#include <deque>
+#include <exception>
+
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "rosbag_io/rosbag/macros.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+namespace overflow
+{
+    //! What to do with a message when its callback queue is full
+    enum OverflowPolicy
+    {
+        Block      = 0,   //!< wait for the queue to make room
+        DropOldest = 1,   //!< discard the oldest queued message
+        DropNewest = 2    //!< discard the new message
+    };
+}
+typedef overflow::OverflowPolicy OverflowPolicy;
+
+//! Counters of a callback queue
+struct ROSBAG_STORAGE_DECL CallbackQueueStats
+{
+    CallbackQueueStats() : enqueued(0), executed(0), dropped(0), blocked(0), max_depth(0) { }
+
+    uint64_t enqueued;    //!< tasks accepted into the queue
+    uint64_t executed;    //!< tasks run to completion
+    uint64_t dropped;     //!< tasks discarded by the overflow policy
+    uint64_t blocked;     //!< pushes that had to wait for room
+    uint32_t max_depth;   //!< largest number of tasks waiting at once
+};
+
+//! Runs tasks in order on a thread of its own, from a bounded queue
+/*!
+ * The first exception thrown by a task is kept and rethrown by drain(); later tasks still run.
+ */
+class ROSBAG_STORAGE_DECL CallbackExecutor
+{
+public:
+    typedef boost::function<void ()> Task;
+
+    CallbackExecutor(uint32_t capacity, OverflowPolicy policy);
+    ~CallbackExecutor();   //!< runs the queued tasks, then stops the thread
+
+    //! Queue a task, applying the overflow policy if the queue is full
+    /*!
+     * Returns false if the task was dropped.
+     */
+    bool push(Task const& task);
+
+    //! Stop waiting for room in the queue
+    /*!
+     * Pushes blocked on a full queue, and later pushes that find it full, drop their task whatever
+     * the policy.  The tasks already queued still run.
+     */
+    void cancel();
+
+    //! Wait until every queued task has run
+    /*!
+     * Can rethrow the first exception thrown by a task since the last drain
+     */
+    void drain();
+
+    CallbackQueueStats getStats() const;
+
+private:
+    CallbackExecutor(CallbackExecutor const&);
+    CallbackExecutor& operator=(CallbackExecutor const&);
+
+    void run();
+
+private:
+    uint32_t       capacity_;
+    OverflowPolicy policy_;
+
+    mutable boost::mutex      mutex_;
+    boost::condition_variable not_empty_;
+    boost::condition_variable not_full_;
+    boost::condition_variable idle_;
+    std::deque<Task>          queue_;
+    bool                      busy_;
+    bool                      stopping_;
+    bool                      cancelled_;
+    CallbackQueueStats        stats_;
+    std::exception_ptr        error_;
+
+    boost::thread             thread_;
+};
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -0,0 +1,109 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_CHUNK_CACHE_H
+#define ROSBAG_CHUNK_CACHE_H
+
+#include <list>
+#include <map>
+
+#include <boost/shared_ptr.hpp>
+
+#include "rosbag_io/rosbag/buffer.h"
+#include "rosbag_io/rosbag/macros.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! Keeps recently decompressed chunks, up to a number of bytes
+/*!
+ * Chunks move in and out of the cache by swapping buffers, so caching a chunk never copies it.  The
+ * least recently used chunks are evicted first.  A capacity of 0, the default, caches nothing.
+ */
+class ROSBAG_STORAGE_DECL ChunkCache
+{
+public:
+    explicit ChunkCache(uint64_t capacity = 0);
+
+    void     setCapacity(uint64_t capacity);   //!< Set the number of bytes of decompressed chunks to keep, evicting as needed
+    uint64_t getCapacity() const;              //!< Get the number of bytes of decompressed chunks to keep
+    uint64_t getSize()     const;              //!< Get the number of bytes of decompressed chunks kept
+
+    uint64_t getHits()   const;                //!< Get the number of chunks found by take()
+    uint64_t getMisses() const;                //!< Get the number of chunks not found by take()
+
+    //! Keep the chunk at chunk_pos, decompressed in buffer
+    /*!
+     * The contents of buffer are swapped into the cache; buffer is left with a spare buffer to reuse.
+     * Nothing is kept if the chunk is larger than the capacity.
+     */
+    void put(uint64_t chunk_pos, Buffer& buffer);
+
+    //! Swap the chunk at chunk_pos into buffer, if it is kept, and remove it from the cache
+    bool take(uint64_t chunk_pos, Buffer& buffer);
+
+    //! Remove every chunk
+    void clear();
+
+    void swap(ChunkCache& other);
+
+private:
+    typedef boost::shared_ptr<Buffer> BufferPtr;
+
+    struct Entry
+    {
+        uint64_t  chunk_pos;
+        BufferPtr buffer;
+    };
+
+    void evict(uint64_t size);
+
+private:
+    uint64_t                                          capacity_;
+    uint64_t                                          size_;
+    uint64_t                                          hits_;
+    uint64_t                                          misses_;
+    std::list<Entry>                                  entries_;   //!< most recently used first
+    std::map<uint64_t, std::list<Entry>::iterator>    index_;
+    BufferPtr                                         spare_;     //!< buffer of the last evicted or taken chunk, to reuse
+};
+
+inline void swap(ChunkCache& a, ChunkCache& b) {
+    a.swap(b);
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -0,0 +1,109 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_CHUNK_LOADER_H
+#define ROSBAG_CHUNK_LOADER_H
+
+#include <deque>
+#include <exception>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "rosbag_io/rosbag/buffer.h"
+#include "rosbag_io/rosbag/macros.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+class Bag;
+
+//! Reads and decompresses chunks on a pool of threads, for callers that must not block
+/*!
+ * Each thread reads through ChunkReaders of its own, so loads of different chunks proceed in
+ * parallel.  A loaded chunk is handed out as a shared Buffer of its decompressed records, and stays
+ * available to find() and later loads for as long as anybody holds it: concurrent queries of the
+ * same chunk decompress it once.  Loads of a chunk already being loaded wait for that load.
+ *
+ * Only version 2.0 bags opened for reading are supported, and they must outlive the loader.
+ */
+class ROSBAG_STORAGE_DECL ChunkLoader
+{
+public:
+    //! Called on a thread of the loader with the chunk, or with the error that prevented its load
+    typedef boost::function<void (boost::shared_ptr<Buffer> const& chunk, std::exception_ptr const& error)> Callback;
+
+    //! Start the threads, 0 to use one per hardware thread
+    explicit ChunkLoader(uint32_t thread_count = 0);
+    ~ChunkLoader();   //!< completes the queued loads, then stops the threads
+
+    //! Load the chunk at chunk_pos of a bag, and call callback with it
+    void load(Bag const& bag, uint64_t chunk_pos, Callback const& callback);
+
+    //! Get a loaded chunk that is still held by somebody, or NULL
+    boost::shared_ptr<Buffer> find(Bag const& bag, uint64_t chunk_pos);
+
+    uint64_t getLoads() const;   //!< Get the number of chunks decompressed so far
+
+private:
+    ChunkLoader(ChunkLoader const&);
+    ChunkLoader& operator=(ChunkLoader const&);
+
+    typedef std::pair<Bag const*, uint64_t> ChunkKey;
+
+    void run();
+
+private:
+    mutable boost::mutex                             mutex_;
+    boost::condition_variable                        not_empty_;
+    std::deque<ChunkKey>                             queue_;
+    std::map<ChunkKey, std::vector<Callback> >       pending_;   //!< the callbacks of each queued or running load
+    std::map<ChunkKey, boost::weak_ptr<Buffer> >     loaded_;
+    bool                                             stopping_;
+    uint64_t                                         loads_;
+
+    boost::thread_group                              threads_;
+};
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -0,0 +1,136 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_CHUNK_READER_H
+#define ROSBAG_CHUNK_READER_H
+
+#include "rosbag_io/rosbag/buffer.h"
+#include "rosbag_io/rosbag/chunk_cache.h"
+#include "rosbag_io/rosbag/chunked_file.h"
+#include "rosbag_io/rosbag/macros.h"
+#include "rosbag_io/rosbag/structures.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+class Bag;
+
+//! Reads and decompresses the chunks of an open bag through its own file handle
+/*!
+ * The Bag reads every message through a single file and decompression buffer.  A ChunkReader opens
+ * the bag file again, so that each thread can decompress chunks with its own reader while the Bag
+ * only provides the index.  Only version 2.0 bags opened for reading are supported.
+ */
+class ROSBAG_STORAGE_DECL ChunkReader
+{
+public:
+    //! Open a reader on the file of a bag
+    /*!
+     * Can throw BagException
+     */
+    explicit ChunkReader(Bag const& bag);
+
+    //! Read the header of the chunk at chunk_pos, leaving the file positioned at its data
+    /*!
+     * Can throw BagFormatException, BagIOException
+     */
+    void readChunkHeader(uint64_t chunk_pos, ChunkHeader& chunk_header);
+
+    //! Read the records of the chunk at chunk_pos as stored, decrypted but still compressed
+    /*!
+     * Does not change the current chunk.
+     *
+     * Can throw BagFormatException, BagIOException
+     */
+    void readRawChunk(uint64_t chunk_pos, ChunkHeader& chunk_header, Buffer& raw);
+
+    //! Decompress the records read by readRawChunk into chunk
+    /*!
+     * raw is left unspecified.  Does not change the current chunk, nor read the file, so one thread
+     * can read chunks while another decompresses them.
+     *
+     * Can throw BagFormatException
+     */
+    void decompressChunk(ChunkHeader const& chunk_header, Buffer& raw, Buffer& chunk);
+
+    //! Decompress the chunk at chunk_pos, unless it is the current chunk already
+    /*!
+     * Can throw BagFormatException, BagIOException
+     */
+    void readChunk(uint64_t chunk_pos);
+
+    //! Locate the data of a message, decompressing its chunk if needed
+    /*!
+     * data points into the reader's buffer, and is valid until another chunk is read.
+     *
+     * Can throw BagFormatException, BagIOException
+     */
+    void readMessageData(IndexEntry const& index_entry, uint8_t const*& data, uint32_t& data_size);
+
+    //! Locate the data of the message at offset in the decompressed records of a chunk
+    /*!
+     * Can throw BagFormatException
+     */
+    static void locateMessageData(uint8_t const* chunk, uint32_t chunk_size, uint32_t offset, uint8_t const*& data, uint32_t& data_size);
+
+    uint64_t getChunkPos() const;   //!< Get the position of the current chunk
+    Buffer&  getChunk();            //!< Get the decompressed records of the current chunk
+
+    //! Swap the current chunk with buffer, leaving the reader without a current chunk
+    /*!
+     * The chunk can then outlive later reads, and the reader reuses the memory of buffer.
+     */
+    void takeChunk(Buffer& buffer);
+
+    void     setCacheSize(uint64_t size);   //!< Set the bytes of decompressed chunks to keep besides the current one, 0 by default
+    uint64_t getCacheSize() const;          //!< Get the bytes of decompressed chunks to keep besides the current one
+
+private:
+    ChunkReader(ChunkReader const&);
+    ChunkReader& operator=(ChunkReader const&);
+
+private:
+    Bag const*  bag_;
+    ChunkedFile file_;
+    Buffer      header_buffer_;
+    Buffer      chunk_buffer_;
+    Buffer      decompress_buffer_;
+    uint64_t    chunk_pos_;
+    ChunkCache  cache_;
+};
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -75,6 +75,7 @@ public:
     // File I/O
     void        write(std::string const& s);
     void        write(void* ptr, size_t size);                          //!< write size bytes from ptr to the file
+    void        writev(ros::SerializedSegment const* segments, size_t count); //!< write count segments to the file, in order
     void        read(void* ptr, size_t size);                           //!< read size bytes from the file into ptr
     std::string getline();
     bool        truncate(uint64_t length);
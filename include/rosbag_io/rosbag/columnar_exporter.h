@@ -0,0 +1,100 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_COLUMNAR_EXPORTER_H
+#define ROSBAG_COLUMNAR_EXPORTER_H
+
+#include <string>
+
+#include "rosbag_io/rosbag/macros.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+class View;
+
+//! Exports the topics of a view into column-oriented files
+/*!
+ * Each topic is written to its own directory under the export directory, named after the topic with
+ * '/' replaced by '.' (e.g. "/camera/image" becomes "camera.image").  The directory holds one file
+ * per primitive field, with the values of every message stored contiguously in native byte order,
+ * so that columns can be memory-mapped directly:
+ *
+ *  - _time.bin               receipt times of the messages (IndexEntry::time) as uint64 nanoseconds
+ *  - <field>.bin             values of the field; strings are stored as their characters
+ *  - <field>.offsets         for list fields: uint64 offsets, one per message plus a final one, into
+ *                            the elements of <field>.bin (or into the items of <field>.item_offsets)
+ *  - <field>.item_offsets    for lists of strings or arrays: uint64 offsets, one per item plus a final
+ *                            one, into the elements of <field>.bin
+ *  - columns.txt             one line per column: name, type, element size in bytes and list depth
+ *
+ * Fields are named by their path in the message, e.g. "layout.dim[].label".  Scalar fields have a
+ * depth of 0; strings, arrays of primitives and fields inside arrays of messages have a depth of 1;
+ * strings and arrays inside arrays of messages have a depth of 2.  For std_msgs/UInt8MultiArray,
+ * "data" is a depth 1 column: a blob of all payloads plus their offsets.
+ *
+ * Chunks are read and decoded in parallel, each thread using its own ChunkReader, and messages are
+ * written in the order of the view.  All messages of a topic must share a message definition.
+ */
+class ROSBAG_STORAGE_DECL ColumnarExporter
+{
+public:
+    //! Create an exporter writing into directory, which is created if needed
+    /*!
+     * \param directory    The export directory
+     * \param thread_count The number of decoding threads, 0 to use one per hardware thread
+     */
+    explicit ColumnarExporter(std::string const& directory, uint32_t thread_count = 0);
+
+    //! Export all messages of a view
+    /*!
+     * The bags of the view must be version 2.0 bags opened for reading.  Existing files of the
+     * exported topics are overwritten.
+     *
+     * Can throw BagException, BagFormatException, BagIOException
+     */
+    void exportView(View& view);
+
+    std::string const& getDirectory()   const;   //!< Get the export directory
+    uint32_t           getThreadCount() const;   //!< Get the number of decoding threads
+
+private:
+    std::string directory_;
+    uint32_t    thread_count_;
+};
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -0,0 +1,225 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_MESSAGE_DECODER_H
+#define ROSBAG_MESSAGE_DECODER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "rosbag_io/ros/duration.h"
+#include "rosbag_io/ros/time.h"
+#include "rosbag_io/rosbag/macros.h"
+#include "rosbag_io/rosbag/structures.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+namespace fieldtype
+{
+    //! The primitive types of the message description language
+    enum FieldType
+    {
+        Bool,
+        Int8,
+        UInt8,
+        Int16,
+        UInt16,
+        Int32,
+        UInt32,
+        Int64,
+        UInt64,
+        Float32,
+        Float64,
+        String,
+        Time,
+        Duration
+    };
+}
+typedef fieldtype::FieldType FieldType;
+
+//! A primitive field found in a serialized message
+/*!
+ * The value does not own its data: it points into the serialized message it was decoded from.
+ * Arrays of primitives are returned whole, with data pointing at the first element.
+ */
+struct ROSBAG_STORAGE_DECL FieldValue
+{
+    FieldType      type;
+    uint8_t const* data;
+    uint32_t       count;   //!< number of elements for arrays, number of characters for strings, 1 otherwise
+    bool           array;   //!< true if the field is an array of primitives
+
+    double        toDouble(uint32_t i = 0)   const;   //!< element i converted to double (numeric, time and duration fields)
+    int64_t       toInt64(uint32_t i = 0)    const;   //!< element i converted to int64 (integer and bool fields)
+    uint64_t      toUInt64(uint32_t i = 0)   const;   //!< element i converted to uint64 (integer and bool fields)
+    std::string   toString()                 const;   //!< characters of a string field
+    ros::Time     toTime(uint32_t i = 0)     const;   //!< element i of a time field
+    ros::Duration toDuration(uint32_t i = 0) const;   //!< element i of a duration field
+};
+
+//! Decodes serialized messages of any type from their message definition
+/*!
+ * The definition (as stored in ConnectionInfo::msg_def) is parsed once and compiled into a flat
+ * plan: runs of fixed-size fields become a single step with precomputed offsets, and arrays become
+ * loops that can be skipped in one step when their elements have a fixed size.  Fields are then
+ * extracted from raw message bytes without instantiating a C++ type.
+ *
+ * Fields are identified by their path, e.g. "layout.data_offset" or "layout.dim[].label".  Arrays
+ * of primitives, such as "data", are a single field.
+ */
+class ROSBAG_STORAGE_DECL MessageDecoder
+{
+public:
+    typedef boost::function<void (uint32_t, FieldValue const&)> Visitor;
+
+    //! Compile a decoder from a full message definition
+    /*!
+     * \param datatype   The type of the message, e.g. "std_msgs/UInt8MultiArray"
+     * \param definition The full message definition, including the definitions of embedded types
+     *
+     * Can throw BagFormatException
+     */
+    MessageDecoder(std::string const& datatype, std::string const& definition);
+
+    //! Get the decoder of a connection, compiling it on first use
+    /*!
+     * Decoders are cached on the connection, and shared between connections of the same type.
+     *
+     * Can throw BagFormatException
+     */
+    static boost::shared_ptr<MessageDecoder const> get(ConnectionInfo const* connection_info);
+
+    std::string const&              getDataType()   const;   //!< Get the type of the decoded messages
+    std::vector<std::string> const& getFieldNames() const;   //!< Get the paths of all primitive fields, in serialization order
+    int                             getFieldIndex(std::string const& name) const;  //!< Get the index of a field path, -1 if unknown
+    FieldType                       getFieldType(uint32_t field) const;            //!< Get the type of a field
+    bool                            isFieldArray(uint32_t field) const;            //!< True if the field is an array of primitives
+    bool                            isFieldRepeated(uint32_t field) const;         //!< True if the field is inside an array of messages or strings
+    uint32_t                        getFixedSize()  const;   //!< Get the serialized size if it is the same for every message, 0 otherwise
+
+    static uint32_t getTypeSize(FieldType type);   //!< Get the size of one element of a type, 1 for the characters of strings
+
+    //! Call visitor with every primitive field of a serialized message, in order
+    /*!
+     * Fields inside arrays of messages are visited once per element.
+     *
+     * Can throw BagFormatException if the data is shorter than the definition requires
+     */
+    void decode(uint8_t const* data, uint32_t size, Visitor const& visitor) const;
+
+    //! Find the first occurrence of a field in a serialized message
+    /*!
+     * Decoding stops as soon as the field is found.  Returns false if the field is not present,
+     * which only happens for fields inside empty arrays of messages.
+     *
+     * Can throw BagFormatException if the data is shorter than the definition requires
+     */
+    bool getField(uint8_t const* data, uint32_t size, uint32_t field, FieldValue& value) const;
+
+private:
+    struct FieldSpec
+    {
+        std::string type;
+        std::string name;
+        bool        is_array;
+        bool        is_dynamic;   //!< variable-length array
+        uint32_t    length;       //!< length of fixed-length arrays
+    };
+
+    struct MessageSpec
+    {
+        std::string            package;
+        std::vector<FieldSpec> fields;
+    };
+
+    //! A primitive field
+    struct Leaf
+    {
+        FieldType type;
+        uint32_t  offset;     //!< offset inside its fixed run, if any
+        bool      array;      //!< array of primitives
+        bool      repeated;   //!< inside an array of messages or strings
+    };
+
+    //! A step of the decode plan
+    struct Op
+    {
+        enum Code
+        {
+            Fixed,            //!< run of fixed-size fields [field, field_end), size bytes in total
+            String,           //!< string field
+            PrimitiveArray,   //!< array of primitives, size bytes per element
+            ArrayBegin,       //!< start of an array of messages, covering fields [field, field_end)
+            ArrayEnd          //!< end of an array of messages
+        };
+
+        Code     code;
+        uint32_t field;
+        uint32_t field_end;
+        uint32_t size;        //!< Fixed: size of the run; PrimitiveArray: element size; ArrayBegin: element size, 0 if not fixed
+        uint32_t min_size;    //!< ArrayBegin: minimum serialized size of an element
+        uint32_t length;      //!< length of fixed-length arrays
+        bool     is_dynamic;  //!< variable-length array, its length is read from the message
+        bool     is_fixed;    //!< ArrayBegin: every element has the same size
+        uint32_t jump;        //!< ArrayBegin: index of the matching ArrayEnd, and vice versa
+    };
+
+    void parse(std::string const& definition, std::map<std::string, MessageSpec>& specs) const;
+    std::string resolveType(std::map<std::string, MessageSpec> const& specs, std::string const& type, std::string const& package) const;
+    void compile(std::map<std::string, MessageSpec> const& specs, std::string const& datatype, std::string const& prefix, int depth);
+    void addOp(Op::Code code, uint32_t size = 0, uint32_t length = 0, bool is_dynamic = false);
+    void addLeaf(std::string const& name, FieldType type, bool fixed);
+    bool computeSizes(uint32_t begin, uint32_t end, uint32_t& fixed_size, uint32_t& min_size) const;
+
+    bool run(uint8_t const* data, uint32_t size, uint32_t target, Visitor const* visitor, FieldValue* value) const;
+
+private:
+    std::string                        datatype_;
+
+    std::vector<Op>                    ops_;
+    std::vector<Leaf>                  leaves_;
+    std::vector<std::string>           field_names_;
+    std::map<std::string, uint32_t>    field_indexes_;
+    uint32_t                           fixed_size_;
+};
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -35,10 +35,13 @@
 #ifndef ROSBAG_MESSAGE_INSTANCE_H
 #define ROSBAG_MESSAGE_INSTANCE_H
 
+#include <boost/make_shared.hpp>
+
 #include <rosbag_io/ros/message_traits.h>
 #include <rosbag_io/ros/serialization.h>
 #include <rosbag_io/ros/time.h>
 
+#include "rosbag_io/rosbag/message_decoder.h"
 #include "rosbag_io/rosbag/structures.h"
 #include "rosbag_io/rosbag/macros.h"
 
@@ -67,6 +70,10 @@ public:
     std::string const& getMD5Sum()            const;
     std::string const& getMessageDefinition() const;
 
+    ConnectionInfo const* getConnectionInfo() const;   //!< Get the connection the message was recorded on
+    Bag const&            getBag()            const;   //!< Get the bag the message is stored in
+    IndexEntry const&     getIndexEntry()     const;   //!< Get the index entry locating the message in the bag
+
     boost::shared_ptr<ros::M_string> getConnectionHeader() const;
 
     std::string getCallerId() const;
@@ -85,6 +92,13 @@ public:
      */
     template<class T>
     boost::shared_ptr<T> instantiate() const;
+
+    //! Instantiate the message from its serialized payload, read by the caller
+    /*!
+     * returns NULL pointer if incompatible
+     */
+    template<class T>
+    boost::shared_ptr<T> instantiate(uint8_t const* data, uint32_t data_size) const;
   
     //! Write serialized message contents out to a stream
     template<typename Stream>
@@ -93,6 +107,21 @@ public:
     //! Size of serialized message
     uint32_t size() const;
 
+    //! Decoder compiled from the message definition of the connection
+    boost::shared_ptr<MessageDecoder const> getDecoder() const;
+
+    //! Read a field of the message by path, without instantiating it
+    /*!
+     * The value points into the bag's read buffer, and is only valid until the next message is read.
+     * Returns false if the field is not present in this message.
+     *
+     * Can throw BagException if the message type has no such field
+     */
+    bool getField(std::string const& name, FieldValue& value) const;
+
+    //! Call visitor with every primitive field of the message, see MessageDecoder::decode
+    void decode(MessageDecoder::Visitor const& visitor) const;
+
 private:
     MessageInstance(ConnectionInfo const* connection_info, IndexEntry const& index, Bag const& bag);
 
@@ -101,6 +130,23 @@ private:
     Bag const*            bag_;
 };
 
+//! Deserialize a message of type T from data_size bytes at data, which came with connection_header
+template<class T>
+boost::shared_ptr<T> deserializeMessage(uint8_t const* data, uint32_t data_size,
+                                        boost::shared_ptr<ros::M_string> const& connection_header)
+{
+    boost::shared_ptr<T> p = boost::make_shared<T>();
+
+    ros::serialization::PreDeserializeParams<T> predes_params;
+    predes_params.message = p;
+    predes_params.connection_header = connection_header;
+    ros::serialization::PreDeserialize<T>::notify(predes_params);
+
+    ros::serialization::IStream stream(const_cast<uint8_t*>(data), data_size);
+    ros::serialization::deserialize(stream, *p);
+    return p;
+}
+
 
 } // namespace rosbag
 } // namespace rosbag_io
@@ -170,6 +216,14 @@ boost::shared_ptr<T> MessageInstance::instantiate() const {
     return bag_->instantiateBuffer<T>(index_entry_);
 }
 
+template<class T>
+boost::shared_ptr<T> MessageInstance::instantiate(uint8_t const* data, uint32_t data_size) const {
+    if (!isType<T>())
+        return boost::shared_ptr<T>();
+
+    return deserializeMessage<T>(data, data_size, getConnectionHeader());
+}
+
 template<typename Stream>
 void MessageInstance::write(Stream& stream) const {
     bag_->readMessageDataIntoStream(index_entry_, stream);
@@ -0,0 +1,154 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_PLAYBACK_CLOCK_H
+#define ROSBAG_PLAYBACK_CLOCK_H
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "rosbag_io/ros/duration.h"
+#include "rosbag_io/ros/time.h"
+#include "rosbag_io/rosbag/macros.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! Decides when the messages of a playback are due, and what time it is when they are delivered
+/*!
+ * A clock replaces the wall-clock pacing of BagPlayer::start_play.  The playback thread calls
+ * begin() whenever it starts playing from a position, waitUntil() before each message and end()
+ * when it returns.  Other threads call interrupt() to make the player handle its controls.
+ */
+class ROSBAG_STORAGE_DECL PlaybackClock
+{
+public:
+    virtual ~PlaybackClock();
+
+    //! Playback starts, or goes on after a seek, from bag time time
+    virtual void begin(ros::Time const& time) = 0;
+
+    //! Wait until the message at bag time time is due, and make it the current time
+    /*!
+     * Returns false, without making the message current, if interrupt() was called since the last wait.
+     */
+    virtual bool waitUntil(ros::Time const& time) = 0;
+
+    //! Playback goes on from bag time time after a pause, or steps to the message at time while paused
+    /*!
+     * The time spent paused is not caught up on.  Makes time current without waiting; by default
+     * the same as begin().
+     */
+    virtual void resume(ros::Time const& time);
+
+    //! Make the current or next waitUntil() return false
+    virtual void interrupt() = 0;
+
+    //! Playback is over
+    virtual void end() = 0;
+};
+
+//! Sets ros::Time to the time of each message, at a fixed rate or as fast as possible
+/*!
+ * Components reading ros::Time::now() see the time of the message being delivered, whatever the
+ * rate, so that playback is deterministic.
+ */
+class ROSBAG_STORAGE_DECL SimulatedClock : public PlaybackClock
+{
+public:
+    //! \param rate Bag seconds played per wall second; 0 plays as fast as possible
+    explicit SimulatedClock(double rate = 0.0);
+
+    void   setRate(double rate);   //!< Set the bag seconds played per wall second, 0 for as fast as possible
+    double getRate() const;
+
+    void begin(ros::Time const& time);
+    bool waitUntil(ros::Time const& time);
+    void interrupt();
+    void end();
+
+private:
+    mutable boost::mutex      mutex_;
+    boost::condition_variable changed_;
+    double                    rate_;
+    bool                      interrupted_;
+    ros::Time                 anchor_time_;   //!< bag time played at anchor_wall_
+    int64_t                   anchor_wall_;
+    ros::Time                 current_;       //!< time of the last message
+};
+
+//! Lets playback advance only as far as an external tick allows, such as a simulator step
+/*!
+ * The ticking thread calls advance() or advanceTo(), which returns once every message up to the
+ * new time has been delivered.  ros::Time is set to the time of each message, then to the tick.
+ */
+class ROSBAG_STORAGE_DECL LockStepClock : public PlaybackClock
+{
+public:
+    LockStepClock();
+
+    //! Let playback go on until bag time until, and wait for it to get there
+    /*!
+     * Returns false if playback ended before, was interrupted, or started over from another position.
+     */
+    bool advanceTo(ros::Time const& until);
+
+    //! Let playback go on for step more bag time after getTime(), and wait for it to get there
+    bool advance(ros::Duration const& step);
+
+    ros::Time getTime()  const;   //!< Get the bag time playback may go on until
+    bool      hasEnded() const;   //!< Check if playback has ended
+
+    void begin(ros::Time const& time);
+    bool waitUntil(ros::Time const& time);
+    void resume(ros::Time const& time);
+    void interrupt();
+    void end();
+
+private:
+    mutable boost::mutex      mutex_;
+    boost::condition_variable changed_;
+    ros::Time                 until_;         //!< playback may deliver messages up to this time
+    bool                      started_;
+    bool                      waiting_;       //!< playback waits for a message after until_
+    ros::Time                 waiting_for_;   //!< time of the message playback waits for
+    bool                      ended_;
+    bool                      interrupted_;
+    uint64_t                  interruptions_;
+};
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -0,0 +1,105 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_PLAYBACK_SCHEDULER_H
+#define ROSBAG_PLAYBACK_SCHEDULER_H
+
+#include <ostream>
+#include <string>
+
+#include "rosbag_io/ros/duration.h"
+#include "rosbag_io/rosbag/macros.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! Histogram of how late messages were delivered, in power-of-two microsecond buckets
+struct ROSBAG_STORAGE_DECL LatenessHistogram
+{
+    //! Bucket 0 counts lateness below 1 us, bucket i below 2^i us, and the last bucket the rest
+    static const int BUCKET_COUNT = 22;
+
+    LatenessHistogram();
+
+    void clear();
+    void add(int64_t lateness_ns);
+
+    uint64_t getBucketLimit(int bucket) const;   //!< Get the upper bound of a bucket in nanoseconds, 0 for the last bucket
+    double   getMean() const;                    //!< Get the mean lateness in nanoseconds
+
+    std::string toString() const;
+
+    uint64_t counts[BUCKET_COUNT];
+    uint64_t count;      //!< number of samples
+    int64_t  total_ns;   //!< sum of the samples
+    int64_t  max_ns;     //!< largest sample
+};
+
+ROSBAG_STORAGE_DECL std::ostream& operator<<(std::ostream& os, LatenessHistogram const& histogram);
+
+//! Waits for absolute deadlines on the monotonic clock
+/*!
+ * Deadlines are absolute, so that sleeping late for one message does not delay the next ones.  The
+ * scheduler sleeps with clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME) until spin_tail before the
+ * deadline, then spins on the clock, trading CPU for wake-up accuracy.
+ */
+class ROSBAG_STORAGE_DECL PlaybackScheduler
+{
+public:
+    explicit PlaybackScheduler(ros::WallDuration const& spin_tail = ros::WallDuration(0, 100000));
+
+    void               setSpinTail(ros::WallDuration const& spin_tail);   //!< Set how long before a deadline to stop sleeping and spin
+    ros::WallDuration  getSpinTail() const;
+
+    //! Get the current time of the monotonic clock, in nanoseconds
+    static int64_t now();
+
+    //! Wait until deadline (as returned by now()) and record how late the wake-up was
+    /*!
+     * Returns the lateness in nanoseconds.  Deadlines already passed return immediately.
+     */
+    int64_t waitUntil(int64_t deadline);
+
+    LatenessHistogram const& getLateness() const;   //!< Get the lateness of the waits since the last reset
+    void                     resetLateness();
+
+private:
+    int64_t           spin_tail_ns_;
+    LatenessHistogram lateness_;
+};
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
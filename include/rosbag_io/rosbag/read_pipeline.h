@@ -0,0 +1,236 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_READ_PIPELINE_H
+#define ROSBAG_READ_PIPELINE_H
+
+#include <exception>
+#include <map>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "rosbag_io/rosbag/buffer.h"
+#include "rosbag_io/rosbag/message_instance.h"
+#include "rosbag_io/rosbag/macros.h"
+#include "rosbag_io/rosbag/structures.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+class ChunkReader;
+class View;
+
+//! A message delivered by a ReadPipeline, pinning the decompressed chunk that holds its payload
+struct ROSBAG_STORAGE_DECL PipelineMessage
+{
+    PipelineMessage(MessageInstance const& message, boost::shared_ptr<Buffer> const& chunk, uint8_t const* data, uint32_t data_size)
+        : message(message), chunk(chunk), data(data), data_size(data_size), instance_type(NULL) { }
+
+    //! Get the instance made by the decode stage, or deserialize the payload now
+    /*!
+     * Returns a NULL pointer if the message is not of the type.
+     */
+    template<class T>
+    boost::shared_ptr<T const> instantiate() const;
+
+    MessageInstance               message;
+    boost::shared_ptr<Buffer>     chunk;
+    uint8_t const*                data;            //!< valid as long as the message is
+    uint32_t                      data_size;
+
+    boost::shared_ptr<void const> instance;        //!< set by the decoder of the pipeline
+    std::type_info const*         instance_type;
+};
+
+//! Counters of a stage of a ReadPipeline
+struct ROSBAG_STORAGE_DECL PipelineStageStats
+{
+    PipelineStageStats() : threads(0), items(0), bytes(0), busy_seconds(0), queue_depth(0), max_queue_depth(0), starved(0), blocked(0) { }
+
+    //! Get the fraction of the time its threads were busy
+    double getOccupancy(double seconds) const;
+
+    uint32_t threads;
+    uint64_t items;             //!< chunks read or decompressed, messages decoded or delivered
+    uint64_t bytes;             //!< bytes read, decompressed, or of the payloads
+    double   busy_seconds;      //!< time spent working, summed over the threads
+    uint32_t queue_depth;       //!< items waiting for the stage
+    uint32_t max_queue_depth;
+    uint64_t starved;           //!< waits of a thread for an item
+    uint64_t blocked;           //!< waits of a thread for room in the queue of the next stage
+};
+
+//! Counters of every stage of a ReadPipeline
+struct ROSBAG_STORAGE_DECL PipelineStats
+{
+    PipelineStats() : seconds(0) { }
+
+    PipelineStageStats read;
+    PipelineStageStats decompress;
+    PipelineStageStats decode;
+    PipelineStageStats user;
+    double             seconds;     //!< duration of the run
+};
+
+//! Reads the messages of a view through stages with thread pools of their own
+/*!
+ * The messages are split in runs sharing a chunk.  Each run goes through four stages, each with its
+ * own threads: the compressed chunk is read from the file, then decompressed, then its messages are
+ * located and decoded, and finally they are passed to the callback of run(), in the order of the
+ * view, on the calling thread.  A chunk still held by a message is not read again for a later run.
+ *
+ * Between two stages at most capacity runs are queued or in progress, so a slow stage holds the
+ * ones before it back.  The oldest run in the pipeline may always proceed, so the stages can not
+ * deadlock on the order of delivery.
+ *
+ * The bags of the view must be version 2.0 bags opened for reading.
+ */
+class ROSBAG_STORAGE_DECL ReadPipeline
+{
+public:
+    typedef boost::function<void (PipelineMessage& message)>       Decoder;
+    typedef boost::function<void (PipelineMessage const& message)> Callback;
+
+    //! Plan the runs of a view
+    /*!
+     * \param view               The messages to read
+     * \param read_threads       The number of threads reading chunks
+     * \param decompress_threads The number of threads decompressing chunks, 0 for one per hardware thread
+     * \param decode_threads     The number of threads decoding messages
+     * \param capacity           The number of runs allowed between two stages
+     */
+    explicit ReadPipeline(View& view, uint32_t read_threads = 1, uint32_t decompress_threads = 0,
+                          uint32_t decode_threads = 1, uint32_t capacity = 8);
+    ~ReadPipeline();
+
+    void setDecoder(Decoder const& decoder);   //!< Set the function decoding each message in the decode stage
+
+    //! Instantiate the messages of type T in the decode stage
+    template<class T>
+    void decodeAs();
+
+    //! Pass every message of the view to callback
+    /*!
+     * Can throw BagFormatException, BagIOException, or rethrow an exception of the decoder or the callback
+     */
+    void run(Callback const& callback);
+
+    //! Make run() return after the current message, from any thread
+    void stop();
+
+    PipelineStats getStats() const;   //!< Get the counters of the current or last run
+
+private:
+    ReadPipeline(ReadPipeline const&);
+    ReadPipeline& operator=(ReadPipeline const&);
+
+    //! Consecutive messages of the view stored in the same chunk
+    struct Run
+    {
+        Bag const*                   bag;
+        uint64_t                     chunk_pos;
+        std::vector<MessageInstance> messages;
+
+        ChunkHeader                  chunk_header;
+        boost::shared_ptr<Buffer>    raw;
+        boost::shared_ptr<Buffer>    chunk;
+        std::vector<PipelineMessage> decoded;
+    };
+
+    enum Stage { READ = 0, DECOMPRESS = 1, DECODE = 2, USER = 3, STAGE_COUNT = 4 };
+
+    typedef std::map<Bag const*, boost::shared_ptr<ChunkReader> > ChunkReaders;
+
+    void     work(Stage stage);
+    uint64_t process(Stage stage, Run& run, ChunkReaders& readers);
+
+    PipelineStageStats&       getStageStats(Stage stage);
+    PipelineStageStats const& getStageStats(Stage stage) const;
+
+    template<class T>
+    static void decode(PipelineMessage& message);
+
+private:
+    std::vector<Run>     runs_;
+    uint32_t             threads_[STAGE_COUNT];
+    uint32_t             capacity_;
+    Decoder              decoder_;
+
+    mutable boost::mutex      mutex_;
+    boost::condition_variable changed_;
+    bool                      stopping_;
+    std::exception_ptr        error_;
+
+    size_t                    next_read_;                     //!< the next run to read
+    size_t                    next_delivery_;                 //!< the next run to pass to the callback
+    std::map<size_t, Run*>    inputs_[STAGE_COUNT];           //!< runs waiting for each stage but the first
+    size_t                    remaining_[STAGE_COUNT];        //!< runs each stage has yet to take
+    uint32_t                  pending_[STAGE_COUNT];          //!< runs taken by a stage and not yet by the next one
+    std::map<std::pair<Bag const*, uint64_t>, boost::weak_ptr<Buffer> > chunks_;   //!< the pinned chunks
+
+    PipelineStats             stats_;
+};
+
+template<class T>
+boost::shared_ptr<T const> PipelineMessage::instantiate() const {
+    if (instance && *instance_type == typeid(T))
+        return boost::static_pointer_cast<T const>(instance);
+    return message.instantiate<T>(data, data_size);
+}
+
+template<class T>
+void ReadPipeline::decode(PipelineMessage& message) {
+    boost::shared_ptr<T const> p = message.message.instantiate<T>(message.data, message.data_size);
+    if (p) {
+        message.instance      = p;
+        message.instance_type = &typeid(T);
+    }
+}
+
+template<class T>
+void ReadPipeline::decodeAs() {
+    setDecoder(&ReadPipeline::decode<T>);
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -0,0 +1,94 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_RECORD_HEADER_H
+#define ROSBAG_RECORD_HEADER_H
+
+#include <string>
+#include <vector>
+
+#include "rosbag_io/ros/datatypes.h"
+#include "rosbag_io/ros/time.h"
+#include "rosbag_io/rosbag/macros.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! Encodes a record header in place
+/*!
+ * A record header is its 4-byte length followed by fields, each a 4-byte length and "name=value".
+ * Fields are encoded as they are added, into storage that is kept between records, so that once it
+ * has grown to fit the largest header no allocation is made.  Fields are written in the order they
+ * are added; add them sorted by name to produce the same bytes as ros::Header::write.
+ */
+class ROSBAG_STORAGE_DECL RecordHeader
+{
+public:
+    RecordHeader();
+
+    void clear();   //!< Remove all fields
+
+    //! Add a field holding the bytes of value
+    template<typename T>
+    void add(std::string const& name, T const* value);
+
+    void add(std::string const& name, ros::Time const* value);   //!< Add a time field, packed as in the bag format
+    void add(std::string const& name, std::string const& value);
+    void add(std::string const& name, void const* value, uint32_t size);
+
+    //! Replace the fields with the fields of a map, in map order
+    void assign(ros::M_string const& fields);
+
+    uint8_t const* getData() const;   //!< Get the encoded header, starting with its length
+    uint32_t       getSize() const;   //!< Get the size of the encoded header, including its length
+
+    //! Get the size of the encoded header of fields, including its length
+    static uint32_t getEncodedSize(ros::M_string const& fields);
+
+    //! Encode the header of fields into getEncodedSize(fields) bytes at dest
+    static void encode(ros::M_string const& fields, uint8_t* dest);
+
+private:
+    std::vector<uint8_t> data_;
+};
+
+template<typename T>
+void RecordHeader::add(std::string const& name, T const* value) {
+    add(name, value, sizeof(T));
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -0,0 +1,141 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_SHARED_CHUNK_CACHE_H
+#define ROSBAG_SHARED_CHUNK_CACHE_H
+
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "rosbag_io/rosbag/buffer.h"
+#include "rosbag_io/rosbag/macros.h"
+
+namespace boost {
+namespace interprocess {
+class mapped_region;
+class shared_memory_object;
+}
+}
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! Decompressed chunks shared by every process on the host reading the same bags
+/*!
+ * The cache lives in a named shared memory object holding a fixed number of slots, each large
+ * enough for one decompressed chunk.  Chunks are keyed by the identity of their file (see getFileId)
+ * and their position in it, so any process reading the same file finds the chunks another process
+ * has decompressed.  Lookups take no lock: each slot carries a sequence number that a store makes
+ * odd while it rewrites the slot, and a lookup misses if the sequence changed while it copied the
+ * chunk.  Stores are serialized by a mutex in the shared memory and replace the least recently used
+ * slot; a store gives up rather than wait long for the mutex, so a process dying while it holds the
+ * mutex only stops the others from adding chunks.
+ *
+ * The first process to open a cache creates it, and later ones use its slot count and size whatever
+ * they ask for.  The shared memory object persists until remove() is called, even after every
+ * process has closed it.  Chunks of encrypted bags are stored decrypted, readable by any process
+ * allowed to open the shared memory.
+ */
+class ROSBAG_STORAGE_DECL SharedChunkCache
+{
+public:
+    static const uint32_t DEFAULT_SLOT_SIZE = 2 * 1024 * 1024;
+
+    //! Open the cache called name, creating it to hold up to size bytes of chunks if needed
+    /*!
+     * Chunks larger than slot_size are never cached.  Only the pages of the slots in use are backed
+     * by memory.
+     *
+     * Can throw BagException
+     */
+    SharedChunkCache(std::string const& name, uint64_t size, uint32_t slot_size = DEFAULT_SLOT_SIZE);
+
+    //! Open the existing cache called name, without ever creating it
+    /*!
+     * Can throw BagException, if there is no such cache or it can not be opened
+     */
+    explicit SharedChunkCache(std::string const& name);
+
+    ~SharedChunkCache();
+
+    //! Remove the cache called name from the system, returning false if there is none
+    /*!
+     * Processes which have it open keep using it, but later opens create a new cache.
+     */
+    static bool remove(std::string const& name);
+
+    //! Get the identity of a file from its canonical path, size and modification time, or 0 if it can not be determined
+    static uint64_t getFileId(std::string const& filename);
+
+    //! Copy the chunk at chunk_pos of file_id into buffer, returning false if it is not cached
+    bool get(uint64_t file_id, uint64_t chunk_pos, Buffer& buffer);
+
+    //! Test whether the chunk at chunk_pos of file_id is cached, though it may be evicted right after
+    bool contains(uint64_t file_id, uint64_t chunk_pos) const;
+
+    //! Store the decompressed chunk at chunk_pos of file_id, unless it is cached already or larger than a slot
+    void put(uint64_t file_id, uint64_t chunk_pos, uint8_t const* data, uint32_t size);
+
+    std::string getName()      const;
+    uint32_t    getSlotCount() const;
+    uint32_t    getSlotSize()  const;
+
+    uint64_t    getHits()   const;   //!< Get the number of chunks found by get() in this process
+    uint64_t    getMisses() const;   //!< Get the number of chunks not found by get() in this process
+
+private:
+    SharedChunkCache(SharedChunkCache const&);
+    SharedChunkCache& operator=(SharedChunkCache const&);
+
+    struct Header;
+    struct Slot;
+
+    void     map(boost::interprocess::shared_memory_object& shm);
+    Slot*    getSlot(uint32_t i) const;
+    uint8_t* getSlotData(uint32_t i) const;
+
+private:
+    std::string                                         name_;
+    boost::scoped_ptr<boost::interprocess::mapped_region> region_;
+    Header*                                             header_;
+    boost::atomic<uint64_t>                             hits_;
+    boost::atomic<uint64_t>                             misses_;
+};
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
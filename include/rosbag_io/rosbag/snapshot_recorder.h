@@ -0,0 +1,238 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_SNAPSHOT_RECORDER_H
+#define ROSBAG_SNAPSHOT_RECORDER_H
+
+#include <deque>
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "rosbag_io/ros/duration.h"
+#include "rosbag_io/ros/header.h"
+#include "rosbag_io/ros/message_traits.h"
+#include "rosbag_io/ros/serialization.h"
+#include "rosbag_io/ros/time.h"
+#include "rosbag_io/rosbag/bag.h"
+#include "rosbag_io/rosbag/buffer.h"
+#include "rosbag_io/rosbag/macros.h"
+#include "rosbag_io/rosbag/structures.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! Keeps the latest messages in memory, and writes them into a bag on demand
+/*!
+ * Messages are serialized as they are written into a block of a fixed size.  A full block is
+ * sealed, LZ4-compressed if asked to, and copied into a ring allocated once, overwriting the oldest
+ * blocks.  Blocks whose messages are older than the duration to keep are dropped as well, so the
+ * recorder holds the messages of the last duration, or as many as fit in the ring.  Nothing is
+ * written to disk until a snapshot is taken.
+ *
+ * A snapshot copies the blocks out of the ring, and a thread of the recorder writes them into a
+ * bag, so recording goes on while the bag is written.  The copy is made without holding up
+ * recording, which only waits if it wraps around onto blocks not copied yet.
+ */
+class ROSBAG_STORAGE_DECL SnapshotRecorder
+{
+public:
+    static const uint32_t DEFAULT_BLOCK_SIZE = 256 * 1024;
+
+    //! Keep the messages of the last duration, in a ring of size bytes
+    /*!
+     * \param duration    The span of the messages to keep, or 0 to keep as many as fit in the ring
+     * \param size        The size of the ring
+     * \param compression The compression of the blocks in the ring and of the snapshots, none or LZ4
+     * \param block_size  The size of the blocks, also the largest message kept
+     *
+     * Can throw BagException
+     */
+    SnapshotRecorder(ros::Duration const& duration, uint64_t size, CompressionType compression = compression::Uncompressed,
+                     uint32_t block_size = DEFAULT_BLOCK_SIZE);
+    ~SnapshotRecorder();   //!< Wait for the snapshots being written, ignoring errors
+
+    //! Keep a message, serializing it into the current block
+    /*!
+     * Messages larger than a block are dropped.
+     */
+    template<class T>
+    void write(std::string const& topic, ros::Time const& time, T const& msg,
+               boost::shared_ptr<ros::M_string> connection_header = boost::shared_ptr<ros::M_string>());
+
+    template<class T>
+    void write(std::string const& topic, ros::Time const& time, boost::shared_ptr<T const> const& msg,
+               boost::shared_ptr<ros::M_string> connection_header = boost::shared_ptr<ros::M_string>());
+
+    template<class T>
+    void write(std::string const& topic, ros::Time const& time, boost::shared_ptr<T> const& msg,
+               boost::shared_ptr<ros::M_string> connection_header = boost::shared_ptr<ros::M_string>());
+
+    //! Write the messages kept into the bag filename, in the background
+    /*!
+     * The messages are copied out of the ring before returning.
+     *
+     * Can throw BagException if writing a previous snapshot failed
+     */
+    void snapshot(std::string const& filename);
+
+    //! Wait for the snapshots being written
+    /*!
+     * Can throw BagException if writing a snapshot failed
+     */
+    void waitForSnapshots();
+
+    void forget();   //!< Drop the messages kept
+
+    uint64_t  getCapacity()     const;   //!< Get the size of the ring
+    uint64_t  getSize()         const;   //!< Get the bytes of the ring in use
+    uint64_t  getMessageCount() const;   //!< Get the number of messages kept
+    uint64_t  getDropCount()    const;   //!< Get the number of messages too large to keep
+    ros::Time getBeginTime()    const;   //!< Get the time of the earliest message kept
+    ros::Time getEndTime()      const;   //!< Get the time of the latest message kept
+    size_t    getPendingCount() const;   //!< Get the number of snapshots not written yet
+
+private:
+    SnapshotRecorder(SnapshotRecorder const&);
+    SnapshotRecorder& operator=(SnapshotRecorder const&);
+
+    //! A sealed block of messages in the ring
+    struct Block
+    {
+        uint64_t  offset;
+        uint32_t  size;            //!< bytes in the ring
+        uint32_t  raw_size;        //!< bytes once decompressed
+        bool      compressed;
+        ros::Time start_time;
+        ros::Time end_time;
+        uint32_t  message_count;
+    };
+
+    //! The blocks of a snapshot, copied out of the ring
+    struct Snapshot
+    {
+        std::string                    filename;
+        std::vector<ConnectionInfo>    connections;
+        std::vector<Block>             blocks;     //!< offsets into data
+        std::vector<uint8_t>           data;
+    };
+
+    template<class T>
+    void doWrite(std::string const& topic, ros::Time const& time, T const& msg, boost::shared_ptr<ros::M_string> const& connection_header);
+
+    uint32_t getConnectionId(std::string const& topic, char const* datatype, char const* md5sum, char const* msg_def,
+                             boost::shared_ptr<ros::M_string> const& connection_header);
+    uint8_t* reserve(boost::unique_lock<boost::mutex>& lock, uint32_t connection_id, ros::Time const& time, uint32_t data_size);
+    void     seal(boost::unique_lock<boost::mutex>& lock);
+    bool     isPinned(uint64_t offset, uint64_t size) const;
+    void     unpin(std::vector<Block> const& blocks);
+    void     evict(ros::Time const& end_time);
+    void     rethrowError();
+    void     writeSnapshots();
+    void     writeSnapshot(Snapshot const& snapshot);
+
+private:
+    ros::Duration                                   duration_;
+    CompressionType                                 compression_;
+    uint32_t                                        block_size_;
+
+    mutable boost::mutex                            mutex_;
+    std::vector<uint8_t>                            ring_;
+    uint64_t                                        head_;           //!< where the next block goes in the ring
+    std::deque<Block>                               blocks_;         //!< oldest first
+    std::vector<std::vector<Block> const*>          pinned_;         //!< blocks being copied by snapshots, not to be overwritten
+    boost::condition_variable                       unpinned_;
+    uint64_t                                        size_;
+    uint64_t                                        message_count_;
+    uint64_t                                        drop_count_;
+
+    Buffer                                          current_;        //!< the block being filled
+    Block                                           current_block_;
+    Buffer                                          compressed_;     //!< the current block once compressed
+
+    std::vector<ConnectionInfo>                     connections_;
+    std::map<std::string, uint32_t>                 topic_connection_ids_;    //!< connections written without a header
+    std::map<ros::M_string, uint32_t>               header_connection_ids_;   //!< connections written with a header
+
+    boost::thread                                   writer_;
+    boost::condition_variable                       queued_;
+    bool                                            closing_;
+    std::deque<boost::shared_ptr<Snapshot> >        snapshots_;      //!< snapshots to write, oldest first
+    std::exception_ptr                              error_;          //!< error writing a snapshot, not yet thrown
+};
+
+template<class T>
+void SnapshotRecorder::write(std::string const& topic, ros::Time const& time, T const& msg, boost::shared_ptr<ros::M_string> connection_header) {
+    doWrite(topic, time, msg, connection_header);
+}
+
+template<class T>
+void SnapshotRecorder::write(std::string const& topic, ros::Time const& time, boost::shared_ptr<T const> const& msg, boost::shared_ptr<ros::M_string> connection_header) {
+    doWrite(topic, time, *msg, connection_header);
+}
+
+template<class T>
+void SnapshotRecorder::write(std::string const& topic, ros::Time const& time, boost::shared_ptr<T> const& msg, boost::shared_ptr<ros::M_string> connection_header) {
+    doWrite(topic, time, *msg, connection_header);
+}
+
+template<class T>
+void SnapshotRecorder::doWrite(std::string const& topic, ros::Time const& time, T const& msg, boost::shared_ptr<ros::M_string> const& connection_header) {
+    uint32_t data_size = ros::serialization::serializationLength(msg);
+
+    boost::unique_lock<boost::mutex> lock(mutex_);
+
+    uint32_t connection_id = getConnectionId(topic, ros::message_traits::datatype(msg), ros::message_traits::md5sum(msg),
+                                             ros::message_traits::definition(msg), connection_header);
+
+    // Serialize the message in place
+    uint8_t* data = reserve(lock, connection_id, time, data_size);
+    if (data) {
+        ros::serialization::OStream stream(data, data_size);
+        ros::serialization::serialize(stream, msg);
+    }
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -0,0 +1,193 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_SPLIT_BAG_WRITER_H
+#define ROSBAG_SPLIT_BAG_WRITER_H
+
+#include <deque>
+#include <exception>
+#include <string>
+#include <utility>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "rosbag_io/ros/duration.h"
+#include "rosbag_io/ros/time.h"
+#include "rosbag_io/rosbag/bag.h"
+#include "rosbag_io/rosbag/macros.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! Writes messages into a series of bags, starting a new bag whenever the current one is full
+/*!
+ * The bags are named prefix_0.bag, prefix_1.bag, and so on, like those of rosbag record --split.
+ * Numbering goes on after the highest index already there, so bags of earlier runs are kept.
+ * A bag is full once it reaches a size, once its messages span a duration, or once it holds a
+ * number of messages, whichever comes first.
+ *
+ * Closing a bag writes its index and rewrites its header, which takes long for large bags.  A full
+ * bag is closed on a thread of the writer instead, so writing goes on into the next bag at once.
+ * Once closed, the oldest bags can be deleted to keep a number of bags, or a total size.
+ */
+class ROSBAG_STORAGE_DECL SplitBagWriter
+{
+public:
+    //! Write bags named after prefix, which may end with .bag
+    explicit SplitBagWriter(std::string const& prefix);
+    ~SplitBagWriter();   //!< Close the bags, ignoring errors
+
+    void            setMaxSize(uint64_t size);                    //!< Start a new bag once the bag reaches size bytes, 0 (the default) for no limit
+    uint64_t        getMaxSize() const;
+    void            setMaxDuration(ros::Duration const& duration);  //!< Start a new bag once its messages span duration, 0 (the default) for no limit
+    ros::Duration   getMaxDuration() const;
+    void            setMaxMessages(uint64_t count);               //!< Start a new bag once it holds count messages, 0 (the default) for no limit
+    uint64_t        getMaxMessages() const;
+
+    void            setMaxFiles(uint32_t count);                  //!< Delete the oldest closed bags beyond count, counting the bag being written, 0 (the default) to keep them all
+    uint32_t        getMaxFiles() const;
+    void            setMaxTotalSize(uint64_t size);               //!< Delete the oldest closed bags while they total more than size bytes, 0 (the default) for no limit
+    uint64_t        getMaxTotalSize() const;
+
+    void            setCompression(CompressionType compression);  //!< Set the compression of the bags started from now on
+    CompressionType getCompression() const;
+    void            setChunkThreshold(uint32_t chunk_threshold);  //!< Set the chunk threshold of the bags started from now on
+    uint32_t        getChunkThreshold() const;
+
+    //! Write a message into the current bag, starting a new bag first if the current one is full
+    /*!
+     * Can throw BagException, including when closing a previous bag failed
+     */
+    template<class T>
+    void write(std::string const& topic, ros::Time const& time, T const& msg,
+               boost::shared_ptr<ros::M_string> connection_header = boost::shared_ptr<ros::M_string>());
+
+    template<class T>
+    void write(std::string const& topic, ros::Time const& time, boost::shared_ptr<T const> const& msg,
+               boost::shared_ptr<ros::M_string> connection_header = boost::shared_ptr<ros::M_string>());
+
+    template<class T>
+    void write(std::string const& topic, ros::Time const& time, boost::shared_ptr<T> const& msg,
+               boost::shared_ptr<ros::M_string> connection_header = boost::shared_ptr<ros::M_string>());
+
+    //! Hand the current bag over to be closed, so that the next message starts a new bag
+    void split();
+
+    //! Close every bag, waiting for them
+    /*!
+     * The writer can go on writing into new bags afterwards.
+     *
+     * Can throw BagException if closing a bag failed
+     */
+    void close();
+
+    std::string getFileName()     const;   //!< Get the name of the current bag, or an empty string if there is none
+    uint32_t    getFileCount()    const;   //!< Get the number of bags started
+    size_t      getPendingCount() const;   //!< Get the number of bags handed over but not yet closed
+
+private:
+    SplitBagWriter(SplitBagWriter const&);
+    SplitBagWriter& operator=(SplitBagWriter const&);
+
+    template<class T>
+    void doWrite(std::string const& topic, ros::Time const& time, T const& msg, boost::shared_ptr<ros::M_string> const& connection_header);
+
+    bool isFull(ros::Time const& time) const;
+    void open(ros::Time const& time);
+    void rethrowError();
+    void finalize();
+    void prune(boost::unique_lock<boost::mutex>& lock);
+
+private:
+    std::string                      prefix_;
+    uint64_t                         max_size_;
+    ros::Duration                    max_duration_;
+    uint64_t                         max_messages_;
+    uint32_t                         max_files_;
+    uint64_t                         max_total_size_;
+    CompressionType                  compression_;
+    uint32_t                         chunk_threshold_;
+
+    boost::shared_ptr<Bag>           bag_;              //!< the bag being written
+    ros::Time                        start_time_;       //!< time of the first message of the bag
+    uint64_t                         message_count_;    //!< messages in the bag
+    uint32_t                         file_count_;
+    uint32_t                         next_index_;       //!< index in the name of the next bag
+
+    boost::thread                    finalizer_;
+    mutable boost::mutex             mutex_;
+    boost::condition_variable        queued_;
+    bool                             writing_;          //!< a bag is being written
+    bool                             closing_;
+    std::deque<boost::shared_ptr<Bag> > queue_;         //!< bags to close, oldest first
+    std::deque<std::pair<std::string, uint64_t> > files_;   //!< names and sizes of the closed bags, oldest first
+    uint64_t                         total_size_;       //!< size of the closed bags
+    std::exception_ptr               error_;            //!< error closing a bag, not yet thrown
+};
+
+template<class T>
+void SplitBagWriter::write(std::string const& topic, ros::Time const& time, T const& msg, boost::shared_ptr<ros::M_string> connection_header) {
+    doWrite(topic, time, msg, connection_header);
+}
+
+template<class T>
+void SplitBagWriter::write(std::string const& topic, ros::Time const& time, boost::shared_ptr<T const> const& msg, boost::shared_ptr<ros::M_string> connection_header) {
+    doWrite(topic, time, *msg, connection_header);
+}
+
+template<class T>
+void SplitBagWriter::write(std::string const& topic, ros::Time const& time, boost::shared_ptr<T> const& msg, boost::shared_ptr<ros::M_string> connection_header) {
+    doWrite(topic, time, *msg, connection_header);
+}
+
+template<class T>
+void SplitBagWriter::doWrite(std::string const& topic, ros::Time const& time, T const& msg, boost::shared_ptr<ros::M_string> const& connection_header) {
+    rethrowError();
+
+    if (bag_ && isFull(time))
+        split();
+    if (!bag_)
+        open(time);
+
+    bag_->write(topic, time, msg, connection_header);
+    message_count_++;
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
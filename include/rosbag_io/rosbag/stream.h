@@ -45,6 +45,8 @@
 
 #include "rosbag_io/roslz4/lz4s.h"
 
+#include "rosbag_io/ros/serialized_message.h"
+
 #include "rosbag_io/rosbag/exceptions.h"
 #include "rosbag_io/rosbag/macros.h"
 
@@ -78,6 +80,9 @@ public:
     virtual void write(void* ptr, size_t size) = 0;
     virtual void read (void* ptr, size_t size) = 0;
 
+    //! Write count segments in order.  The default implementation writes them one by one.
+    virtual void writev(ros::SerializedSegment const* segments, size_t count);
+
     virtual void decompress(uint8_t* dest, unsigned int dest_len, uint8_t* source, unsigned int source_len) = 0;
 
     virtual void startWrite();
@@ -129,6 +134,7 @@ public:
     CompressionType getCompressionType() const;
 
     void write(void* ptr, size_t size);
+    void writev(ros::SerializedSegment const* segments, size_t count);
     void read(void* ptr, size_t size);
 
     void decompress(uint8_t* dest, unsigned int dest_len, uint8_t* source, unsigned int source_len);
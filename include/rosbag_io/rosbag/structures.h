@@ -38,6 +38,8 @@
 #include <map>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
+
 #include "rosbag_io/ros/time.h"
 #include "rosbag_io/ros/datatypes.h"
 #include "rosbag_io/rosbag/macros.h"
@@ -45,6 +47,8 @@
 namespace rosbag_io {
 namespace rosbag {
 
+class MessageDecoder;
+
 struct ROSBAG_STORAGE_DECL ConnectionInfo
 {
     ConnectionInfo() : id(-1) { }
@@ -56,6 +60,8 @@ struct ROSBAG_STORAGE_DECL ConnectionInfo
     std::string msg_def;
 
     boost::shared_ptr<ros::M_string> header;
+
+    mutable boost::shared_ptr<MessageDecoder const> decoder;   //!< compiled on first use, see MessageDecoder::get
 };
 
 struct ChunkInfo
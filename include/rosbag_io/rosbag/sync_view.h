@@ -0,0 +1,173 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_SYNC_VIEW_H
+#define ROSBAG_SYNC_VIEW_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "rosbag_io/ros/duration.h"
+#include "rosbag_io/ros/time.h"
+#include "rosbag_io/rosbag/chunk_reader.h"
+#include "rosbag_io/rosbag/message_instance.h"
+#include "rosbag_io/rosbag/macros.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! A message of a synchronized tuple, with its serialized payload
+struct ROSBAG_STORAGE_DECL SyncedMessage
+{
+    SyncedMessage(MessageInstance const& message, uint8_t const* data, uint32_t data_size)
+        : message(message), data(data), data_size(data_size) { }
+
+    //! Deserialize the payload, returning a NULL pointer if the message is not of the type
+    template<class T>
+    boost::shared_ptr<T> instantiate() const;
+
+    MessageInstance message;
+    uint8_t const*  data;        //!< valid until the iterator is incremented
+    uint32_t        data_size;
+};
+
+//! Joins the messages of several topics into tuples whose receipt times lie within a tolerance
+/*!
+ * Tuple i holds one message of each topic, in the order of the topics, and the times of its
+ * messages are at most the tolerance apart.  Each message is used in at most one tuple, and the
+ * tuples come in time order.  The join picks, for the latest message of a candidate tuple, the
+ * latest message of every other topic not after it, and drops messages that can not be matched.
+ *
+ * The join is computed over the index alone, when the view is constructed.  Iterating then reads
+ * each chunk holding a matched message once, through a ChunkReader of its own: the payloads of the
+ * chunk that any tuple uses are copied out, and released after the last tuple that uses them.
+ * Unmatched messages are never decompressed into memory of their own or deserialized.
+ */
+class ROSBAG_STORAGE_DECL SyncView
+{
+public:
+    typedef std::vector<SyncedMessage> Tuple;
+
+    //! An iterator over the tuples of a SyncView
+    /*!
+     * The tuple is owned by the view, and is only valid until the iterator is incremented.
+     */
+    class ROSBAG_STORAGE_DECL iterator : public boost::iterator_facade<iterator,
+                                                   Tuple const,
+                                                   boost::forward_traversal_tag>
+    {
+    public:
+        iterator();
+
+    private:
+        friend class SyncView;
+        friend class boost::iterator_core_access;
+
+        iterator(SyncView* view, uint32_t index);
+
+        bool equal(iterator const& other) const;
+        void increment();
+        Tuple const& dereference() const;
+
+    private:
+        SyncView* view_;
+        uint32_t  index_;
+    };
+
+    //! Join the messages of topics
+    /*!
+     * \param bag        The bag to read, a version 2.0 bag opened for reading
+     * \param topics     The topics to join, one message of each per tuple
+     * \param tolerance  The largest difference between the times of the messages of a tuple
+     * \param start_time The beginning of the time range of the messages
+     * \param end_time   The end of the time range of the messages
+     *
+     * Can throw BagException
+     */
+    SyncView(Bag const& bag, std::vector<std::string> const& topics, ros::Duration const& tolerance,
+             ros::Time const& start_time = ros::TIME_MIN, ros::Time const& end_time = ros::TIME_MAX);
+    ~SyncView();
+
+    iterator begin();
+    iterator end();
+
+    uint32_t size() const;             //!< Get the number of tuples
+    uint32_t getChunkReads() const;    //!< Get the number of chunks decompressed so far
+
+private:
+    SyncView(SyncView const&);
+    SyncView& operator=(SyncView const&);
+
+    //! The payloads of a chunk used by the tuples
+    struct Chunk
+    {
+        std::vector<uint32_t> slots;        //!< messages of the tuples in the chunk
+        uint32_t              last_tuple;
+        bool                  loaded;
+        std::vector<uint8_t>  data;         //!< the payloads of the slots, once loaded
+    };
+
+    Tuple const& load(uint32_t index);
+    void         loadChunk(uint64_t chunk_pos, Chunk& chunk);
+
+private:
+    uint32_t                           topic_count_;
+    std::vector<MessageInstance>       slots_;              //!< the messages of tuple i start at i * topic_count_
+    std::vector<uint64_t>              slot_offsets_;       //!< offset of the payload of each slot in the data of its chunk
+    std::vector<uint32_t>              slot_sizes_;
+    std::map<uint64_t, Chunk>          chunks_;
+    std::set<std::pair<uint32_t, uint64_t> > loaded_;     //!< (last tuple, position) of the loaded chunks
+
+    boost::scoped_ptr<ChunkReader>     reader_;
+    uint32_t                           chunk_reads_;
+
+    uint32_t                           current_index_;
+    Tuple                              current_;
+};
+
+template<class T>
+boost::shared_ptr<T> SyncedMessage::instantiate() const {
+    return message.instantiate<T>(data, data_size);
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
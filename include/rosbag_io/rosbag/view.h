@@ -129,6 +129,13 @@ public:
     iterator end();
     uint32_t size();
 
+    //! Get an iterator to the first message at or after a time
+    /*!
+     * The position is found by a binary search of the index of each connection, so seeking does
+     * not depend on the number of messages skipped.
+     */
+    iterator seek(ros::Time const& time);
+
     //! Add a query to a view
     /*!
      * param bag        The bag file on which to run this query
@@ -0,0 +1,213 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of Willow Garage, Inc. nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef ROSBAG_WINDOW_VIEW_H
+#define ROSBAG_WINDOW_VIEW_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <typeinfo>
+#include <utility>
+
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "rosbag_io/ros/duration.h"
+#include "rosbag_io/rosbag/buffer.h"
+#include "rosbag_io/rosbag/chunk_reader.h"
+#include "rosbag_io/rosbag/message_instance.h"
+#include "rosbag_io/rosbag/macros.h"
+#include "rosbag_io/rosbag/view.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! A message of a window, pinning the decompressed chunk that holds its payload
+struct ROSBAG_STORAGE_DECL WindowedMessage
+{
+    WindowedMessage(MessageInstance const& message, boost::shared_ptr<Buffer> const& chunk, uint8_t const* data, uint32_t data_size)
+        : message(message), chunk(chunk), data(data), data_size(data_size), instance_type(NULL) { }
+
+    //! Deserialize the payload, returning a NULL pointer if the message is not of the type
+    /*!
+     * The message is deserialized once: every window holding it shares the instance.
+     */
+    template<class T>
+    boost::shared_ptr<T const> instantiate() const;
+
+    MessageInstance           message;
+    boost::shared_ptr<Buffer> chunk;
+    uint8_t const*            data;        //!< valid as long as the message is
+    uint32_t                  data_size;
+
+private:
+    mutable boost::shared_ptr<void const> instance;
+    mutable std::type_info const*         instance_type;
+};
+
+//! Slides a window over the messages of each topic of a view
+/*!
+ * After each message of a topic, the window of the topic holds its latest messages: a fixed count
+ * of them, or those within a time span of the newest one.  A window is returned once the topic
+ * fills it, then again every stride messages of the topic.  Iterating with a window of 10 and a
+ * stride of 1 returns the windows [0, 10), [1, 11), ... of each topic.
+ *
+ * The windows of a topic share one ring of messages, so moving a window only reads the messages
+ * entering it.  Each message pins its decompressed chunk, which is freed once no window holds a
+ * message of it, and keeps its deserialized instance: a message is neither read nor deserialized
+ * again for each window it appears in.
+ */
+class ROSBAG_STORAGE_DECL WindowView
+{
+public:
+    typedef std::deque<WindowedMessage>::const_iterator const_iterator;
+
+    //! The latest messages of a topic, oldest first
+    class ROSBAG_STORAGE_DECL Window
+    {
+    public:
+        Window();
+
+        std::string const& getTopic() const;
+        size_t             size() const;
+
+        const_iterator         begin() const;
+        const_iterator         end()   const;
+        WindowedMessage const& operator[](size_t i) const;
+        WindowedMessage const& front() const;   //!< Get the oldest message
+        WindowedMessage const& back()  const;   //!< Get the newest message
+
+    private:
+        friend class WindowView;
+
+        std::string                  topic_;
+        std::deque<WindowedMessage>  ring_;
+        uint64_t                     count_;    //!< messages of the topic so far
+        uint64_t                     full_at_;  //!< messages of the topic when the window first filled, 0 before
+        ros::Time                    first_;    //!< time of the first message of the topic
+    };
+
+    //! An iterator over the windows of a WindowView
+    /*!
+     * The window is owned by the view, and is only valid until the iterator is incremented.
+     */
+    class ROSBAG_STORAGE_DECL iterator : public boost::iterator_facade<iterator,
+                                                   Window const,
+                                                   boost::forward_traversal_tag>
+    {
+    public:
+        iterator();
+
+    private:
+        friend class WindowView;
+        friend class boost::iterator_core_access;
+
+        iterator(WindowView* view, uint64_t index);
+
+        bool equal(iterator const& other) const;
+        void increment();
+        Window const& dereference() const;
+
+    private:
+        WindowView* view_;
+        uint64_t    index_;
+    };
+
+    //! Slide a window of count messages over each topic of a view
+    /*!
+     * The view must outlive the WindowView.  Its bags must be version 2.0 bags opened for reading.
+     */
+    WindowView(View& view, uint32_t count, uint32_t stride = 1);
+
+    //! Slide a window of the messages within span of the newest one over each topic of a view
+    /*!
+     * A window is full once the first message of its topic is at least span older than the newest.
+     * The view must outlive the WindowView.  Its bags must be version 2.0 bags opened for reading.
+     */
+    WindowView(View& view, ros::Duration const& span, uint32_t stride = 1);
+
+    ~WindowView();
+
+    //! Restart from the first message of the view
+    /*!
+     * Can throw BagException, BagFormatException, BagIOException
+     */
+    iterator begin();
+    iterator end();
+
+    uint32_t getChunkReads() const;   //!< Get the number of chunks decompressed so far
+
+private:
+    WindowView(WindowView const&);
+    WindowView& operator=(WindowView const&);
+
+    bool        advance();
+    void        read(MessageInstance const& m, Window& window);
+    ChunkReader& getReader(Bag const* bag);
+
+private:
+    View*                       view_;
+    uint32_t                    count_;     //!< size of the windows, 0 for windows of a time span
+    ros::Duration               span_;
+    uint32_t                    stride_;
+
+    View::iterator              position_;
+    std::map<std::string, Window>           windows_;
+    std::map<ConnectionInfo const*, Window*> connection_windows_;
+    Window*                     current_;
+
+    std::map<Bag const*, boost::shared_ptr<ChunkReader> >                         readers_;
+    std::map<std::pair<Bag const*, uint64_t>, boost::weak_ptr<Buffer> >            chunks_;   //!< the pinned chunks
+    uint32_t                    chunk_reads_;
+};
+
+template<class T>
+boost::shared_ptr<T const> WindowedMessage::instantiate() const {
+    if (instance && *instance_type == typeid(T))
+        return boost::static_pointer_cast<T const>(instance);
+
+    boost::shared_ptr<T const> p = message.instantiate<T>(data, data_size);
+    if (p) {
+        instance      = p;
+        instance_type = &typeid(T);
+    }
+    return p;
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+#endif
@@ -100,6 +100,8 @@ void Bag::init() {
     curr_chunk_data_pos_ = 0;
     current_buffer_ = 0;
     decompressed_chunk_ = 0;
+    file_id_ = 0;
+    index_ = boost::make_shared<BagIndex>();
     encryptor_ = boost::make_shared<NoEncryptor>();
     encryptor_->initialize(*this, "");
 }
@@ -130,7 +132,7 @@ void Bag::openRead(string const& filename) {
 
     switch (version_) {
     case 102: startReadingVersion102(); break;
-    case 200: startReadingVersion200(); break;
+    case 200: startReadingSharedVersion200(filename); break;
     default:
         throw BagException((format("Unsupported bag file version: %1%.%2%") % getMajorVersion() % getMinorVersion()).str());
     }
@@ -150,7 +152,11 @@ void Bag::openAppend(string const& filename) {
     if (version_ != 200)
         throw BagException((format("Bag file version %1%.%2% is unsupported for appending") % getMajorVersion() % getMinorVersion()).str());
 
-    startReadingVersion200();
+    // The message index is only needed to read the bag, and takes a seek per chunk to load
+    if (mode_ & bagmode::Read)
+        startReadingVersion200();
+    else
+        readIndexVersion200();
 
     // Truncate the file to chop off the index
     file_.truncate(index_data_pos_);
@@ -173,14 +179,9 @@ void Bag::close() {
     
     file_.close();
 
-    topic_connection_ids_.clear();
-    header_connection_ids_.clear();
-    for (map<uint32_t, ConnectionInfo*>::iterator i = connections_.begin(); i != connections_.end(); i++)
-        delete i->second;
-    connections_.clear();
-    chunks_.clear();
-    connection_indexes_.clear();
+    index_.reset();
     curr_chunk_connection_indexes_.clear();
+    chunk_cache_.clear();
 
     init();
 }
@@ -195,6 +196,18 @@ uint64_t Bag::getSize()     const { return file_size_;          }
 
 uint32_t Bag::getChunkThreshold() const { return chunk_threshold_; }
 
+uint64_t Bag::getChunkCacheSize() const { return chunk_cache_.getCapacity(); }
+
+void Bag::setChunkCacheSize(uint64_t size) {
+    chunk_cache_.setCapacity(size);
+}
+
+shared_ptr<SharedChunkCache> Bag::getSharedChunkCache() const { return shared_chunk_cache_; }
+
+void Bag::setSharedChunkCache(shared_ptr<SharedChunkCache> const& cache) {
+    shared_chunk_cache_ = cache;
+}
+
 void Bag::setChunkThreshold(uint32_t chunk_threshold) {
     if (isOpen() && chunk_open_)
         stopWritingChunk();
@@ -275,6 +288,11 @@ void Bag::stopWriting() {
 }
 
 void Bag::startReadingVersion200() {
+    readIndexVersion200();
+    readConnectionIndexesVersion200();
+}
+
+void Bag::readIndexVersion200() {
     // Read the file header record, which points to the end of the chunks
     readFileHeaderRecord();
 
@@ -288,9 +306,11 @@ void Bag::startReadingVersion200() {
     // Read the chunk info records
     for (uint32_t i = 0; i < chunk_count_; i++)
         readChunkInfoRecord();
+}
 
+void Bag::readConnectionIndexesVersion200() {
     // Read the connection indexes for each chunk
-    for (ChunkInfo const& chunk_info : chunks_) {
+    for (ChunkInfo const& chunk_info : index_->chunks) {
         curr_chunk_info_ = chunk_info;
 
         seek(curr_chunk_info_.pos);
@@ -309,6 +329,33 @@ void Bag::startReadingVersion200() {
     curr_chunk_info_ = ChunkInfo();
 }
 
+void Bag::startReadingSharedVersion200(string const& filename) {
+    BagIndexRegistry::Key key;
+    if (!BagIndexRegistry::isEnabled() || !BagIndexRegistry::getKey(filename, key)) {
+        startReadingVersion200();
+        return;
+    }
+
+    // Attach to the index of another reader of the file, if its file header still matches
+    boost::shared_ptr<BagIndex> index = BagIndexRegistry::find(key);
+    if (index) {
+        readFileHeaderRecord();
+        if (index->index_data_pos == index_data_pos_ && index->connection_count == connection_count_ && index->chunk_count == chunk_count_) {
+            index_ = index;
+            curr_chunk_info_ = ChunkInfo();
+            return;
+        }
+        seek(file_header_pos_);
+    }
+
+    startReadingVersion200();
+
+    index_->index_data_pos   = index_data_pos_;
+    index_->connection_count = connection_count_;
+    index_->chunk_count      = chunk_count_;
+    BagIndexRegistry::add(key, index_);
+}
+
 void Bag::startReadingVersion102() {
     try
     {
@@ -331,7 +378,7 @@ void Bag::startReadingVersion102() {
         readTopicIndexRecord102();
 
     // Read the message definition records (which are the first entry in the topic indexes)
-    for (map<uint32_t, multiset<IndexEntry> >::const_iterator i = connection_indexes_.begin(); i != connection_indexes_.end(); i++) {
+    for (map<uint32_t, multiset<IndexEntry> >::const_iterator i = index_->connection_indexes.begin(); i != index_->connection_indexes.end(); i++) {
         multiset<IndexEntry> const& index       = i->second;
         IndexEntry const&           first_entry = *index.begin();
 
@@ -346,8 +393,8 @@ void Bag::startReadingVersion102() {
 // File header record
 
 void Bag::writeFileHeaderRecord() {
-    connection_count_ = connections_.size();
-    chunk_count_      = chunks_.size();
+    connection_count_ = index_->connections.size();
+    chunk_count_      = index_->chunks.size();
 
     LOG_DEBUG("Writing FILE_HEADER [%llu]: index_pos=%llu connection_count=%d chunk_count=%d",
               (unsigned long long) file_.getOffset(), (unsigned long long) index_data_pos_, connection_count_, chunk_count_);
@@ -440,7 +487,7 @@ void Bag::startWritingChunk(Time time) {
 
 void Bag::stopWritingChunk() {
     // Add this chunk to the index
-    chunks_.push_back(curr_chunk_info_);
+    index_->chunks.push_back(curr_chunk_info_);
     
     // Get the uncompressed and compressed sizes
     uint32_t uncompressed_size = getChunkOffset();
@@ -483,11 +530,11 @@ void Bag::writeChunkHeader(CompressionType compression, uint32_t compressed_size
     LOG_DEBUG("Writing CHUNK [%llu]: compression=%s compressed=%d uncompressed=%d",
               (unsigned long long) file_.getOffset(), chunk_header.compression.c_str(), chunk_header.compressed_size, chunk_header.uncompressed_size);
 
-    M_string header;
-    header[OP_FIELD_NAME]          = toHeaderString(&OP_CHUNK);
-    header[COMPRESSION_FIELD_NAME] = chunk_header.compression;
-    header[SIZE_FIELD_NAME]        = toHeaderString(&chunk_header.uncompressed_size);
-    writeHeader(header);
+    record_header_.clear();
+    record_header_.add(COMPRESSION_FIELD_NAME, chunk_header.compression);
+    record_header_.add(OP_FIELD_NAME,          &OP_CHUNK);
+    record_header_.add(SIZE_FIELD_NAME,        &chunk_header.uncompressed_size);
+    writeHeader(record_header_);
 
     writeDataLength(chunk_header.compressed_size);
 }
@@ -517,12 +564,12 @@ void Bag::writeIndexRecords() {
 
         // Write the index record header
         uint32_t index_size = index.size();
-        M_string header;
-        header[OP_FIELD_NAME]         = toHeaderString(&OP_INDEX_DATA);
-        header[CONNECTION_FIELD_NAME] = toHeaderString(&connection_id);
-        header[VER_FIELD_NAME]        = toHeaderString(&INDEX_VERSION);
-        header[COUNT_FIELD_NAME]      = toHeaderString(&index_size);
-        writeHeader(header);
+        record_header_.clear();
+        record_header_.add(CONNECTION_FIELD_NAME, &connection_id);
+        record_header_.add(COUNT_FIELD_NAME,      &index_size);
+        record_header_.add(OP_FIELD_NAME,         &OP_INDEX_DATA);
+        record_header_.add(VER_FIELD_NAME,        &INDEX_VERSION);
+        writeHeader(record_header_);
 
         writeDataLength(index_size * 12);
 
@@ -562,22 +609,22 @@ void Bag::readTopicIndexRecord102() {
         throw BagFormatException((format("Unsupported INDEX_DATA version: %1%") % index_version).str());
 
     uint32_t connection_id;
-    map<string, uint32_t>::const_iterator topic_conn_id_iter = topic_connection_ids_.find(topic);
-    if (topic_conn_id_iter == topic_connection_ids_.end()) {
-    	connection_id = connections_.size();
+    map<string, uint32_t>::const_iterator topic_conn_id_iter = index_->topic_connection_ids.find(topic);
+    if (topic_conn_id_iter == index_->topic_connection_ids.end()) {
+    	connection_id = index_->connections.size();
 
         LOG_DEBUG("Creating connection: id=%d topic=%s", connection_id, topic.c_str());
         ConnectionInfo* connection_info = new ConnectionInfo();
         connection_info->id       = connection_id;
         connection_info->topic    = topic;
-        connections_[connection_id] = connection_info;
+        index_->connections[connection_id] = connection_info;
 
-        topic_connection_ids_[topic] = connection_id;
+        index_->topic_connection_ids[topic] = connection_id;
     }
     else
     	connection_id = topic_conn_id_iter->second;
 
-    multiset<IndexEntry>& connection_index = connection_indexes_[connection_id];
+    multiset<IndexEntry>& connection_index = index_->connection_indexes[connection_id];
 
     for (uint32_t i = 0; i < count; i++) {
         IndexEntry index_entry;
@@ -625,7 +672,7 @@ void Bag::readConnectionIndexRecord200() {
 
     uint64_t chunk_pos = curr_chunk_info_.pos;
 
-    multiset<IndexEntry>& connection_index = connection_indexes_[connection_id];
+    multiset<IndexEntry>& connection_index = index_->connection_indexes[connection_id];
 
     for (uint32_t i = 0; i < count; i++) {
         IndexEntry index_entry;
@@ -641,7 +688,7 @@ void Bag::readConnectionIndexRecord200() {
 
         if (index_entry.time < ros::TIME_MIN || index_entry.time > ros::TIME_MAX)
         {
-          LOG_ERROR("Index entry for topic %s contains invalid time.  This message will not be loaded.", connections_[connection_id]->topic.c_str());
+          LOG_ERROR("Index entry for topic %s contains invalid time.  This message will not be loaded.", index_->connections[connection_id]->topic.c_str());
         } else
         {
           connection_index.insert(connection_index.end(), index_entry);
@@ -652,7 +699,7 @@ void Bag::readConnectionIndexRecord200() {
 // Connection records
 
 void Bag::writeConnectionRecords() {
-    for (map<uint32_t, ConnectionInfo*>::const_iterator i = connections_.begin(); i != connections_.end(); i++) {
+    for (map<uint32_t, ConnectionInfo*>::const_iterator i = index_->connections.begin(); i != index_->connections.end(); i++) {
         ConnectionInfo const* connection_info = i->second;
         writeConnectionRecord(connection_info, true);
     }
@@ -662,28 +709,33 @@ void Bag::writeConnectionRecord(ConnectionInfo const* connection_info, const boo
     LOG_DEBUG("Writing CONNECTION [%llu:%d]: topic=%s id=%d",
               (unsigned long long) file_.getOffset(), getChunkOffset(), connection_info->topic.c_str(), connection_info->id);
 
-    M_string header;
-    header[OP_FIELD_NAME]         = toHeaderString(&OP_CONNECTION);
-    header[TOPIC_FIELD_NAME]      = connection_info->topic;
-    header[CONNECTION_FIELD_NAME] = toHeaderString(&connection_info->id);
+    if (encrypt) {
+        // The encryptor takes the header fields as a map
+        void (Bag::*write_header)(M_string const&) = &Bag::writeHeader;
 
-    if (encrypt)
-        encryptor_->writeEncryptedHeader(boost::bind(&Bag::writeHeader, this, boost::placeholders::_1), header, file_);
-    else
-        writeHeader(header);
-
-    if (encrypt)
-        encryptor_->writeEncryptedHeader(boost::bind(&Bag::writeHeader, this, boost::placeholders::_1), *connection_info->header, file_);
-    else
+        M_string header;
+        header[OP_FIELD_NAME]         = toHeaderString(&OP_CONNECTION);
+        header[TOPIC_FIELD_NAME]      = connection_info->topic;
+        header[CONNECTION_FIELD_NAME] = toHeaderString(&connection_info->id);
+        encryptor_->writeEncryptedHeader(boost::bind(write_header, this, boost::placeholders::_1), header, file_);
+        encryptor_->writeEncryptedHeader(boost::bind(write_header, this, boost::placeholders::_1), *connection_info->header, file_);
+    }
+    else {
+        record_header_.clear();
+        record_header_.add(CONNECTION_FIELD_NAME, &connection_info->id);
+        record_header_.add(OP_FIELD_NAME,         &OP_CONNECTION);
+        record_header_.add(TOPIC_FIELD_NAME,      connection_info->topic);
+        writeHeader(record_header_);
         writeHeader(*connection_info->header);
+    }
 }
 
 void Bag::appendConnectionRecordToBuffer(Buffer& buf, ConnectionInfo const* connection_info) {
-    M_string header;
-    header[OP_FIELD_NAME]         = toHeaderString(&OP_CONNECTION);
-    header[TOPIC_FIELD_NAME]      = connection_info->topic;
-    header[CONNECTION_FIELD_NAME] = toHeaderString(&connection_info->id);
-    appendHeaderToBuffer(buf, header);
+    record_header_.clear();
+    record_header_.add(CONNECTION_FIELD_NAME, &connection_info->id);
+    record_header_.add(OP_FIELD_NAME,         &OP_CONNECTION);
+    record_header_.add(TOPIC_FIELD_NAME,      connection_info->topic);
+    appendHeaderToBuffer(buf, record_header_);
 
     appendHeaderToBuffer(buf, *connection_info->header);
 }
@@ -707,8 +759,8 @@ void Bag::readConnectionRecord() {
         throw BagFormatException("Error reading connection header");
 
     // If this is a new connection, update connections
-    map<uint32_t, ConnectionInfo*>::iterator key = connections_.find(id);
-    if (key == connections_.end()) {
+    map<uint32_t, ConnectionInfo*>::iterator key = index_->connections.find(id);
+    if (key == index_->connections.end()) {
         ConnectionInfo* connection_info = new ConnectionInfo();
         connection_info->id       = id;
         connection_info->topic    = topic;
@@ -718,7 +770,7 @@ void Bag::readConnectionRecord() {
         connection_info->msg_def  = (*connection_info->header)["message_definition"];
         connection_info->datatype = (*connection_info->header)["type"];
         connection_info->md5sum   = (*connection_info->header)["md5sum"];
-        connections_[id] = connection_info;
+        index_->connections[id] = connection_info;
 
         LOG_DEBUG("Read CONNECTION: topic=%s id=%d", topic.c_str(), id);
     }
@@ -742,20 +794,20 @@ void Bag::readMessageDefinitionRecord102() {
 
     ConnectionInfo* connection_info;
 
-    map<string, uint32_t>::const_iterator topic_conn_id_iter = topic_connection_ids_.find(topic);
-    if (topic_conn_id_iter == topic_connection_ids_.end()) {
-    	uint32_t id = connections_.size();
+    map<string, uint32_t>::const_iterator topic_conn_id_iter = index_->topic_connection_ids.find(topic);
+    if (topic_conn_id_iter == index_->topic_connection_ids.end()) {
+    	uint32_t id = index_->connections.size();
 
         LOG_DEBUG("Creating connection: topic=%s md5sum=%s datatype=%s", topic.c_str(), md5sum.c_str(), datatype.c_str());
         connection_info = new ConnectionInfo();
         connection_info->id       = id;
         connection_info->topic    = topic;
 
-        connections_[id] = connection_info;
-        topic_connection_ids_[topic] = id;
+        index_->connections[id] = connection_info;
+        index_->topic_connection_ids[topic] = id;
     }
     else
-        connection_info = connections_[topic_conn_id_iter->second];
+        connection_info = index_->connections[topic_conn_id_iter->second];
 
     connection_info->msg_def  = message_definition;
     connection_info->datatype = datatype;
@@ -779,6 +831,24 @@ void Bag::decompressChunk(uint64_t chunk_pos) const {
     if (decompressed_chunk_ == chunk_pos)
         return;
 
+    // Keep the current chunk, and reuse the cached one if there is one
+    if (decompressed_chunk_ != 0)
+        chunk_cache_.put(decompressed_chunk_, decompress_buffer_);
+    decompressed_chunk_ = 0;
+
+    if (chunk_cache_.take(chunk_pos, decompress_buffer_)) {
+        decompressed_chunk_ = chunk_pos;
+        return;
+    }
+
+    // Another process may have decompressed the chunk already
+    if (shared_chunk_cache_ && file_id_ == 0)
+        file_id_ = SharedChunkCache::getFileId(getFileName());
+    if (shared_chunk_cache_ && shared_chunk_cache_->get(file_id_, chunk_pos, decompress_buffer_)) {
+        decompressed_chunk_ = chunk_pos;
+        return;
+    }
+
     // Seek to the start of the chunk
     seek(chunk_pos);
 
@@ -797,6 +867,9 @@ void Bag::decompressChunk(uint64_t chunk_pos) const {
         throw BagFormatException("Unknown compression: " + chunk_header.compression);
     
     decompressed_chunk_ = chunk_pos;
+
+    if (shared_chunk_cache_)
+        shared_chunk_cache_->put(file_id_, chunk_pos, decompress_buffer_.getData(), decompress_buffer_.getSize());
 }
 
 void Bag::readMessageDataRecord102(uint64_t offset, ros::Header& header) const {
@@ -900,24 +973,44 @@ uint32_t Bag::readMessageDataSize(IndexEntry const& index_entry) const {
     }
 }
 
+void Bag::readMessageData(IndexEntry const& index_entry, uint8_t const*& data, uint32_t& data_size) const {
+    ros::Header header;
+    uint32_t bytes_read;
+    switch (version_)
+    {
+    case 200:
+        decompressChunk(index_entry.chunk_pos);
+        readMessageDataHeaderFromBuffer(*current_buffer_, index_entry.offset, header, data_size, bytes_read);
+        data = current_buffer_->getData() + index_entry.offset + bytes_read;
+        break;
+    case 102:
+        readMessageDataRecord102(index_entry.chunk_pos, header);
+        data      = record_buffer_.getData();
+        data_size = record_buffer_.getSize();
+        break;
+    default:
+        throw BagFormatException((format("Unhandled version: %1%") % version_).str());
+    }
+}
+
 void Bag::writeChunkInfoRecords() {
-    for (ChunkInfo const& chunk_info : chunks_) {
+    for (ChunkInfo const& chunk_info : index_->chunks) {
         // Write the chunk info header
-        M_string header;
         uint32_t chunk_connection_count = chunk_info.connection_counts.size();
-        header[OP_FIELD_NAME]         = toHeaderString(&OP_CHUNK_INFO);
-        header[VER_FIELD_NAME]        = toHeaderString(&CHUNK_INFO_VERSION);
-        header[CHUNK_POS_FIELD_NAME]  = toHeaderString(&chunk_info.pos);
-        header[START_TIME_FIELD_NAME] = toHeaderString(&chunk_info.start_time);
-        header[END_TIME_FIELD_NAME]   = toHeaderString(&chunk_info.end_time);
-        header[COUNT_FIELD_NAME]      = toHeaderString(&chunk_connection_count);
+        record_header_.clear();
+        record_header_.add(CHUNK_POS_FIELD_NAME,  &chunk_info.pos);
+        record_header_.add(COUNT_FIELD_NAME,      &chunk_connection_count);
+        record_header_.add(END_TIME_FIELD_NAME,   &chunk_info.end_time);
+        record_header_.add(OP_FIELD_NAME,         &OP_CHUNK_INFO);
+        record_header_.add(START_TIME_FIELD_NAME, &chunk_info.start_time);
+        record_header_.add(VER_FIELD_NAME,        &CHUNK_INFO_VERSION);
 
         LOG_DEBUG("Writing CHUNK_INFO [%llu]: ver=%d pos=%llu start=%d.%d end=%d.%d",
                   (unsigned long long) file_.getOffset(), CHUNK_INFO_VERSION, (unsigned long long) chunk_info.pos,
                   chunk_info.start_time.sec, chunk_info.start_time.nsec,
                   chunk_info.end_time.sec, chunk_info.end_time.nsec);
 
-        writeHeader(header);
+        writeHeader(record_header_);
 
         writeDataLength(8 * chunk_connection_count);
 
@@ -974,7 +1067,7 @@ void Bag::readChunkInfoRecord() {
         chunk_info.connection_counts[connection_id] = connection_count;
     }
 
-    chunks_.push_back(chunk_info);
+    index_->chunks.push_back(chunk_info);
 }
 
 // Record I/O
@@ -986,11 +1079,12 @@ bool Bag::isOp(M_string& fields, uint8_t reqOp) const {
 }
 
 void Bag::writeHeader(M_string const& fields) {
-    boost::shared_array<uint8_t> header_buffer;
-    uint32_t header_len;
-    ros::Header::write(fields, header_buffer, header_len);
-    write((char*) &header_len, 4);
-    write((char*) header_buffer.get(), header_len);
+    record_header_.assign(fields);
+    writeHeader(record_header_);
+}
+
+void Bag::writeHeader(RecordHeader const& header) {
+    write((char const*) header.getData(), header.getSize());
 }
 
 void Bag::writeDataLength(uint32_t data_len) {
@@ -998,17 +1092,19 @@ void Bag::writeDataLength(uint32_t data_len) {
 }
 
 void Bag::appendHeaderToBuffer(Buffer& buf, M_string const& fields) {
-    boost::shared_array<uint8_t> header_buffer;
-    uint32_t header_len;
-    ros::Header::write(fields, header_buffer, header_len);
+    uint32_t offset = buf.getSize();
+
+    buf.setSize(buf.getSize() + RecordHeader::getEncodedSize(fields));
+
+    RecordHeader::encode(fields, buf.getData() + offset);
+}
 
+void Bag::appendHeaderToBuffer(Buffer& buf, RecordHeader const& header) {
     uint32_t offset = buf.getSize();
 
-    buf.setSize(buf.getSize() + 4 + header_len);
+    buf.setSize(buf.getSize() + header.getSize());
 
-    memcpy(buf.getData() + offset, &header_len, 4);
-    offset += 4;
-    memcpy(buf.getData() + offset, header_buffer.get(), header_len);
+    memcpy(buf.getData() + offset, header.getData(), header.getSize());
 }
 
 void Bag::appendDataLengthToBuffer(Buffer& buf, uint32_t data_len) {
@@ -1156,19 +1252,21 @@ void Bag::swap(Bag& other) {
     swap(chunk_open_, other.chunk_open_);
     swap(curr_chunk_info_, other.curr_chunk_info_);
     swap(curr_chunk_data_pos_, other.curr_chunk_data_pos_);
-    swap(topic_connection_ids_, other.topic_connection_ids_);
-    swap(header_connection_ids_, other.header_connection_ids_);
-    swap(connections_, other.connections_);
-    swap(chunks_, other.chunks_);
-    swap(connection_indexes_, other.connection_indexes_);
+    swap(index_, other.index_);
     swap(curr_chunk_connection_indexes_, other.curr_chunk_connection_indexes_);
     swap(header_buffer_, other.header_buffer_);
     swap(record_buffer_, other.record_buffer_);
+    swap(record_header_, other.record_header_);
+    swap(record_stream_, other.record_stream_);
+    swap(record_segments_, other.record_segments_);
     swap(chunk_buffer_, other.chunk_buffer_);
     swap(decompress_buffer_, other.decompress_buffer_);
     swap(outgoing_chunk_buffer_, other.outgoing_chunk_buffer_);
     swap(current_buffer_, other.current_buffer_);
     swap(decompressed_chunk_, other.decompressed_chunk_);
+    swap(chunk_cache_, other.chunk_cache_);
+    swap(shared_chunk_cache_, other.shared_chunk_cache_);
+    swap(file_id_, other.file_id_);
     swap(encryptor_, other.encryptor_);
 }
 
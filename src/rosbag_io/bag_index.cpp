@@ -0,0 +1,130 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/bag_index.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
+using std::map;
+using std::string;
+
+namespace rosbag_io {
+namespace rosbag {
+
+// BagIndex
+
+BagIndex::BagIndex() : index_data_pos(0), connection_count(0), chunk_count(0) { }
+
+BagIndex::~BagIndex() {
+    for (map<uint32_t, ConnectionInfo*>::iterator i = connections.begin(); i != connections.end(); i++)
+        delete i->second;
+}
+
+// BagIndexRegistry
+
+typedef map<BagIndexRegistry::Key, boost::weak_ptr<BagIndex> > Indexes;
+
+static boost::mutex& getMutex() {
+    static boost::mutex mutex;
+    return mutex;
+}
+
+static Indexes& getIndexes() {
+    static Indexes indexes;
+    return indexes;
+}
+
+static bool registry_enabled = true;
+
+bool BagIndexRegistry::Key::operator<(Key const& other) const {
+    if (path != other.path)
+        return path < other.path;
+    if (size != other.size)
+        return size < other.size;
+    return mtime < other.mtime;
+}
+
+bool BagIndexRegistry::getKey(string const& filename, Key& key) {
+    boost::system::error_code error;
+    boost::filesystem::path path = boost::filesystem::canonical(filename, error);
+    if (error)
+        return false;
+
+    key.path = path.string();
+    key.size = boost::filesystem::file_size(path, error);
+    if (error)
+        return false;
+    key.mtime = boost::filesystem::last_write_time(path, error);
+    return !error;
+}
+
+boost::shared_ptr<BagIndex> BagIndexRegistry::find(Key const& key) {
+    boost::lock_guard<boost::mutex> lock(getMutex());
+
+    Indexes::const_iterator i = getIndexes().find(key);
+    return i != getIndexes().end() ? i->second.lock() : boost::shared_ptr<BagIndex>();
+}
+
+void BagIndexRegistry::add(Key const& key, boost::shared_ptr<BagIndex> const& index) {
+    boost::lock_guard<boost::mutex> lock(getMutex());
+
+    // Forget the indexes no Bag uses anymore
+    Indexes& indexes = getIndexes();
+    for (Indexes::iterator i = indexes.begin(); i != indexes.end(); ) {
+        if (i->second.expired())
+            indexes.erase(i++);
+        else
+            ++i;
+    }
+    indexes[key] = index;
+}
+
+void BagIndexRegistry::setEnabled(bool enabled) {
+    boost::lock_guard<boost::mutex> lock(getMutex());
+    registry_enabled = enabled;
+}
+
+bool BagIndexRegistry::isEnabled() {
+    boost::lock_guard<boost::mutex> lock(getMutex());
+    return registry_enabled;
+}
+
+size_t BagIndexRegistry::getSize() {
+    boost::lock_guard<boost::mutex> lock(getMutex());
+
+    size_t size = 0;
+    for (Indexes::const_iterator i = getIndexes().begin(); i != getIndexes().end(); i++)
+        if (!i->second.expired())
+            size++;
+    return size;
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -1,4 +1,11 @@
 #include "rosbag_io/rosbag/bag_player.h"
+#include "rosbag_io/rosbag/chunk_reader.h"
+
+#include <deque>
+#include <set>
+
+#include <boost/optional.hpp>
+#include <boost/scoped_ptr.hpp>
 
 namespace rosbag_io
 {
@@ -13,13 +20,55 @@ BagPlayer::BagPlayer(const std::string &fname) {
     bag_end_ = v.getEndTime();
     last_message_time_ = ros::Time(0);
     playback_speed_ = 1.0;
+    read_ahead_instantiate_ = true;
+    chunk_cache_size_ = 0;
+    paused_ = false;
+    stop_requested_ = false;
+    seek_requested_ = false;
+    steps_ = 0;
+    loop_ = false;
+    paused_at_ = bag_start_;
+    clock_time_ = bag_start_;
+    anchor_time_ = bag_start_;
+    anchor_wall_ = PlaybackScheduler::now();
 }
 
 BagPlayer::~BagPlayer() {
     bag.close();
+    for (const auto& extra : extra_bags_)
+        extra->close();
+}
+
+/* Shift a time by an offset, within the range of ros::Time */
+static ros::Time shift(const ros::Time &time, const ros::Duration &offset) {
+    int64_t nsec = (int64_t) time.toNSec() + offset.toNSec();
+    if (nsec < (int64_t) ros::TIME_MIN.toNSec())
+        return ros::TIME_MIN;
+    if ((uint64_t) nsec > ros::TIME_MAX.toNSec())
+        return ros::TIME_MAX;
+    return ros::Time().fromNSec(nsec);
+}
+
+void BagPlayer::add_bag(const std::string &filename, const ros::Duration &offset) {
+    boost::shared_ptr<Bag> extra = boost::make_shared<Bag>(filename, bagmode::Read);
+    extra->setChunkCacheSize(chunk_cache_size_);
+
+    View v(*extra);
+    if (v.size() > 0) {
+        ros::Time start = shift(v.getBeginTime(), offset);
+        ros::Time end = shift(v.getEndTime(), offset);
+        if (start < bag_start_)
+            bag_start_ = start;
+        if (end > bag_end_)
+            bag_end_ = end;
+    }
+
+    extra_bags_.push_back(extra);
+    extra_offsets_.push_back(offset);
 }
 
 ros::Time BagPlayer::get_time() {
+    boost::lock_guard<boost::mutex> lock(control_mutex_);
     return last_message_time_;
 }
 
@@ -32,12 +81,459 @@ void BagPlayer::set_end(const ros::Time &end) {
 }
 
 void BagPlayer::set_playback_speed(double scale) {
-  if (scale > 0.0)
-    playback_speed_ = scale;
+  if (scale <= 0.0)
+    return;
+
+  boost::lock_guard<boost::mutex> lock(control_mutex_);
+  if (!paused_) {
+    /* Keep the current position: only the time to come is scaled */
+    int64_t now = PlaybackScheduler::now();
+    anchor_time_ = bag_time(now);
+    anchor_wall_ = now;
+  }
+  playback_speed_ = scale;
+  control_changed_.notify_all();
+}
+
+void BagPlayer::pause() {
+    boost::lock_guard<boost::mutex> lock(control_mutex_);
+    if (paused_)
+        return;
+    /* A clock, rather than the anchors, paces playback */
+    paused_at_ = clock_ ? clock_time_ : bag_time(PlaybackScheduler::now());
+    paused_ = true;
+    control_changed_.notify_all();
+    if (clock_)
+        clock_->interrupt();
+}
+
+void BagPlayer::resume() {
+    boost::lock_guard<boost::mutex> lock(control_mutex_);
+    if (!paused_)
+        return;
+    anchor_time_ = paused_at_;
+    anchor_wall_ = PlaybackScheduler::now();
+    paused_ = false;
+    control_changed_.notify_all();
+    if (clock_) {
+        clock_time_ = paused_at_;
+        clock_->resume(paused_at_);
+    }
+}
+
+bool BagPlayer::is_paused() {
+    boost::lock_guard<boost::mutex> lock(control_mutex_);
+    return paused_;
+}
+
+void BagPlayer::step() {
+    boost::lock_guard<boost::mutex> lock(control_mutex_);
+    if (!paused_)
+        return;
+    steps_++;
+    control_changed_.notify_all();
+}
+
+void BagPlayer::seek(const ros::Time &time) {
+    boost::lock_guard<boost::mutex> lock(control_mutex_);
+    seek_time_ = time;
+    seek_requested_ = true;
+    control_changed_.notify_all();
+    if (clock_)
+        clock_->interrupt();
+}
+
+void BagPlayer::set_loop(bool loop) {
+    boost::lock_guard<boost::mutex> lock(control_mutex_);
+    loop_ = loop;
+}
+
+void BagPlayer::stop() {
+    boost::lock_guard<boost::mutex> lock(control_mutex_);
+    stop_requested_ = true;
+    control_changed_.notify_all();
+    if (clock_)
+        clock_->interrupt();
+    /* Do not leave playback blocked on a full callback queue */
+    for (CallbackExecutor *executor : running_executors_)
+        executor->cancel();
+}
+
+void BagPlayer::set_clock(const boost::shared_ptr<PlaybackClock> &clock) {
+    boost::lock_guard<boost::mutex> lock(control_mutex_);
+    clock_ = clock;
+}
+
+void BagPlayer::set_chunk_cache_size(uint64_t size) {
+    chunk_cache_size_ = size;
+    bag.setChunkCacheSize(size);
+    for (const auto& extra : extra_bags_)
+        extra->setChunkCacheSize(size);
+}
+
+void BagPlayer::set_spin_tail(const ros::WallDuration &tail) {
+    scheduler_.setSpinTail(tail);
+}
+
+const LatenessHistogram &BagPlayer::get_lateness() const {
+    return scheduler_.getLateness();
+}
+
+/* Messages read ahead are never more than this many */
+static const size_t MAX_READ_AHEAD_MESSAGES = 10000;
+/* Horizon of each bag when several are played without set_read_ahead */
+static const int32_t DEFAULT_MULTI_BAG_READ_AHEAD_NS = 100000000;
+
+/* How long before a deadline to stop waiting for the controls, and
+   leave the rest of the wait to the scheduler */
+static const int64_t CONTROL_WAIT_MARGIN_NS = 1000000;
+
+/* Messages are due at absolute times on the monotonic clock, so that
+   oversleeping for one message does not delay the following ones.  The
+   clock is anchored again on every seek, resume and change of speed. */
+int64_t BagPlayer::deadline(const ros::Time &msg_time) const {
+  return anchor_wall_ + (int64_t) ((msg_time - anchor_time_).toNSec() / playback_speed_);
+}
+
+ros::Time BagPlayer::bag_time(int64_t now) const {
+  return anchor_time_ + ros::Duration().fromNSec((int64_t) ((now - anchor_wall_) * playback_speed_));
+}
+
+void BagPlayer::anchor(const ros::Time &time) {
+    boost::shared_ptr<PlaybackClock> clock;
+    {
+        boost::lock_guard<boost::mutex> lock(control_mutex_);
+        anchor_time_ = time;
+        anchor_wall_ = PlaybackScheduler::now();
+        if (paused_)
+            paused_at_ = time;
+        clock_time_ = time;
+        clock = clock_;
+    }
+    if (clock)
+        clock->begin(time);
+}
+
+/* Wait until a message is due, or for a step while paused.  Returns
+   false if playback has to stop or seek instead. */
+bool BagPlayer::wait_for(const ros::Time &msg_time) {
+    boost::unique_lock<boost::mutex> lock(control_mutex_);
+    while (true) {
+        if (stop_requested_ || seek_requested_)
+            return false;
+
+        if (paused_) {
+            if (steps_ > 0) {
+                steps_--;
+                paused_at_ = msg_time;
+                last_message_time_ = msg_time;
+                if (clock_) {
+                    clock_time_ = msg_time;
+                    clock_->resume(msg_time);
+                }
+                return true;
+            }
+            control_changed_.wait(lock);
+            continue;
+        }
+
+        if (clock_) {
+            /* The clock is interrupted by the controls */
+            boost::shared_ptr<PlaybackClock> clock = clock_;
+            lock.unlock();
+            bool due = clock->waitUntil(msg_time);
+            lock.lock();
+            if (due) {
+                last_message_time_ = msg_time;
+                clock_time_ = msg_time;
+                return true;
+            }
+            continue;
+        }
+
+        int64_t remaining = deadline(msg_time) - PlaybackScheduler::now() - CONTROL_WAIT_MARGIN_NS;
+        if (remaining <= 0)
+            break;
+        control_changed_.timed_wait(lock, boost::posix_time::microseconds(remaining / 1000 + 1));
+    }
+    int64_t due = deadline(msg_time);
+    lock.unlock();
+
+    scheduler_.waitUntil(due);
+
+    lock.lock();
+    last_message_time_ = msg_time; /* this is the recorded time */
+    return true;
+}
+
+void BagPlayer::set_callback_group(const std::string &topic, const std::string &group,
+                                   uint32_t queue_size, OverflowPolicy policy) {
+    topic_groups_[topic] = group;
+    CallbackGroup &g = groups_[group];
+    g.queue_size = queue_size;
+    g.policy = policy;
+}
+
+std::map<std::string, CallbackQueueStats> BagPlayer::get_queue_stats() const {
+    return queue_stats_;
+}
+
+void BagPlayer::set_read_ahead(const ros::Duration &horizon, bool instantiate) {
+    read_ahead_ = horizon;
+    read_ahead_instantiate_ = instantiate;
+}
+
+/* Reads messages on a thread of its own, up to a horizon (in playback
+   time) ahead of the message being played */
+class BagPlayer::ReadAhead
+{
+public:
+    typedef boost::function<PendingMessage (const MessageInstance &)> Prepare;
+
+    ReadAhead(ChunkReader &chunk_reader, const View::iterator &begin, const View::iterator &end,
+              const Prepare &prepare, const ros::Duration &horizon, bool instantiate,
+              const ros::Duration &offset, const ros::Time &playing) :
+        chunk_reader_(chunk_reader), begin_(begin), end_(end), prepare_(prepare),
+        horizon_(horizon), instantiate_(instantiate), offset_(offset), playing_(playing),
+        primed_(false), done_(false), stop_(false)
+    {
+        thread_ = boost::thread(boost::bind(&ReadAhead::run, this));
+    }
+
+    ~ReadAhead() {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            stop_ = true;
+            changed_.notify_all();
+        }
+        thread_.join();
+    }
+
+    /* Wait until the queue covers the horizon */
+    void wait_primed() {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (!primed_ && !done_)
+            changed_.wait(lock);
+    }
+
+    /* Get the next message, or nothing at the end.  Rethrows the error
+       of the reader once the messages read before it are played. */
+    boost::optional<PendingMessage> pop() {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (queue_.empty() && !done_)
+            changed_.wait(lock);
+        if (queue_.empty()) {
+            if (error_)
+                std::rethrow_exception(error_);
+            return boost::optional<PendingMessage>();
+        }
+
+        boost::optional<PendingMessage> pending(queue_.front());
+        queue_.pop_front();
+        return pending;
+    }
+
+    /* Let the reader know the time of the message being played */
+    void set_playing(const ros::Time &time) {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        playing_ = time;
+        changed_.notify_all();
+    }
+
+private:
+    void run() {
+        try {
+            /* Only the index is shared with the playback thread: the
+               messages are read through a file handle of our own */
+            for (View::iterator i = begin_; i != end_; ++i) {
+                const MessageInstance &m = *i;
+                ros::Time time = shift(m.getTime(), offset_);
+                PendingMessage pending = prepare_(m);
+
+                const uint8_t *data;
+                uint32_t size;
+                chunk_reader_.readMessageData(m.getIndexEntry(), data, size);
+
+                shared_.clear();
+                for (const Subscriber &subscriber : pending.dispatch->subscribers)
+                    pending.calls.push_back(subscriber.cb->bind(m, data, size, instantiate_, shared_));
+
+                /* The message after a gap longer than the horizon is still
+                   queued when the queue runs empty, or playback would wait
+                   for it forever */
+                boost::unique_lock<boost::mutex> lock(mutex_);
+                while (!stop_ && !queue_.empty() &&
+                       (queue_.size() >= MAX_READ_AHEAD_MESSAGES || time - playing_ > horizon_)) {
+                    primed_ = true;
+                    changed_.notify_all();
+                    changed_.wait(lock);
+                }
+                if (stop_)
+                    return;
+                queue_.push_back(pending);
+                changed_.notify_all();
+            }
+        }
+        catch (...) {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            error_ = std::current_exception();
+        }
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        done_ = true;
+        changed_.notify_all();
+    }
+
+    ChunkReader &chunk_reader_;
+    View::iterator begin_;
+    View::iterator end_;
+    Prepare prepare_;
+    ros::Duration horizon_;
+    bool instantiate_;
+    ros::Duration offset_;   /* added to the recorded times */
+    SharedMessages shared_;
+
+    boost::mutex mutex_;
+    boost::condition_variable changed_;
+    std::deque<PendingMessage> queue_;
+    ros::Time playing_;
+    bool primed_;   /* the queue covers the horizon */
+    bool done_;
+    bool stop_;
+    std::exception_ptr error_;
+    boost::thread thread_;
+};
+
+/* A bag of the playback, with its messages to play and its position */
+class BagPlayer::Source
+{
+public:
+    Source(const Bag &bag, const ros::Duration &offset) :
+        bag(bag), offset(offset)
+    {}
+
+    PendingMessage prepare(const MessageInstance &m) const {
+        return PendingMessage(m, &dispatch[m.getConnectionInfo()->id]);
+    }
+
+    /* Move the head to the next message to play */
+    void advance() {
+        head.reset();
+        if (reader) {
+            boost::optional<PendingMessage> pending = reader->pop();
+            if (pending)
+                head.emplace(std::move(*pending));
+        }
+        else if (i != view->end()) {
+            head.emplace(prepare(*i));
+            ++i;
+        }
+    }
+
+    /* Get the time the head is played at */
+    ros::Time head_time() const {
+        return shift(head->message.getTime(), offset);
+    }
+
+    const Bag &bag;
+    ros::Duration offset;   /* added to the recorded times */
+    boost::scoped_ptr<View> view;
+    std::vector<Dispatch> dispatch;
+    boost::scoped_ptr<ChunkReader> chunk_reader;   /* kept with its chunk cache across seeks */
+
+    View::iterator i;
+    boost::scoped_ptr<ReadAhead> reader;
+    boost::optional<PendingMessage> head;
+};
+
+/* Open a view on each bag, with the callbacks of its connections */
+void BagPlayer::open_sources(const std::vector<std::string> &topics,
+                             const std::map<std::string, CallbackExecutor*> &topic_executors,
+                             bool chunk_readers, std::vector<boost::shared_ptr<Source> > &sources,
+                             std::vector<BatchSubscriber> &batches) {
+    std::vector<std::pair<const Bag*, ros::Duration> > bags;
+    bags.push_back(std::make_pair(&bag, ros::Duration(0)));
+    for (size_t i = 0; i < extra_bags_.size(); i++)
+        bags.push_back(std::make_pair(extra_bags_[i].get(), extra_offsets_[i]));
+
+    for (const auto& b : bags) {
+        boost::shared_ptr<Source> source = boost::make_shared<Source>(*b.first, b.second);
+        source->view.reset(new View(*b.first, TopicQuery(topics),
+                                    shift(bag_start_, -b.second), shift(bag_end_, -b.second)));
+        build_dispatch(*source->view, topic_executors, source->dispatch, batches);
+        if (chunk_readers) {
+            source->chunk_reader.reset(new ChunkReader(*b.first));
+            source->chunk_reader->setCacheSize(chunk_cache_size_);
+        }
+        sources.push_back(source);
+    }
 }
 
-ros::Time BagPlayer::real_time(const ros::Time &msg_time) {
-  return play_start_ + (msg_time - bag_start_) * (1 / playback_speed_);
+void BagPlayer::deliver(PendingMessage &pending, SharedMessages &shared) {
+    shared.clear();
+
+    const std::vector<Subscriber> &subscribers = pending.dispatch->subscribers;
+    for (size_t i = 0; i < subscribers.size(); i++) {
+        const Subscriber &subscriber = subscribers[i];
+
+        boost::function<void ()> call;
+        if (i < pending.calls.size())
+            call.swap(pending.calls[i]);
+
+        if (subscriber.executor) {
+            if (!call)
+                call = subscriber.cb->bind(pending.message, shared);
+            if (call) {
+                subscriber.executor->push(call);
+                continue;
+            }
+        }
+        else if (call) {
+            call();
+            continue;
+        }
+
+        subscriber.cb->call(pending.message, shared);
+    }
+}
+
+/* Resolve the callbacks of each connection of the view once, rather
+   than by topic for every message */
+void BagPlayer::build_dispatch(View &view, const std::map<std::string, CallbackExecutor*> &topic_executors,
+                               std::vector<Dispatch> &dispatch, std::vector<BatchSubscriber> &batches) {
+    for (const ConnectionInfo *connection : view.getConnections()) {
+        if (connection->id >= dispatch.size())
+            dispatch.resize(connection->id + 1);
+        Dispatch &d = dispatch[connection->id];
+
+        CallbackExecutor *executor = NULL;
+        std::map<std::string, CallbackExecutor*>::const_iterator e = topic_executors.find(connection->topic);
+        if (e != topic_executors.end())
+            executor = e->second;
+
+        std::map<std::string, std::vector<boost::shared_ptr<BagCallback> > >::const_iterator cbs = cbs_.find(connection->topic);
+        if (cbs != cbs_.end()) {
+            for (const auto& cb : cbs->second) {
+                Subscriber subscriber = { cb.get(), executor };
+                d.subscribers.push_back(subscriber);
+            }
+        }
+
+        /* The batches of a topic gather the messages of all its connections, in every bag */
+        std::map<std::string, std::vector<boost::shared_ptr<BagBatchCallback> > >::const_iterator batch_cbs = batch_cbs_.find(connection->topic);
+        if (batch_cbs != batch_cbs_.end()) {
+            for (const auto& cb : batch_cbs->second) {
+                size_t index = 0;
+                while (index < batches.size() && batches[index].cb != cb.get())
+                    index++;
+                if (index == batches.size()) {
+                    BatchSubscriber batch = { cb.get(), cb->reads_bag() ? NULL : executor, 0 };
+                    batches.push_back(batch);
+                }
+                d.batches.push_back(index);
+            }
+        }
+    }
 }
 
 void BagPlayer::start_play() {
@@ -46,25 +542,409 @@ void BagPlayer::start_play() {
     for (const auto& cb : cbs_)
         topics.push_back(cb.first);
 
-    View view(bag, TopicQuery(topics), bag_start_, bag_end_);
-    play_start_ = ros::Time::now();
+    Executors executors;
+    std::map<std::string, CallbackExecutor*> topic_executors;
+    start_executors(executors, topic_executors);
+
+    SharedMessages shared;
+
+    {
+        boost::lock_guard<boost::mutex> lock(control_mutex_);
+        stop_requested_ = false;
+        seek_requested_ = false;
+        steps_ = 0;
+    }
+    scheduler_.resetLateness();
+
+    std::exception_ptr error;
+
+    try {
+        /* Several bags are always read ahead, so that one bag does not
+           hold the others back */
+        bool read_ahead = read_ahead_ > ros::Duration(0) || !extra_bags_.empty();
+        if (bag.getMajorVersion() != 2)
+            read_ahead = false;
+        for (const auto& extra : extra_bags_)
+            if (extra->getMajorVersion() != 2)
+                read_ahead = false;
+        ros::Duration horizon = read_ahead_ > ros::Duration(0) ? read_ahead_ : ros::Duration(0, DEFAULT_MULTI_BAG_READ_AHEAD_NS);
+
+        std::vector<boost::shared_ptr<Source> > sources;
+        std::vector<BatchSubscriber> batches;
+        open_sources(topics, topic_executors, read_ahead, sources, batches);
+
+        /* Play from a position until the end, a seek or a stop */
+        ros::Time from = bag_start_;
+        while (true) {
+            for (const auto& source : sources) {
+                source->i = source->view->seek(shift(from, -source->offset));
+                if (read_ahead) {
+                    Source *s = source.get();
+                    source->reader.reset(new ReadAhead(*source->chunk_reader, source->i, source->view->end(),
+                                                       [s](const MessageInstance &m) { return s->prepare(m); },
+                                                       horizon, read_ahead_instantiate_, source->offset, from));
+                }
+            }
+
+            /* Start the clock once the first messages are ready */
+            for (const auto& source : sources)
+                if (source->reader)
+                    source->reader->wait_primed();
+            anchor(from);
+
+            for (const auto& source : sources)
+                source->advance();
+
+            bool played = false;
+            while (true) {
+                /* Merge the bags in time */
+                Source *next = NULL;
+                for (const auto& source : sources)
+                    if (source->head && (!next || source->head_time() < next->head_time()))
+                        next = source.get();
+                if (!next)
+                    break;
+
+                const ros::Time time = next->head_time();
+                if (!wait_for(time))
+                    break;
+                for (const auto& source : sources)
+                    if (source->reader)
+                        source->reader->set_playing(time);
+
+                deliver(*next->head, shared);
+                played = true;
+                next->advance();
+            }
+
+            for (const auto& source : sources) {
+                source->reader.reset();
+                source->head.reset();
+            }
+
+            boost::lock_guard<boost::mutex> lock(control_mutex_);
+            if (stop_requested_)
+                break;
+            if (seek_requested_) {
+                from = seek_time_;
+                seek_requested_ = false;
+                continue;
+            }
+            /* Do not loop over an empty range forever */
+            if (loop_ && (played || from != bag_start_)) {
+                from = bag_start_;
+                continue;
+            }
+            break;
+        }
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
 
-    for (MessageInstance const& m : view)
     {
-        if (cbs_.find(m.getTopic()) == cbs_.end())
+        boost::lock_guard<boost::mutex> lock(control_mutex_);
+        if (clock_)
+            clock_->end();
+    }
+
+    drain_executors(executors, error);
+    if (error)
+        std::rethrow_exception(error);
+}
+
+static const size_t MAX_UNPACED_CALLS = 1024;
+
+/* Call a callback that reads the message from the bag itself */
+static void call_unshared(BagCallback *cb, const MessageInstance &m) {
+    SharedMessages shared;
+    cb->call(m, shared);
+}
+
+void BagPlayer::start_play_unpaced(uint32_t batch_size) {
+    if (batch_size == 0)
+        batch_size = 1;
+
+    std::set<std::string> topic_set;
+    for (const auto& cb : cbs_)
+        topic_set.insert(cb.first);
+    for (const auto& cb : batch_cbs_)
+        topic_set.insert(cb.first);
+    std::vector<std::string> topics(topic_set.begin(), topic_set.end());
+
+    Executors executors;
+    std::map<std::string, CallbackExecutor*> topic_executors;
+    start_executors(executors, topic_executors);
+
+    /* A call ready to be made, on the playback thread unless it has an
+       executor */
+    struct Call
+    {
+        boost::function<void ()> call;
+        CallbackExecutor *executor;
+        uint32_t messages;
+        uint64_t bytes;
+        bool batch;
+    };
+
+    throughput_ = PlaybackThroughput();
+    int64_t start = PlaybackScheduler::now();
+
+    {
+        boost::lock_guard<boost::mutex> lock(control_mutex_);
+        stop_requested_ = false;
+    }
+
+    std::exception_ptr error;
+
+    try {
+        /* Only bags of version 2.0 are read on a thread of their own;
+           older bags are read on the playback thread, through the bag */
+        bool chunk_readers = bag.getMajorVersion() == 2;
+        for (const auto& extra : extra_bags_)
+            if (extra->getMajorVersion() != 2)
+                chunk_readers = false;
+
+        std::vector<boost::shared_ptr<Source> > sources;
+        std::vector<BatchSubscriber> batches;
+        open_sources(topics, topic_executors, chunk_readers, sources, batches);
+
+        /* Read the bags in time, handing each call to emit until it
+           returns false */
+        auto read = [&](const boost::function<bool (const Call &)> &emit) {
+            auto take_batch = [&](BatchSubscriber &batch) {
+                Call call;
+                call.messages = batch.cb->size();
+                call.bytes = batch.bytes;
+                call.batch = true;
+                call.executor = batch.executor;
+                call.call = batch.cb->take();
+                batch.bytes = 0;
+                return call;
+            };
+
+            SharedMessages shared;
+            std::vector<uint8_t> buffer;
+            for (const auto& source : sources)
+                source->i = source->view->begin();
+
+            while (true) {
+                /* Merge the bags in time */
+                Source *next = NULL;
+                ros::Time next_time;
+                for (const auto& source : sources) {
+                    if (source->i == source->view->end())
+                        continue;
+                    ros::Time time = shift(source->i->getTime(), source->offset);
+                    if (!next || time < next_time) {
+                        next = source.get();
+                        next_time = time;
+                    }
+                }
+                if (!next)
+                    break;
+
+                const MessageInstance &m = *next->i;
+                const Dispatch &d = next->dispatch[m.getConnectionInfo()->id];
+
+                const uint8_t *data;
+                uint32_t size;
+                if (next->chunk_reader) {
+                    next->chunk_reader->readMessageData(m.getIndexEntry(), data, size);
+                }
+                else {
+                    buffer.resize(m.size());
+                    ros::serialization::OStream stream(buffer.data(), buffer.size());
+                    m.write(stream);
+                    data = buffer.data();
+                    size = buffer.size();
+                }
+
+                /* The data is only used until the calls are bound */
+                for (size_t index : d.batches) {
+                    BatchSubscriber &batch = batches[index];
+                    batch.cb->add(m, data, size);
+                    batch.bytes += size;
+                    if (batch.cb->size() >= batch_size && !emit(take_batch(batch)))
+                        return;
+                }
+
+                shared.clear();
+                for (const Subscriber &subscriber : d.subscribers) {
+                    Call call;
+                    call.messages = 1;
+                    call.bytes = size;
+                    call.batch = false;
+                    call.executor = subscriber.executor;
+                    call.call = subscriber.cb->bind(m, data, size, true, shared);
+                    if (!call.call) {
+                        /* The callback reads from the bag itself */
+                        call.executor = NULL;
+                        call.call = boost::bind(&call_unshared, subscriber.cb, m);
+                    }
+                    if (!emit(call))
+                        return;
+                }
+                ++next->i;
+            }
+
+            for (BatchSubscriber &batch : batches)
+                if (batch.cb->size() > 0 && !emit(take_batch(batch)))
+                    return;
+        };
+
+        /* Make a call, and tell if the playback goes on */
+        auto make_call = [&](const Call &call) {
+            if (call.executor)
+                call.executor->push(call.call);
+            else
+                call.call();
+
+            throughput_.messages += call.messages;
+            throughput_.bytes += call.bytes;
+            if (call.batch)
+                throughput_.batches++;
+
+            boost::lock_guard<boost::mutex> control_lock(control_mutex_);
+            return !stop_requested_;
+        };
+
+        if (!chunk_readers) {
+            read(make_call);
+        }
+        else {
+            boost::mutex mutex;
+            boost::condition_variable changed;
+            std::deque<Call> queue;
+            bool done = false;
+            bool stop = false;
+            std::exception_ptr read_error;
+
+            boost::thread reader([&]() {
+                try {
+                    read([&](const Call &call) {
+                        boost::unique_lock<boost::mutex> lock(mutex);
+                        while (!stop && queue.size() >= MAX_UNPACED_CALLS)
+                            changed.wait(lock);
+                        if (stop)
+                            return false;
+                        queue.push_back(call);
+                        changed.notify_all();
+                        return true;
+                    });
+                }
+                catch (...) {
+                    boost::lock_guard<boost::mutex> lock(mutex);
+                    read_error = std::current_exception();
+                }
+
+                boost::lock_guard<boost::mutex> lock(mutex);
+                done = true;
+                changed.notify_all();
+            });
+
+            try {
+                while (true) {
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    while (queue.empty() && !done)
+                        changed.wait(lock);
+                    if (queue.empty())
+                        break;
+
+                    Call call = queue.front();
+                    queue.pop_front();
+                    changed.notify_all();
+                    lock.unlock();
+
+                    if (!make_call(call))
+                        break;
+                }
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+
+            {
+                boost::lock_guard<boost::mutex> lock(mutex);
+                stop = true;
+                changed.notify_all();
+            }
+            reader.join();
+
+            /* Errors of the callbacks come first, then those of the reader */
+            if (!error)
+                error = read_error;
+        }
+    }
+    catch (...) {
+        if (!error)
+            error = std::current_exception();
+    }
+
+    drain_executors(executors, error);
+
+    throughput_.seconds = (PlaybackScheduler::now() - start) / 1e9;
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+const PlaybackThroughput &BagPlayer::get_throughput() const {
+    return throughput_;
+}
+
+double PlaybackThroughput::get_messages_per_second() const {
+    return seconds > 0.0 ? messages / seconds : 0.0;
+}
+
+double PlaybackThroughput::get_bytes_per_second() const {
+    return seconds > 0.0 ? bytes / seconds : 0.0;
+}
+
+/* Start the threads of the callback groups in use */
+void BagPlayer::start_executors(Executors &executors, std::map<std::string, CallbackExecutor*> &topic_executors) {
+    for (const auto& group : topic_groups_) {
+        if (cbs_.find(group.first) == cbs_.end() && batch_cbs_.find(group.first) == batch_cbs_.end())
             continue;
 
-        ros::Time::sleepUntil(real_time(m.getTime()));
+        boost::shared_ptr<CallbackExecutor> &executor = executors[group.second];
+        if (!executor) {
+            const CallbackGroup &g = groups_[group.second];
+            executor = boost::make_shared<CallbackExecutor>(g.queue_size, g.policy);
+        }
+        topic_executors[group.first] = executor.get();
+    }
 
-        last_message_time_ = m.getTime(); /* this is the recorded time */
-        cbs_[m.getTopic()]->call(m);
+    boost::lock_guard<boost::mutex> lock(control_mutex_);
+    running_executors_.clear();
+    for (const auto& executor : executors)
+        running_executors_.push_back(executor.second.get());
+}
+
+/* Wait for the callback groups to finish, keeping the first error */
+void BagPlayer::drain_executors(const Executors &executors, std::exception_ptr &error) {
+    {
+        boost::lock_guard<boost::mutex> lock(control_mutex_);
+        running_executors_.clear();
+    }
+
+    queue_stats_.clear();
+    for (const auto& executor : executors) {
+        try {
+            executor.second->drain();
+        }
+        catch (...) {
+            if (!error)
+                error = std::current_exception();
+        }
+        queue_stats_[executor.first] = executor.second->getStats();
     }
 }
 
 void BagPlayer::unregister_callback(const std::string &topic) {
     cbs_.erase(topic);
+    batch_cbs_.erase(topic);
 }
 
 }
 }
-
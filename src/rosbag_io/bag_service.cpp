@@ -0,0 +1,678 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/bag_service.h"
+#include "rosbag_io/rosbag/chunk_reader.h"
+#include "rosbag_io/rosbag/query.h"
+#include "rosbag_io/rosbag/view.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <boost/bind/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+using std::map;
+using std::string;
+using std::vector;
+using boost::shared_ptr;
+
+namespace rosbag_io {
+namespace rosbag {
+
+// The protocol, in the byte order of the host.  The client sends one query:
+//
+//   OP_QUERY, filename, topic count, topics, start time, end time
+//
+// and the server answers with RECORD_HEADER, a RECORD_CHUNK per run of messages in the same chunk,
+// and RECORD_END, or with RECORD_ERROR at any point:
+//
+//   RECORD_HEADER: file id, shared chunk cache name, connection count, connections, message count
+//   RECORD_CHUNK:  chunk position, message count, whether the chunk is in the shared chunk cache
+//                  [client: whether it found the chunk there]
+//                  [if not: RECORD_PAYLOADS, size of the payloads]
+//                  messages: connection id, time, offset in the chunk [if not: size, payload]
+//   RECORD_ERROR:  message
+//
+// Errors are only sent between records, so the client finds RECORD_ERROR wherever it expects one.
+//
+// Times are sent as seconds and nanoseconds, strings as their size followed by their characters.
+
+static const uint32_t OP_QUERY        = 1;
+
+static const uint32_t RECORD_HEADER   = 1;
+static const uint32_t RECORD_CHUNK    = 2;
+static const uint32_t RECORD_END      = 3;
+static const uint32_t RECORD_ERROR    = 4;
+static const uint32_t RECORD_PAYLOADS = 5;
+
+static const size_t   RECEIVE_BUFFER_SIZE = 64 * 1024;
+static const uint64_t READER_CACHE_SIZE   = 4 * 1024 * 1024;
+
+// Queries come from any local process: sizes beyond these are refused before anything is allocated
+static const uint32_t MAX_QUERY_STRING_SIZE = 64 * 1024;
+static const uint32_t MAX_QUERY_TOPIC_COUNT = 64 * 1024;
+
+static const int ACCEPT_RETRY_DELAY_MS = 50;
+
+#if defined(MSG_NOSIGNAL)
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+static void sendAll(int fd, void const* data, size_t size) {
+    uint8_t const* p = static_cast<uint8_t const*>(data);
+    while (size > 0) {
+        ssize_t n = ::send(fd, p, size, SEND_FLAGS);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            throw BagIOException(string("Error sending to bag server socket: ") + strerror(errno));
+        p    += n;
+        size -= n;
+    }
+}
+
+static size_t receiveSome(int fd, void* data, size_t size) {
+    while (true) {
+        ssize_t n = ::recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw BagIOException(string("Error receiving from bag server socket: ") + strerror(errno));
+        if (n == 0)
+            throw BagIOException("Bag server socket closed");
+        return n;
+    }
+}
+
+static void receiveAll(int fd, void* data, size_t size) {
+    uint8_t* p = static_cast<uint8_t*>(data);
+    while (size > 0) {
+        size_t n = receiveSome(fd, p, size);
+        p    += n;
+        size -= n;
+    }
+}
+
+static uint32_t receiveUInt32(int fd) {
+    uint32_t value;
+    receiveAll(fd, &value, sizeof(value));
+    return value;
+}
+
+static string receiveString(int fd, uint32_t max_size) {
+    uint32_t size = receiveUInt32(fd);
+    if (size > max_size)
+        throw BagException("Bag server query string too long");
+
+    string value(size, '\0');
+    if (!value.empty())
+        receiveAll(fd, &value[0], value.size());
+    return value;
+}
+
+static void put(vector<uint8_t>& out, void const* data, size_t size) {
+    out.insert(out.end(), static_cast<uint8_t const*>(data), static_cast<uint8_t const*>(data) + size);
+}
+
+static void putUInt32(vector<uint8_t>& out, uint32_t value) { put(out, &value, sizeof(value)); }
+static void putUInt64(vector<uint8_t>& out, uint64_t value) { put(out, &value, sizeof(value)); }
+
+static void putString(vector<uint8_t>& out, string const& value) {
+    putUInt32(out, value.size());
+    put(out, value.data(), value.size());
+}
+
+static void flush(int fd, vector<uint8_t>& out) {
+    if (!out.empty())
+        sendAll(fd, &out[0], out.size());
+    out.clear();
+}
+
+static sockaddr_un getAddress(string const& socket_path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+        throw BagIOException("Bag server socket path is too long: " + socket_path);
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+// BagServer
+
+BagServer::BagServer(string const& socket_path, shared_ptr<SharedChunkCache> const& cache)
+    : socket_path_(socket_path), cache_(cache), listen_fd_(-1), stopping_(false), query_count_(0)
+{
+    sockaddr_un address = getAddress(socket_path);
+
+    listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd_ < 0)
+        throw BagIOException(string("Error creating bag server socket: ") + strerror(errno));
+
+    ::unlink(socket_path.c_str());
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || ::listen(listen_fd_, SOMAXCONN) < 0) {
+        string error = strerror(errno);
+        ::close(listen_fd_);
+        throw BagIOException("Error listening on " + socket_path + ": " + error);
+    }
+
+    accept_thread_ = boost::thread(boost::bind(&BagServer::accept, this));
+}
+
+BagServer::~BagServer() {
+    stop();
+}
+
+void BagServer::stop() {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        if (stopping_)
+            return;
+        stopping_ = true;
+    }
+
+    // Wake the accepting thread, then abort the queries
+    ::shutdown(listen_fd_, SHUT_RDWR);
+    accept_thread_.join();
+    ::close(listen_fd_);
+    ::unlink(socket_path_.c_str());
+
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    for (std::set<int>::const_iterator i = clients_.begin(); i != clients_.end(); i++)
+        ::shutdown(*i, SHUT_RDWR);
+    while (!clients_.empty())
+        served_.wait(lock);
+    bags_.clear();
+}
+
+string BagServer::getSocketPath() const { return socket_path_; }
+
+size_t BagServer::getBagCount() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return bags_.size();
+}
+
+uint64_t BagServer::getQueryCount() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return query_count_;
+}
+
+void BagServer::closeBags() {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    for (map<string, shared_ptr<Bag> >::iterator i = bags_.begin(); i != bags_.end(); ) {
+        if (i->second.unique())
+            bags_.erase(i++);
+        else
+            ++i;
+    }
+}
+
+void BagServer::accept() {
+    while (true) {
+        int fd = ::accept(listen_fd_, NULL, NULL);
+        if (fd < 0) {
+            int error = errno;
+            {
+                boost::lock_guard<boost::mutex> lock(mutex_);
+                if (stopping_)
+                    return;
+            }
+            // Other errors, such as running out of descriptors, persist for a while: back off
+            if (error != EINTR && error != ECONNABORTED)
+                boost::this_thread::sleep(boost::posix_time::milliseconds(ACCEPT_RETRY_DELAY_MS));
+            continue;
+        }
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        if (stopping_) {
+            ::close(fd);
+            return;
+        }
+        clients_.insert(fd);
+        query_count_++;
+        boost::thread(boost::bind(&BagServer::serve, this, fd)).detach();
+    }
+}
+
+shared_ptr<Bag> BagServer::getBag(string const& filename) {
+    // A bag changed since it was opened is opened again
+    BagIndexRegistry::Key key;
+    if (!BagIndexRegistry::getKey(filename, key))
+        throw BagIOException("Error opening file: " + filename);
+    string name = (boost::format("%1%:%2%:%3%") % key.path % key.size % key.mtime).str();
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        map<string, shared_ptr<Bag> >::const_iterator i = bags_.find(name);
+        if (i != bags_.end())
+            return i->second;
+    }
+
+    shared_ptr<Bag> bag = boost::make_shared<Bag>(key.path);
+
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    shared_ptr<Bag>& kept = bags_[name];
+    if (!kept)
+        kept = bag;
+    return kept;
+}
+
+void BagServer::serve(int fd) {
+    vector<uint8_t> out;
+    try {
+        if (receiveUInt32(fd) != OP_QUERY)
+            throw BagException("Unknown bag server operation");
+
+        string filename = receiveString(fd, MAX_QUERY_STRING_SIZE);
+        uint32_t topic_count = receiveUInt32(fd);
+        if (topic_count > MAX_QUERY_TOPIC_COUNT)
+            throw BagException("Bag server query has too many topics");
+        vector<string> topics(topic_count);
+        for (size_t i = 0; i < topics.size(); i++)
+            topics[i] = receiveString(fd, MAX_QUERY_STRING_SIZE);
+        uint32_t times[4];
+        receiveAll(fd, times, sizeof(times));
+        ros::Time start_time(times[0], times[1]);
+        ros::Time end_time(times[2], times[3]);
+
+        shared_ptr<Bag> bag = getBag(filename);
+        ChunkReader reader(*bag);
+        reader.setCacheSize(READER_CACHE_SIZE);
+
+        boost::scoped_ptr<View> view(topics.empty() ? new View(*bag, start_time, end_time)
+                                                    : new View(*bag, TopicQuery(topics), start_time, end_time));
+
+        uint64_t file_id = cache_ ? SharedChunkCache::getFileId(bag->getFileName()) : 0;
+
+        putUInt32(out, RECORD_HEADER);
+        putUInt64(out, file_id);
+        putString(out, file_id != 0 ? cache_->getName() : string());
+        vector<ConnectionInfo const*> connections = view->getConnections();
+        putUInt32(out, connections.size());
+        for (ConnectionInfo const* connection_info : connections) {
+            putUInt32(out, connection_info->id);
+            putString(out, connection_info->topic);
+            putString(out, connection_info->datatype);
+            putString(out, connection_info->md5sum);
+            putString(out, connection_info->msg_def);
+            putUInt32(out, connection_info->header->size());
+            for (ros::M_string::const_iterator i = connection_info->header->begin(); i != connection_info->header->end(); i++) {
+                putString(out, i->first);
+                putString(out, i->second);
+            }
+        }
+        putUInt64(out, view->size());
+
+        // Answer a run of messages in the same chunk at a time
+        View::iterator i = view->begin();
+        while (i != view->end()) {
+            vector<MessageInstance> run(1, *i);
+            uint64_t chunk_pos = i->getIndexEntry().chunk_pos;
+            for (++i; i != view->end() && i->getIndexEntry().chunk_pos == chunk_pos; ++i)
+                run.push_back(*i);
+
+            bool shared = false;
+            if (file_id != 0) {
+                if (!cache_->contains(file_id, chunk_pos)) {
+                    reader.readChunk(chunk_pos);
+                    cache_->put(file_id, chunk_pos, reader.getChunk().getData(), reader.getChunk().getSize());
+                }
+                shared = cache_->contains(file_id, chunk_pos);
+            }
+
+            putUInt32(out, RECORD_CHUNK);
+            putUInt64(out, chunk_pos);
+            putUInt32(out, run.size());
+            putUInt32(out, shared ? 1 : 0);
+            if (shared) {
+                flush(fd, out);
+                shared = receiveUInt32(fd) != 0;
+            }
+
+            vector<uint8_t const*> data(run.size());
+            vector<uint32_t>       data_sizes(run.size());
+            if (!shared) {
+                uint32_t total_size = 0;
+                for (size_t j = 0; j < run.size(); j++) {
+                    reader.readMessageData(run[j].getIndexEntry(), data[j], data_sizes[j]);
+                    total_size += data_sizes[j];
+                }
+                putUInt32(out, RECORD_PAYLOADS);
+                putUInt32(out, total_size);
+            }
+
+            for (size_t j = 0; j < run.size(); j++) {
+                IndexEntry const& index_entry = run[j].getIndexEntry();
+                putUInt32(out, run[j].getConnectionInfo()->id);
+                putUInt32(out, index_entry.time.sec);
+                putUInt32(out, index_entry.time.nsec);
+                putUInt32(out, index_entry.offset);
+                if (!shared) {
+                    putUInt32(out, data_sizes[j]);
+                    put(out, data[j], data_sizes[j]);
+                }
+            }
+            flush(fd, out);
+        }
+
+        putUInt32(out, RECORD_END);
+        flush(fd, out);
+    }
+    catch (std::exception const& ex) {
+        // Nothing may escape the detached thread, or the whole server terminates
+        try {
+            out.clear();
+            putUInt32(out, RECORD_ERROR);
+            putString(out, ex.what());
+            flush(fd, out);
+        }
+        catch (...) {
+            // The client went away, or the server is stopping
+        }
+    }
+    catch (...) {
+        // Not even an error message can be sent
+    }
+
+    // Forget the socket before closing it, as its descriptor may then be reused by a new client
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        clients_.erase(fd);
+        served_.notify_all();
+    }
+    ::close(fd);
+}
+
+// BagClient
+
+BagClient::BagClient(string const& socket_path) : socket_path_(socket_path) { }
+
+string BagClient::getSocketPath() const { return socket_path_; }
+
+shared_ptr<SharedChunkCache> BagClient::getCache(string const& name) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    shared_ptr<SharedChunkCache>& cache = caches_[name];
+    if (!cache)
+        cache = boost::make_shared<SharedChunkCache>(name);
+    return cache;
+}
+
+// RemoteMessage
+
+RemoteMessage::RemoteMessage(ConnectionInfo const* connection_info, ros::Time const& time,
+                             shared_ptr<Buffer const> const& buffer, uint8_t const* data, uint32_t data_size)
+    : connection_info_(connection_info), time_(time), buffer_(buffer), data_(data), data_size_(data_size)
+{
+}
+
+ros::Time const&      RemoteMessage::getTime()              const { return time_;                       }
+string const&         RemoteMessage::getTopic()             const { return connection_info_->topic;     }
+string const&         RemoteMessage::getDataType()          const { return connection_info_->datatype;  }
+string const&         RemoteMessage::getMD5Sum()            const { return connection_info_->md5sum;    }
+string const&         RemoteMessage::getMessageDefinition() const { return connection_info_->msg_def;   }
+ConnectionInfo const* RemoteMessage::getConnectionInfo()    const { return connection_info_;            }
+uint8_t const*        RemoteMessage::getData()              const { return data_;                       }
+uint32_t              RemoteMessage::size()                 const { return data_size_;                  }
+
+shared_ptr<ros::M_string> RemoteMessage::getConnectionHeader() const { return connection_info_->header; }
+
+// RemoteView::iterator
+
+RemoteView::iterator::iterator() : view_(NULL) { }
+
+RemoteView::iterator::iterator(RemoteView* view) : view_(view) {
+    if (view_ && view_->done_)
+        view_ = NULL;
+}
+
+bool RemoteView::iterator::equal(iterator const& other) const { return view_ == other.view_; }
+
+void RemoteView::iterator::increment() {
+    if (!view_->next())
+        view_ = NULL;
+}
+
+RemoteMessage const& RemoteView::iterator::dereference() const { return view_->messages_[view_->current_]; }
+
+// RemoteView
+
+RemoteView::RemoteView(BagClient& client, string const& filename, vector<string> const& topics,
+                       ros::Time const& start_time, ros::Time const& end_time)
+    : client_(&client), fd_(-1), receive_buffer_(RECEIVE_BUFFER_SIZE), receive_pos_(0), receive_end_(0),
+      file_id_(0), size_(0), shared_chunks_(0), sent_chunks_(0), current_(0), done_(false)
+{
+    sockaddr_un address = getAddress(client.getSocketPath());
+
+    fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ < 0)
+        throw BagIOException(string("Error creating bag client socket: ") + strerror(errno));
+    if (::connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        string error = strerror(errno);
+        ::close(fd_);
+        throw BagIOException("Error connecting to bag server " + client.getSocketPath() + ": " + error);
+    }
+
+    try {
+        vector<uint8_t> out;
+        putUInt32(out, OP_QUERY);
+        putString(out, filename);
+        putUInt32(out, topics.size());
+        for (string const& topic : topics)
+            putString(out, topic);
+        putUInt32(out, start_time.sec);
+        putUInt32(out, start_time.nsec);
+        putUInt32(out, end_time.sec);
+        putUInt32(out, end_time.nsec);
+        flush(fd_, out);
+
+        uint32_t record = receiveUInt32();
+        if (record == RECORD_ERROR)
+            throw BagException(receiveString());
+        if (record != RECORD_HEADER)
+            throw BagFormatException("Expected header from bag server");
+
+        file_id_ = receiveUInt64();
+        string cache_name = receiveString();
+        if (file_id_ != 0 && !cache_name.empty()) {
+            try {
+                cache_ = client.getCache(cache_name);
+            }
+            catch (BagException const&) {
+                // Receive the messages through the socket instead
+            }
+        }
+
+        uint32_t connection_count = receiveUInt32();
+        for (uint32_t i = 0; i < connection_count; i++) {
+            shared_ptr<ConnectionInfo> connection_info = boost::make_shared<ConnectionInfo>();
+            connection_info->id       = receiveUInt32();
+            connection_info->topic    = receiveString();
+            connection_info->datatype = receiveString();
+            connection_info->md5sum   = receiveString();
+            connection_info->msg_def  = receiveString();
+            connection_info->header   = boost::make_shared<ros::M_string>();
+            uint32_t field_count = receiveUInt32();
+            for (uint32_t j = 0; j < field_count; j++) {
+                string name = receiveString();
+                (*connection_info->header)[name] = receiveString();
+            }
+            connections_[connection_info->id] = connection_info;
+        }
+        size_ = receiveUInt64();
+
+        readChunk();
+    }
+    catch (...) {
+        ::close(fd_);
+        throw;
+    }
+}
+
+RemoteView::~RemoteView() {
+    ::close(fd_);
+}
+
+RemoteView::iterator RemoteView::begin() { return iterator(this); }
+RemoteView::iterator RemoteView::end()   { return iterator();     }
+
+uint64_t RemoteView::size()            const { return size_;          }
+uint32_t RemoteView::getSharedChunks() const { return shared_chunks_; }
+uint32_t RemoteView::getSentChunks()   const { return sent_chunks_;   }
+
+bool RemoteView::next() {
+    if (++current_ < messages_.size())
+        return true;
+
+    readChunk();
+    return !done_;
+}
+
+void RemoteView::readChunk() {
+    messages_.clear();
+    current_ = 0;
+
+    while (messages_.empty() && !done_) {
+        uint32_t record = receiveUInt32();
+        if (record == RECORD_END) {
+            done_ = true;
+            return;
+        }
+        if (record == RECORD_ERROR)
+            throw BagException(receiveString());
+        if (record != RECORD_CHUNK)
+            throw BagFormatException("Expected chunk from bag server");
+
+        uint64_t chunk_pos     = receiveUInt64();
+        uint32_t message_count = receiveUInt32();
+        bool     shared        = receiveUInt32() != 0;
+
+        // Copy the chunk from the shared cache if it is still there, or have its messages sent
+        shared_ptr<Buffer> buffer = boost::make_shared<Buffer>();
+        if (shared) {
+            shared = cache_ && cache_->get(file_id_, chunk_pos, *buffer);
+            uint32_t found = shared ? 1 : 0;
+            send(&found, sizeof(found));
+        }
+        if (shared)
+            shared_chunks_++;
+        else {
+            record = receiveUInt32();
+            if (record == RECORD_ERROR)
+                throw BagException(receiveString());
+            if (record != RECORD_PAYLOADS)
+                throw BagFormatException("Expected payloads from bag server");
+            buffer->setSize(receiveUInt32());
+            sent_chunks_++;
+        }
+
+        uint32_t buffer_pos = 0;
+        messages_.reserve(message_count);
+        for (uint32_t i = 0; i < message_count; i++) {
+            uint32_t connection_id = receiveUInt32();
+            uint32_t sec           = receiveUInt32();
+            uint32_t nsec          = receiveUInt32();
+            uint32_t offset        = receiveUInt32();
+
+            map<uint32_t, shared_ptr<ConnectionInfo> >::const_iterator connection_iter = connections_.find(connection_id);
+            if (connection_iter == connections_.end())
+                throw BagFormatException((boost::format("Unknown connection from bag server: %1%") % connection_id).str());
+
+            uint8_t const* data;
+            uint32_t       data_size;
+            if (shared)
+                ChunkReader::locateMessageData(buffer->getData(), buffer->getSize(), offset, data, data_size);
+            else {
+                data_size = receiveUInt32();
+                if (data_size > buffer->getSize() - buffer_pos)
+                    throw BagFormatException("Message from bag server overruns its chunk");
+                receive(buffer->getData() + buffer_pos, data_size);
+                data        = buffer->getData() + buffer_pos;
+                buffer_pos += data_size;
+            }
+
+            messages_.push_back(RemoteMessage(connection_iter->second.get(), ros::Time(sec, nsec), buffer, data, data_size));
+        }
+    }
+}
+
+void RemoteView::receive(void* data, size_t size) {
+    uint8_t* p = static_cast<uint8_t*>(data);
+    while (size > 0) {
+        if (receive_pos_ == receive_end_) {
+            // Receive large payloads in place
+            if (size >= receive_buffer_.size()) {
+                receiveAll(fd_, p, size);
+                return;
+            }
+            receive_pos_ = 0;
+            receive_end_ = receiveSome(fd_, &receive_buffer_[0], receive_buffer_.size());
+        }
+
+        size_t n = std::min(size, receive_end_ - receive_pos_);
+        memcpy(p, &receive_buffer_[receive_pos_], n);
+        receive_pos_ += n;
+        p            += n;
+        size         -= n;
+    }
+}
+
+uint32_t RemoteView::receiveUInt32() {
+    uint32_t value;
+    receive(&value, sizeof(value));
+    return value;
+}
+
+uint64_t RemoteView::receiveUInt64() {
+    uint64_t value;
+    receive(&value, sizeof(value));
+    return value;
+}
+
+string RemoteView::receiveString() {
+    string value(receiveUInt32(), '\0');
+    if (!value.empty())
+        receive(&value[0], value.size());
+    return value;
+}
+
+void RemoteView::send(void const* data, size_t size) {
+    sendAll(fd_, data, size);
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -0,0 +1,283 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/bulk_extractor.h"
+#include "rosbag_io/rosbag/chunk_reader.h"
+#include "rosbag_io/rosbag/view.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+
+#if !defined(_WIN32)
+  #include <sys/mman.h>
+#endif
+
+#include <boost/format.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/barrier.hpp>
+#include <boost/thread/thread.hpp>
+
+using std::map;
+using std::pair;
+using std::vector;
+using boost::format;
+using boost::shared_ptr;
+
+namespace rosbag_io {
+namespace rosbag {
+
+static const uint64_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+typedef map<Bag const*, shared_ptr<ChunkReader> > ChunkReaders;
+
+static ChunkReader& getReader(ChunkReaders& readers, Bag const* bag) {
+    shared_ptr<ChunkReader>& reader = readers[bag];
+    if (!reader)
+        reader = boost::make_shared<ChunkReader>(*bag);
+    return *reader;
+}
+
+BulkExtractor::BulkExtractor(View& view, uint32_t thread_count)
+    : thread_count_(thread_count), max_data_size_(0), data_(NULL), data_size_(0), allocation_(NULL), allocation_size_(0)
+{
+    if (thread_count_ == 0)
+        thread_count_ = std::max(1u, boost::thread::hardware_concurrency());
+
+    // Group the messages of the view by chunk, in the order the chunks are first needed
+    map<pair<Bag const*, uint64_t>, size_t> chunk_indices;
+    for (MessageInstance const& m : view) {
+        IndexEntry const& index_entry = m.getIndexEntry();
+        pair<Bag const*, uint64_t> key(&m.getBag(), index_entry.chunk_pos);
+
+        map<pair<Bag const*, uint64_t>, size_t>::iterator i = chunk_indices.find(key);
+        if (i == chunk_indices.end()) {
+            i = chunk_indices.insert(std::make_pair(key, chunks_.size())).first;
+            chunks_.push_back(Chunk());
+            chunks_.back().bag       = key.first;
+            chunks_.back().chunk_pos = key.second;
+        }
+
+        Chunk& chunk = chunks_[i->second];
+        chunk.messages.push_back(times_.size());
+        chunk.entries.push_back(index_entry);
+        times_.push_back(index_entry.time);
+    }
+
+    // The payloads of a chunk can not be larger than the chunk
+    ChunkReaders readers;
+    for (Chunk const& chunk : chunks_) {
+        ChunkHeader chunk_header;
+        getReader(readers, chunk.bag).readChunkHeader(chunk.chunk_pos, chunk_header);
+        max_data_size_ += chunk_header.uncompressed_size;
+    }
+}
+
+BulkExtractor::~BulkExtractor() {
+    freeBuffer();
+}
+
+uint32_t                      BulkExtractor::getMessageCount() const { return times_.size(); }
+uint64_t                      BulkExtractor::getMaxDataSize()  const { return max_data_size_;  }
+uint8_t const*                BulkExtractor::getData()         const { return data_;           }
+uint64_t                      BulkExtractor::getDataSize()     const { return data_size_;      }
+vector<uint64_t> const&       BulkExtractor::getOffsets()      const { return offsets_;        }
+vector<ros::Time> const&      BulkExtractor::getTimes()        const { return times_;          }
+
+uint64_t BulkExtractor::extract(uint8_t* buffer, uint64_t capacity) {
+    data_      = buffer;
+    data_size_ = 0;
+    offsets_.assign(times_.size() + 1, 0);
+
+    // Each thread decompresses one chunk per round, keeps it and locates its payloads.  The payloads
+    // are then assigned their offsets in view order, as far as the sizes of the messages before them
+    // are known, and every thread copies those of its chunks into place.  A chunk is released once all
+    // its payloads are copied, so each chunk is decompressed only once, even when its messages are
+    // spread over the view.
+    uint32_t thread_count = std::max(1u, std::min<uint32_t>(thread_count_, chunks_.size()));
+    size_t   round_count  = (chunks_.size() + thread_count - 1) / thread_count;
+
+    vector<uint32_t> sizes(times_.size());
+    vector<bool>     sized(times_.size(), false);
+    size_t           placed = 0;
+
+    vector<ChunkReaders>         readers(thread_count);
+    vector<std::exception_ptr>   errors(thread_count);
+    boost::barrier               barrier(thread_count);
+    bool                         abort = false;
+
+    auto work = [&](uint32_t t) {
+        vector<Chunk*>              pending;
+        vector<shared_ptr<Buffer> > spare;
+
+        for (size_t round = 0; round < round_count; round++) {
+            size_t index = round * thread_count + t;
+            Chunk* chunk = index < chunks_.size() ? &chunks_[index] : NULL;
+
+            if (chunk) {
+                try {
+                    ChunkReader& reader = getReader(readers[t], chunk->bag);
+                    reader.readChunk(chunk->chunk_pos);
+
+                    if (spare.empty())
+                        chunk->buffer = boost::make_shared<Buffer>();
+                    else {
+                        chunk->buffer = spare.back();
+                        spare.pop_back();
+                    }
+                    reader.takeChunk(*chunk->buffer);
+
+                    chunk->data.resize(chunk->entries.size());
+                    for (size_t i = 0; i < chunk->entries.size(); i++) {
+                        ChunkReader::locateMessageData(chunk->buffer->getData(), chunk->buffer->getSize(), chunk->entries[i].offset,
+                                                       chunk->data[i], sizes[chunk->messages[i]]);
+                    }
+                    chunk->copied = 0;
+                    pending.push_back(chunk);
+                }
+                catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            }
+
+            barrier.wait();
+
+            if (t == 0) {
+                for (std::exception_ptr const& error : errors)
+                    abort = abort || error;
+
+                size_t end = std::min(chunks_.size(), (round + 1) * thread_count);
+                for (size_t c = round * thread_count; c < end && !abort; c++)
+                    for (uint32_t message : chunks_[c].messages)
+                        sized[message] = true;
+
+                for (; placed < times_.size() && sized[placed] && !abort; placed++) {
+                    uint64_t offset = offsets_[placed];
+                    if (sizes[placed] > capacity - offset) {
+                        errors[0] = std::make_exception_ptr(BagException((format("Extraction buffer of %1% bytes is too small") % capacity).str()));
+                        abort = true;
+                        break;
+                    }
+                    offsets_[placed + 1] = offset + sizes[placed];
+                }
+            }
+
+            barrier.wait();
+
+            if (abort)
+                return;
+
+            for (size_t p = 0; p < pending.size(); ) {
+                Chunk* pending_chunk = pending[p];
+                for (; pending_chunk->copied < pending_chunk->messages.size() && pending_chunk->messages[pending_chunk->copied] < placed; pending_chunk->copied++) {
+                    uint32_t message = pending_chunk->messages[pending_chunk->copied];
+                    memcpy(buffer + offsets_[message], pending_chunk->data[pending_chunk->copied], sizes[message]);
+                }
+
+                if (pending_chunk->copied < pending_chunk->messages.size()) {
+                    p++;
+                    continue;
+                }
+
+                pending_chunk->data.clear();
+                spare.push_back(pending_chunk->buffer);
+                pending_chunk->buffer.reset();
+                pending[p] = pending.back();
+                pending.pop_back();
+            }
+        }
+    };
+
+    if (thread_count == 1)
+        work(0);
+    else {
+        boost::thread_group threads;
+        for (uint32_t t = 1; t < thread_count; t++)
+            threads.create_thread(boost::bind<void>(work, t));
+        work(0);
+        threads.join_all();
+    }
+
+    for (std::exception_ptr const& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+
+    data_size_ = offsets_.back();
+    return data_size_;
+}
+
+uint64_t BulkExtractor::extract() {
+    freeBuffer();
+
+    uint64_t size = (max_data_size_ + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    if (size > 0) {
+#if defined(_WIN32)
+        allocation_ = (uint8_t*) malloc(size);
+        if (!allocation_)
+            throw BagException((format("Error allocating %1% bytes") % size).str());
+#else
+        // Over-allocate to align the buffer on a huge page, and return the excess
+        uint8_t* p = (uint8_t*) mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            throw BagException((format("Error allocating %1% bytes") % size).str());
+
+        uint8_t* aligned = (uint8_t*) (((uintptr_t) p + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+        if (aligned > p)
+            munmap(p, aligned - p);
+        if (p + HUGE_PAGE_SIZE > aligned)
+            munmap(aligned + size, p + HUGE_PAGE_SIZE - aligned);
+        allocation_ = aligned;
+  #if defined(MADV_HUGEPAGE)
+        madvise(allocation_, size, MADV_HUGEPAGE);
+  #endif
+#endif
+        allocation_size_ = size;
+    }
+
+    return extract(allocation_, max_data_size_);
+}
+
+void BulkExtractor::freeBuffer() {
+    if (!allocation_)
+        return;
+
+    if (data_ == allocation_) {
+        data_      = NULL;
+        data_size_ = 0;
+    }
+
+#if defined(_WIN32)
+    free(allocation_);
+#else
+    munmap(allocation_, allocation_size_);
+#endif
+    allocation_      = NULL;
+    allocation_size_ = 0;
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
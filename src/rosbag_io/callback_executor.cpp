@@ -0,0 +1,144 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/callback_executor.h"
+
+#include <algorithm>
+
+#include <boost/bind/bind.hpp>
+
+namespace rosbag_io {
+namespace rosbag {
+
+CallbackExecutor::CallbackExecutor(uint32_t capacity, OverflowPolicy policy)
+    : capacity_(std::max(capacity, 1u)), policy_(policy), busy_(false), stopping_(false), cancelled_(false)
+{
+    thread_ = boost::thread(boost::bind(&CallbackExecutor::run, this));
+}
+
+CallbackExecutor::~CallbackExecutor() {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    not_empty_.notify_all();
+    thread_.join();
+}
+
+bool CallbackExecutor::push(Task const& task) {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+
+    if (queue_.size() >= capacity_) {
+        switch (policy_) {
+        case overflow::Block:
+            stats_.blocked++;
+            while (queue_.size() >= capacity_ && !cancelled_)
+                not_full_.wait(lock);
+            if (queue_.size() >= capacity_) {
+                stats_.dropped++;
+                return false;
+            }
+            break;
+        case overflow::DropOldest:
+            queue_.pop_front();
+            stats_.dropped++;
+            break;
+        case overflow::DropNewest:
+            stats_.dropped++;
+            return false;
+        }
+    }
+
+    queue_.push_back(task);
+    stats_.enqueued++;
+    stats_.max_depth = std::max<uint32_t>(stats_.max_depth, queue_.size());
+
+    lock.unlock();
+    not_empty_.notify_one();
+    return true;
+}
+
+void CallbackExecutor::cancel() {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        cancelled_ = true;
+    }
+    not_full_.notify_all();
+}
+
+void CallbackExecutor::drain() {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (!queue_.empty() || busy_)
+        idle_.wait(lock);
+
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = std::exception_ptr();
+        std::rethrow_exception(error);
+    }
+}
+
+CallbackQueueStats CallbackExecutor::getStats() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return stats_;
+}
+
+void CallbackExecutor::run() {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (true) {
+        while (queue_.empty() && !stopping_)
+            not_empty_.wait(lock);
+        if (queue_.empty())
+            return;
+
+        Task task;
+        task.swap(queue_.front());
+        queue_.pop_front();
+        busy_ = true;
+
+        lock.unlock();
+        not_full_.notify_one();
+
+        try {
+            task();
+        }
+        catch (...) {
+            boost::lock_guard<boost::mutex> error_lock(mutex_);
+            if (!error_)
+                error_ = std::current_exception();
+        }
+
+        lock.lock();
+        busy_ = false;
+        stats_.executed++;
+        if (queue_.empty())
+            idle_.notify_all();
+    }
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
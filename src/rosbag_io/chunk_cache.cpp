@@ -0,0 +1,124 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/chunk_cache.h"
+
+#include <algorithm>
+
+#include <boost/make_shared.hpp>
+
+namespace rosbag_io {
+namespace rosbag {
+
+ChunkCache::ChunkCache(uint64_t capacity) : capacity_(capacity), size_(0), hits_(0), misses_(0) { }
+
+uint64_t ChunkCache::getCapacity() const { return capacity_; }
+uint64_t ChunkCache::getSize()     const { return size_;     }
+uint64_t ChunkCache::getHits()     const { return hits_;     }
+uint64_t ChunkCache::getMisses()   const { return misses_;   }
+
+void ChunkCache::setCapacity(uint64_t capacity) {
+    capacity_ = capacity;
+    evict(0);
+}
+
+void ChunkCache::put(uint64_t chunk_pos, Buffer& buffer) {
+    if (capacity_ == 0 || buffer.getSize() > capacity_)
+        return;
+
+    // A chunk is only ever kept once
+    std::map<uint64_t, std::list<Entry>::iterator>::iterator i = index_.find(chunk_pos);
+    if (i != index_.end()) {
+        entries_.splice(entries_.begin(), entries_, i->second);
+        return;
+    }
+
+    evict(buffer.getSize());
+
+    Entry entry;
+    entry.chunk_pos = chunk_pos;
+    if (spare_)
+        entry.buffer.swap(spare_);
+    else
+        entry.buffer = boost::make_shared<Buffer>();
+    entry.buffer->swap(buffer);
+
+    entries_.push_front(entry);
+    index_[chunk_pos] = entries_.begin();
+    size_ += entry.buffer->getSize();
+}
+
+bool ChunkCache::take(uint64_t chunk_pos, Buffer& buffer) {
+    std::map<uint64_t, std::list<Entry>::iterator>::iterator i = index_.find(chunk_pos);
+    if (i == index_.end()) {
+        if (capacity_ > 0)
+            misses_++;
+        return false;
+    }
+    hits_++;
+
+    Entry& entry = *i->second;
+    size_ -= entry.buffer->getSize();
+    entry.buffer->swap(buffer);
+    spare_ = entry.buffer;
+
+    entries_.erase(i->second);
+    index_.erase(i);
+    return true;
+}
+
+void ChunkCache::swap(ChunkCache& other) {
+    std::swap(capacity_, other.capacity_);
+    std::swap(size_,     other.size_);
+    std::swap(hits_,     other.hits_);
+    std::swap(misses_,   other.misses_);
+    entries_.swap(other.entries_);
+    index_.swap(other.index_);
+    spare_.swap(other.spare_);
+}
+
+void ChunkCache::clear() {
+    entries_.clear();
+    index_.clear();
+    spare_.reset();
+    size_ = 0;
+}
+
+//! Evict the least recently used chunks until size more bytes fit
+void ChunkCache::evict(uint64_t size) {
+    while (!entries_.empty() && size_ + size > capacity_) {
+        Entry& entry = entries_.back();
+        size_ -= entry.buffer->getSize();
+        spare_ = entry.buffer;
+
+        index_.erase(entry.chunk_pos);
+        entries_.pop_back();
+    }
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
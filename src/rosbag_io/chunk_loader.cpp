@@ -0,0 +1,140 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/chunk_loader.h"
+#include "rosbag_io/rosbag/chunk_reader.h"
+
+#include <boost/make_shared.hpp>
+
+using std::map;
+using std::vector;
+using boost::shared_ptr;
+
+namespace rosbag_io {
+namespace rosbag {
+
+ChunkLoader::ChunkLoader(uint32_t thread_count) : stopping_(false), loads_(0) {
+    if (thread_count == 0)
+        thread_count = std::max(1u, boost::thread::hardware_concurrency());
+
+    for (uint32_t i = 0; i < thread_count; i++)
+        threads_.create_thread(boost::bind(&ChunkLoader::run, this));
+}
+
+ChunkLoader::~ChunkLoader() {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        stopping_ = true;
+        not_empty_.notify_all();
+    }
+    threads_.join_all();
+}
+
+void ChunkLoader::load(Bag const& bag, uint64_t chunk_pos, Callback const& callback) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    ChunkKey key(&bag, chunk_pos);
+    vector<Callback>& callbacks = pending_[key];
+    callbacks.push_back(callback);
+    if (callbacks.size() == 1) {
+        queue_.push_back(key);
+        not_empty_.notify_one();
+    }
+}
+
+shared_ptr<Buffer> ChunkLoader::find(Bag const& bag, uint64_t chunk_pos) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    map<ChunkKey, boost::weak_ptr<Buffer> >::const_iterator i = loaded_.find(ChunkKey(&bag, chunk_pos));
+    return i != loaded_.end() ? i->second.lock() : shared_ptr<Buffer>();
+}
+
+uint64_t ChunkLoader::getLoads() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return loads_;
+}
+
+void ChunkLoader::run() {
+    map<Bag const*, shared_ptr<ChunkReader> > readers;
+
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (true) {
+        while (queue_.empty() && !stopping_)
+            not_empty_.wait(lock);
+        if (queue_.empty())
+            break;
+
+        ChunkKey key = queue_.front();
+        queue_.pop_front();
+
+        // A chunk still held from an earlier load is not read again
+        shared_ptr<Buffer> chunk = loaded_[key].lock();
+        std::exception_ptr error;
+        if (!chunk) {
+            lock.unlock();
+            try {
+                shared_ptr<ChunkReader>& reader = readers[key.first];
+                if (!reader)
+                    reader = boost::make_shared<ChunkReader>(*key.first);
+
+                reader->readChunk(key.second);
+                chunk = boost::make_shared<Buffer>();
+                reader->takeChunk(*chunk);
+            }
+            catch (...) {
+                error = std::current_exception();
+                chunk.reset();
+            }
+            lock.lock();
+
+            if (chunk) {
+                loads_++;
+
+                // Forget the chunks nobody holds anymore
+                for (map<ChunkKey, boost::weak_ptr<Buffer> >::iterator i = loaded_.begin(); i != loaded_.end(); ) {
+                    if (i->second.expired())
+                        loaded_.erase(i++);
+                    else
+                        ++i;
+                }
+                loaded_[key] = chunk;
+            }
+        }
+
+        vector<Callback> callbacks;
+        callbacks.swap(pending_[key]);
+        pending_.erase(key);
+
+        lock.unlock();
+        for (Callback const& callback : callbacks)
+            callback(chunk, error);
+        lock.lock();
+    }
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
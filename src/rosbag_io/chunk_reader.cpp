@@ -0,0 +1,178 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/chunk_reader.h"
+#include "rosbag_io/rosbag/bag.h"
+
+#include <cstring>
+
+#include <boost/format.hpp>
+
+using std::string;
+using boost::format;
+using rosbag_io::ros::M_string;
+
+namespace rosbag_io {
+namespace rosbag {
+
+static const uint64_t NO_CHUNK = (uint64_t) -1;
+
+static uint8_t readOp(M_string const& fields) {
+    M_string::const_iterator i = fields.find(OP_FIELD_NAME);
+    if (i == fields.end() || i->second.size() != 1)
+        throw BagFormatException("Required '" + OP_FIELD_NAME + "' field missing");
+    return (uint8_t) i->second[0];
+}
+
+ChunkReader::ChunkReader(Bag const& bag) : bag_(&bag), chunk_pos_(NO_CHUNK) {
+    if (!bag.isOpen() || bag.getMode() != bagmode::Read)
+        throw BagException("Chunks can only be read from a bag opened for reading");
+    if (bag.version_ != 200)
+        throw BagException((format("Chunks can not be read from a version %1% bag") % bag.version_).str());
+
+    file_.openRead(bag.getFileName());
+}
+
+uint64_t ChunkReader::getChunkPos() const { return chunk_pos_; }
+Buffer&  ChunkReader::getChunk()          { return decompress_buffer_; }
+uint64_t ChunkReader::getCacheSize() const { return cache_.getCapacity(); }
+
+void ChunkReader::setCacheSize(uint64_t size) {
+    cache_.setCapacity(size);
+}
+
+void ChunkReader::readChunkHeader(uint64_t chunk_pos, ChunkHeader& chunk_header) {
+    file_.seek(chunk_pos);
+
+    // Read the chunk header
+    uint32_t header_len;
+    file_.read((char*) &header_len, 4);
+    header_buffer_.setSize(header_len);
+    file_.read((char*) header_buffer_.getData(), header_len);
+
+    ros::Header header;
+    string error_msg;
+    if (!header.parse(header_buffer_.getData(), header_len, error_msg))
+        throw BagFormatException("Error reading CHUNK record");
+
+    M_string& fields = *header.getValues();
+    if (readOp(fields) != OP_CHUNK)
+        throw BagFormatException("Expected CHUNK op not found");
+
+    file_.read((char*) &chunk_header.compressed_size, 4);
+    bag_->readField(fields, COMPRESSION_FIELD_NAME, true, chunk_header.compression);
+    bag_->readField(fields, SIZE_FIELD_NAME,        true, &chunk_header.uncompressed_size);
+}
+
+void ChunkReader::readRawChunk(uint64_t chunk_pos, ChunkHeader& chunk_header, Buffer& raw) {
+    readChunkHeader(chunk_pos, chunk_header);
+    bag_->encryptor_->decryptChunk(chunk_header, raw, file_);
+}
+
+void ChunkReader::decompressChunk(ChunkHeader const& chunk_header, Buffer& raw, Buffer& chunk) {
+    if (chunk_header.compression == COMPRESSION_NONE) {
+        chunk.swap(raw);
+        return;
+    }
+
+    CompressionType compression;
+    if (chunk_header.compression == COMPRESSION_BZ2)
+        compression = compression::BZ2;
+    else if (chunk_header.compression == COMPRESSION_LZ4)
+        compression = compression::LZ4;
+    else
+        throw BagFormatException("Unknown compression: " + chunk_header.compression);
+
+    chunk.setSize(chunk_header.uncompressed_size);
+    file_.decompress(compression, chunk.getData(), chunk.getSize(), raw.getData(), raw.getSize());
+}
+
+void ChunkReader::readChunk(uint64_t chunk_pos) {
+    if (chunk_pos_ == chunk_pos)
+        return;
+    if (chunk_pos_ != NO_CHUNK)
+        cache_.put(chunk_pos_, decompress_buffer_);
+    chunk_pos_ = NO_CHUNK;
+
+    if (cache_.take(chunk_pos, decompress_buffer_)) {
+        chunk_pos_ = chunk_pos;
+        return;
+    }
+
+    ChunkHeader chunk_header;
+    readRawChunk(chunk_pos, chunk_header, chunk_buffer_);
+    decompressChunk(chunk_header, chunk_buffer_, decompress_buffer_);
+
+    chunk_pos_ = chunk_pos;
+}
+
+void ChunkReader::takeChunk(Buffer& buffer) {
+    buffer.swap(decompress_buffer_);
+    chunk_pos_ = NO_CHUNK;
+}
+
+void ChunkReader::readMessageData(IndexEntry const& index_entry, uint8_t const*& data, uint32_t& data_size) {
+    readChunk(index_entry.chunk_pos);
+    locateMessageData(decompress_buffer_.getData(), decompress_buffer_.getSize(), index_entry.offset, data, data_size);
+}
+
+void ChunkReader::locateMessageData(uint8_t const* chunk, uint32_t chunk_size, uint32_t offset, uint8_t const*& data, uint32_t& data_size) {
+    // Skip any connection records preceding the message data
+    uint8_t op;
+    do {
+        if ((uint64_t) offset + 4 > chunk_size)
+            throw BagFormatException("Message record outside of its chunk");
+
+        uint8_t const* ptr = chunk + offset;
+        uint32_t header_len;
+        memcpy(&header_len, ptr, 4);
+        if ((uint64_t) offset + 8 + header_len > chunk_size)
+            throw BagFormatException("Message record outside of its chunk");
+
+        ros::Header header;
+        string error_msg;
+        if (!header.parse((uint8_t*) ptr + 4, header_len, error_msg))
+            throw BagFormatException("Error parsing header");
+        op = readOp(*header.getValues());
+
+        memcpy(&data_size, ptr + 4 + header_len, 4);
+        offset += 8 + header_len;
+        if (op != OP_MSG_DATA)
+            offset += data_size;
+    }
+    while (op == OP_MSG_DEF || op == OP_CONNECTION);
+
+    if (op != OP_MSG_DATA)
+        throw BagFormatException("Expected MSG_DATA op not found");
+    if ((uint64_t) offset + data_size > chunk_size)
+        throw BagFormatException("Message record outside of its chunk");
+
+    data = chunk + offset;
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -200,6 +200,8 @@ void ChunkedFile::write(string const& s)        { write((void*) s.c_str(), s.siz
 void ChunkedFile::write(void* ptr, size_t size) { write_stream_->write(ptr, size);    }
 void ChunkedFile::read(void* ptr, size_t size)  { read_stream_->read(ptr, size);      }
 
+void ChunkedFile::writev(ros::SerializedSegment const* segments, size_t count) { write_stream_->writev(segments, count); }
+
 bool ChunkedFile::truncate(uint64_t length) {
     int fd = fileno(file_);
     return ftruncate(fd, length) == 0;
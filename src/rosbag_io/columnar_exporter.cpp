@@ -0,0 +1,404 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/columnar_exporter.h"
+#include "rosbag_io/rosbag/chunk_reader.h"
+#include "rosbag_io/rosbag/message_decoder.h"
+#include "rosbag_io/rosbag/view.h"
+
+#include <cstdio>
+#include <exception>
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+using std::map;
+using std::string;
+using std::vector;
+using boost::format;
+using boost::shared_ptr;
+
+namespace rosbag_io {
+namespace rosbag {
+
+namespace {
+
+//! Number of chunks decoded by each thread before their columns are written out
+const uint32_t CHUNKS_PER_THREAD = 4;
+
+char const* typeName(FieldType type) {
+    switch (type) {
+    case fieldtype::Bool:     return "bool";
+    case fieldtype::Int8:     return "int8";
+    case fieldtype::UInt8:    return "uint8";
+    case fieldtype::Int16:    return "int16";
+    case fieldtype::UInt16:   return "uint16";
+    case fieldtype::Int32:    return "int32";
+    case fieldtype::UInt32:   return "uint32";
+    case fieldtype::Int64:    return "int64";
+    case fieldtype::UInt64:   return "uint64";
+    case fieldtype::Float32:  return "float32";
+    case fieldtype::Float64:  return "float64";
+    case fieldtype::String:   return "string";
+    case fieldtype::Time:     return "time";
+    case fieldtype::Duration: return "duration";
+    }
+    return "unknown";
+}
+
+//! A file written sequentially with stdio
+class OutputFile
+{
+public:
+    OutputFile() : file_(NULL) { }
+    ~OutputFile() { if (file_) fclose(file_); }
+
+    void open(string const& filename) {
+        filename_ = filename;
+        file_ = fopen(filename.c_str(), "wb");
+        if (!file_)
+            throw BagIOException("Error opening file: " + filename);
+    }
+
+    void write(void const* data, size_t size) {
+        if (size > 0 && fwrite(data, 1, size, file_) != size)
+            throw BagIOException("Error writing to file: " + filename_);
+    }
+
+    void write(uint64_t value) { write(&value, sizeof(value)); }
+
+    void close() {
+        FILE* file = file_;
+        file_ = NULL;
+        if (fclose(file) != 0)
+            throw BagIOException("Error closing file: " + filename_);
+    }
+
+private:
+    OutputFile(OutputFile const&);
+    OutputFile& operator=(OutputFile const&);
+
+private:
+    string filename_;
+    FILE*  file_;
+};
+
+//! A column being written
+struct Column
+{
+    string     name;
+    FieldType  type;
+    uint32_t   element_size;
+    bool       variable;       //!< string or array: each occurrence holds a number of elements
+    bool       repeated;       //!< inside an array of messages: each message holds a number of occurrences
+    uint32_t   depth;
+
+    OutputFile values;
+    OutputFile offsets;
+    OutputFile item_offsets;
+    uint64_t   value_count;    //!< number of elements written to values
+    uint64_t   item_count;     //!< number of items written to item_offsets
+};
+
+//! A topic being written
+struct TopicExport
+{
+    string                                   topic;
+    string                                   directory;
+    shared_ptr<MessageDecoder const>         decoder;
+    OutputFile                               times;
+    vector<shared_ptr<Column> >              columns;
+    vector<uint32_t>                         repeated;   //!< indexes of the repeated columns
+};
+
+//! The part of a column decoded from one chunk
+struct ColumnFragment
+{
+    vector<uint8_t>  values;
+    vector<uint64_t> lengths;        //!< number of elements or items of each message, for lists
+    vector<uint64_t> item_lengths;   //!< number of elements of each item, for lists of lists
+};
+
+//! The part of a topic decoded from one chunk
+struct TopicFragment
+{
+    vector<uint64_t>       times;
+    vector<ColumnFragment> columns;
+};
+
+//! Consecutive messages of the view stored in the same chunk
+struct Segment
+{
+    struct Message
+    {
+        IndexEntry   index_entry;
+        TopicExport* topic;
+    };
+
+    Bag const*      bag;
+    uint64_t        chunk_pos;
+    vector<Message> messages;
+
+    map<TopicExport*, TopicFragment> fragments;
+};
+
+typedef map<Bag const*, shared_ptr<ChunkReader> > ChunkReaders;
+
+void decodeField(TopicFragment* fragment, TopicExport const* topic, uint32_t field, FieldValue const& value) {
+    Column const&   column = *topic->columns[field];
+    ColumnFragment& out    = fragment->columns[field];
+
+    uint64_t count = column.variable ? value.count : 1;
+    uint64_t size  = count * column.element_size;
+    out.values.insert(out.values.end(), value.data, value.data + size);
+
+    if (column.repeated) {
+        out.lengths.back()++;
+        if (column.variable)
+            out.item_lengths.push_back(count);
+    }
+    else if (column.variable)
+        out.lengths.push_back(count);
+}
+
+void decodeSegment(Segment& segment, ChunkReaders& readers) {
+    shared_ptr<ChunkReader>& reader = readers[segment.bag];
+    if (!reader)
+        reader = boost::make_shared<ChunkReader>(*segment.bag);
+
+    reader->readChunk(segment.chunk_pos);
+
+    TopicFragment*     fragment = NULL;
+    TopicExport const* topic    = NULL;
+    MessageDecoder::Visitor visitor = [&](uint32_t field, FieldValue const& value) { decodeField(fragment, topic, field, value); };
+
+    for (Segment::Message const& message : segment.messages) {
+        topic    = message.topic;
+        fragment = &segment.fragments[message.topic];
+        if (fragment->columns.empty())
+            fragment->columns.resize(topic->columns.size());
+
+        uint8_t const* data;
+        uint32_t data_size;
+        reader->readMessageData(message.index_entry, data, data_size);
+
+        fragment->times.push_back(message.index_entry.time.toNSec());
+        for (uint32_t field : topic->repeated)
+            fragment->columns[field].lengths.push_back(0);
+
+        topic->decoder->decode(data, data_size, visitor);
+    }
+}
+
+void writeFragment(TopicExport& topic, TopicFragment const& fragment) {
+    topic.times.write(fragment.times.data(), fragment.times.size() * sizeof(uint64_t));
+
+    for (size_t i = 0; i < topic.columns.size(); i++) {
+        Column&               column = *topic.columns[i];
+        ColumnFragment const& in     = fragment.columns[i];
+
+        column.values.write(in.values.data(), in.values.size());
+
+        if (column.depth == 2) {
+            for (uint64_t length : in.lengths) {
+                column.item_count += length;
+                column.offsets.write(column.item_count);
+            }
+            for (uint64_t length : in.item_lengths) {
+                column.value_count += length;
+                column.item_offsets.write(column.value_count);
+            }
+        }
+        else if (column.depth == 1) {
+            for (uint64_t length : in.lengths) {
+                column.value_count += length;
+                column.offsets.write(column.value_count);
+            }
+        }
+    }
+}
+
+string topicDirectory(string const& topic) {
+    string name = topic.substr(topic.find_first_not_of('/') == string::npos ? topic.size() : topic.find_first_not_of('/'));
+    for (char& c : name)
+        if (c == '/')
+            c = '.';
+    return name.empty() ? string("_") : name;
+}
+
+} // namespace
+
+ColumnarExporter::ColumnarExporter(string const& directory, uint32_t thread_count) : directory_(directory), thread_count_(thread_count) {
+    if (thread_count_ == 0)
+        thread_count_ = std::max(1u, boost::thread::hardware_concurrency());
+}
+
+string const& ColumnarExporter::getDirectory()   const { return directory_;    }
+uint32_t      ColumnarExporter::getThreadCount() const { return thread_count_; }
+
+void ColumnarExporter::exportView(View& view) {
+    namespace fs = boost::filesystem;
+
+    map<string, shared_ptr<TopicExport> > topics;
+
+    // Split the view into runs of messages sharing a chunk
+    vector<Segment> segments;
+    for (MessageInstance const& m : view) {
+        shared_ptr<TopicExport>& topic = topics[m.getTopic()];
+        shared_ptr<MessageDecoder const> decoder = m.getDecoder();
+        if (!topic) {
+            topic = boost::make_shared<TopicExport>();
+            topic->topic     = m.getTopic();
+            topic->directory = (fs::path(directory_) / topicDirectory(m.getTopic())).string();
+            topic->decoder   = decoder;
+        }
+        else if (topic->decoder != decoder && (topic->decoder->getDataType() != decoder->getDataType() ||
+                                               topic->decoder->getFieldNames() != decoder->getFieldNames()))
+            throw BagException("Topic " + m.getTopic() + " is recorded with different message definitions");
+
+        IndexEntry const& index_entry = m.getIndexEntry();
+        if (segments.empty() || segments.back().bag != &m.getBag() || segments.back().chunk_pos != index_entry.chunk_pos) {
+            segments.push_back(Segment());
+            segments.back().bag       = &m.getBag();
+            segments.back().chunk_pos = index_entry.chunk_pos;
+        }
+
+        Segment::Message message = { index_entry, topic.get() };
+        segments.back().messages.push_back(message);
+    }
+
+    // Open the column files
+    for (map<string, shared_ptr<TopicExport> >::value_type& i : topics) {
+        TopicExport& topic = *i.second;
+        MessageDecoder const& decoder = *topic.decoder;
+
+        fs::create_directories(topic.directory);
+        topic.times.open((fs::path(topic.directory) / "_time.bin").string());
+
+        for (uint32_t field = 0; field < decoder.getFieldNames().size(); field++) {
+            shared_ptr<Column> column = boost::make_shared<Column>();
+            column->name         = decoder.getFieldNames()[field];
+            column->type         = decoder.getFieldType(field);
+            column->element_size = MessageDecoder::getTypeSize(column->type);
+            column->variable     = column->type == fieldtype::String || decoder.isFieldArray(field);
+            column->repeated     = decoder.isFieldRepeated(field);
+            column->depth        = (column->variable ? 1 : 0) + (column->repeated ? 1 : 0);
+            column->value_count  = 0;
+            column->item_count   = 0;
+
+            string base = (fs::path(topic.directory) / column->name).string();
+            column->values.open(base + ".bin");
+            if (column->depth > 0) {
+                column->offsets.open(base + ".offsets");
+                column->offsets.write(0);
+            }
+            if (column->depth > 1) {
+                column->item_offsets.open(base + ".item_offsets");
+                column->item_offsets.write(0);
+            }
+
+            if (column->repeated)
+                topic.repeated.push_back(field);
+            topic.columns.push_back(column);
+        }
+    }
+
+    // Decode batches of chunks in parallel, then write them out in order
+    vector<ChunkReaders> readers(thread_count_);
+    size_t batch_size = thread_count_ * CHUNKS_PER_THREAD;
+    for (size_t begin = 0; begin < segments.size(); begin += batch_size) {
+        size_t end = std::min(segments.size(), begin + batch_size);
+
+        if (thread_count_ == 1) {
+            for (size_t i = begin; i < end; i++)
+                decodeSegment(segments[i], readers[0]);
+        }
+        else {
+            boost::mutex       error_mutex;
+            std::exception_ptr error;
+
+            boost::thread_group threads;
+            for (uint32_t t = 0; t < thread_count_ && begin + t < end; t++) {
+                threads.create_thread([&, t]() {
+                    try {
+                        for (size_t i = begin + t; i < end; i += thread_count_)
+                            decodeSegment(segments[i], readers[t]);
+                    }
+                    catch (...) {
+                        boost::lock_guard<boost::mutex> lock(error_mutex);
+                        if (!error)
+                            error = std::current_exception();
+                    }
+                });
+            }
+            threads.join_all();
+
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        for (size_t i = begin; i < end; i++) {
+            for (map<TopicExport*, TopicFragment>::value_type const& fragment : segments[i].fragments)
+                writeFragment(*fragment.first, fragment.second);
+
+            // Release the decoded data as soon as it is written
+            Segment().fragments.swap(segments[i].fragments);
+        }
+    }
+
+    // Close the column files and describe them
+    for (map<string, shared_ptr<TopicExport> >::value_type& i : topics) {
+        TopicExport& topic = *i.second;
+
+        OutputFile manifest;
+        manifest.open((fs::path(topic.directory) / "columns.txt").string());
+
+        string line = (format("# %1% %2%\n_time uint64 8 0\n") % topic.topic % topic.decoder->getDataType()).str();
+        manifest.write(line.data(), line.size());
+
+        topic.times.close();
+        for (shared_ptr<Column> const& column : topic.columns) {
+            line = (format("%1% %2% %3% %4%\n") % column->name % typeName(column->type) % column->element_size % column->depth).str();
+            manifest.write(line.data(), line.size());
+
+            column->values.close();
+            if (column->depth > 0)
+                column->offsets.close();
+            if (column->depth > 1)
+                column->item_offsets.close();
+        }
+
+        manifest.close();
+    }
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -0,0 +1,626 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/message_decoder.h"
+#include "rosbag_io/rosbag/exceptions.h"
+
+#include <cstring>
+#include <sstream>
+
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
+using std::map;
+using std::string;
+using std::vector;
+using boost::format;
+using boost::shared_ptr;
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! Maximum nesting of embedded messages and arrays in a definition
+static const int MAX_DEPTH = 32;
+
+static const uint32_t NO_FIELD = 0xFFFFFFFF;
+
+static uint32_t fieldSize(FieldType type) {
+    switch (type) {
+    case fieldtype::Bool:
+    case fieldtype::Int8:
+    case fieldtype::UInt8:    return 1;
+    case fieldtype::Int16:
+    case fieldtype::UInt16:   return 2;
+    case fieldtype::Int32:
+    case fieldtype::UInt32:
+    case fieldtype::Float32:  return 4;
+    case fieldtype::Int64:
+    case fieldtype::UInt64:
+    case fieldtype::Float64:
+    case fieldtype::Time:
+    case fieldtype::Duration: return 8;
+    default:                  return 0;
+    }
+}
+
+static bool builtinType(string const& name, FieldType& type) {
+    static map<string, FieldType> const types = {
+        { "bool",     fieldtype::Bool     },
+        { "int8",     fieldtype::Int8     },
+        { "byte",     fieldtype::Int8     },
+        { "uint8",    fieldtype::UInt8    },
+        { "char",     fieldtype::UInt8    },
+        { "int16",    fieldtype::Int16    },
+        { "uint16",   fieldtype::UInt16   },
+        { "int32",    fieldtype::Int32    },
+        { "uint32",   fieldtype::UInt32   },
+        { "int64",    fieldtype::Int64    },
+        { "uint64",   fieldtype::UInt64   },
+        { "float32",  fieldtype::Float32  },
+        { "float64",  fieldtype::Float64  },
+        { "string",   fieldtype::String   },
+        { "time",     fieldtype::Time     },
+        { "duration", fieldtype::Duration },
+    };
+
+    map<string, FieldType>::const_iterator i = types.find(name);
+    if (i == types.end())
+        return false;
+
+    type = i->second;
+    return true;
+}
+
+static string trim(string const& s) {
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if (begin == string::npos)
+        return string();
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end - begin + 1);
+}
+
+static string packageOf(string const& datatype) {
+    size_t slash = datatype.find('/');
+    return slash == string::npos ? string() : datatype.substr(0, slash);
+}
+
+template<typename T>
+static T load(uint8_t const* data) {
+    T value;
+    memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+// FieldValue
+
+static uint8_t const* element(FieldValue const& value, uint32_t i) {
+    if (i >= value.count)
+        throw BagException((format("Element %1% out of range for a field of %2% elements") % i % value.count).str());
+    return value.data + i * fieldSize(value.type);
+}
+
+double FieldValue::toDouble(uint32_t i) const {
+    uint8_t const* p = element(*this, i);
+    switch (type) {
+    case fieldtype::Float32:  return load<float>(p);
+    case fieldtype::Float64:  return load<double>(p);
+    case fieldtype::Time:     return toTime(i).toSec();
+    case fieldtype::Duration: return toDuration(i).toSec();
+    case fieldtype::UInt8:
+    case fieldtype::UInt16:
+    case fieldtype::UInt32:
+    case fieldtype::UInt64:   return (double) toUInt64(i);
+    default:                  return (double) toInt64(i);
+    }
+}
+
+int64_t FieldValue::toInt64(uint32_t i) const {
+    uint8_t const* p = element(*this, i);
+    switch (type) {
+    case fieldtype::Bool:
+    case fieldtype::UInt8:  return load<uint8_t>(p);
+    case fieldtype::Int8:   return load<int8_t>(p);
+    case fieldtype::Int16:  return load<int16_t>(p);
+    case fieldtype::UInt16: return load<uint16_t>(p);
+    case fieldtype::Int32:  return load<int32_t>(p);
+    case fieldtype::UInt32: return load<uint32_t>(p);
+    case fieldtype::Int64:  return load<int64_t>(p);
+    case fieldtype::UInt64: return (int64_t) load<uint64_t>(p);
+    default:
+        throw BagException("Field is not an integer");
+    }
+}
+
+uint64_t FieldValue::toUInt64(uint32_t i) const {
+    if (type == fieldtype::UInt64)
+        return load<uint64_t>(element(*this, i));
+    return (uint64_t) toInt64(i);
+}
+
+string FieldValue::toString() const {
+    if (type != fieldtype::String)
+        throw BagException("Field is not a string");
+    return string((char const*) data, count);
+}
+
+ros::Time FieldValue::toTime(uint32_t i) const {
+    if (type != fieldtype::Time)
+        throw BagException("Field is not a time");
+    uint8_t const* p = element(*this, i);
+    return ros::Time(load<uint32_t>(p), load<uint32_t>(p + 4));
+}
+
+ros::Duration FieldValue::toDuration(uint32_t i) const {
+    if (type != fieldtype::Duration)
+        throw BagException("Field is not a duration");
+    uint8_t const* p = element(*this, i);
+    return ros::Duration(load<int32_t>(p), load<int32_t>(p + 4));
+}
+
+// MessageDecoder
+
+MessageDecoder::MessageDecoder(string const& datatype, string const& definition) : datatype_(datatype), fixed_size_(0) {
+    if (definition.empty())
+        throw BagFormatException("Missing message definition for " + datatype);
+
+    map<string, MessageSpec> specs;
+    parse(definition, specs);
+    compile(specs, datatype_, string(), 0);
+
+    uint32_t min_size;
+    if (!computeSizes(0, ops_.size(), fixed_size_, min_size))
+        fixed_size_ = 0;
+}
+
+shared_ptr<MessageDecoder const> MessageDecoder::get(ConnectionInfo const* connection_info) {
+    shared_ptr<MessageDecoder const> decoder = boost::atomic_load(&connection_info->decoder);
+    if (decoder)
+        return decoder;
+
+    // Decoders are shared by type, as long as they are in use by some connection
+    static boost::mutex mutex;
+    static map<string, boost::weak_ptr<MessageDecoder const> > decoders;
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    decoder = boost::atomic_load(&connection_info->decoder);
+    if (decoder)
+        return decoder;
+
+    string const& md5sum = connection_info->md5sum;
+    bool shared = !md5sum.empty() && md5sum != "*";
+    string key = connection_info->datatype + "/" + md5sum;
+
+    if (shared)
+        decoder = decoders[key].lock();
+    if (!decoder) {
+        decoder = boost::make_shared<MessageDecoder>(connection_info->datatype, connection_info->msg_def);
+        if (shared)
+            decoders[key] = decoder;
+    }
+
+    boost::atomic_store(&connection_info->decoder, decoder);
+    return decoder;
+}
+
+string const&         MessageDecoder::getDataType()   const { return datatype_;    }
+vector<string> const& MessageDecoder::getFieldNames() const { return field_names_; }
+uint32_t              MessageDecoder::getFixedSize()  const { return fixed_size_;  }
+
+int MessageDecoder::getFieldIndex(string const& name) const {
+    map<string, uint32_t>::const_iterator i = field_indexes_.find(name);
+    return i == field_indexes_.end() ? -1 : (int) i->second;
+}
+
+FieldType MessageDecoder::getFieldType(uint32_t field) const {
+    if (field >= leaves_.size())
+        throw BagException((format("Unknown field index: %1%") % field).str());
+    return leaves_[field].type;
+}
+
+bool MessageDecoder::isFieldArray(uint32_t field) const {
+    if (field >= leaves_.size())
+        throw BagException((format("Unknown field index: %1%") % field).str());
+    return leaves_[field].array;
+}
+
+bool MessageDecoder::isFieldRepeated(uint32_t field) const {
+    if (field >= leaves_.size())
+        throw BagException((format("Unknown field index: %1%") % field).str());
+    return leaves_[field].repeated;
+}
+
+uint32_t MessageDecoder::getTypeSize(FieldType type) {
+    return type == fieldtype::String ? 1 : fieldSize(type);
+}
+
+void MessageDecoder::decode(uint8_t const* data, uint32_t size, Visitor const& visitor) const {
+    run(data, size, NO_FIELD, &visitor, NULL);
+}
+
+bool MessageDecoder::getField(uint8_t const* data, uint32_t size, uint32_t field, FieldValue& value) const {
+    if (field >= leaves_.size())
+        throw BagException((format("Unknown field index: %1%") % field).str());
+    return run(data, size, field, NULL, &value);
+}
+
+// Parsing
+
+void MessageDecoder::parse(string const& definition, map<string, MessageSpec>& specs) const {
+    MessageSpec* spec = &specs[datatype_];
+    spec->package = packageOf(datatype_);
+
+    std::istringstream stream(definition);
+    string line;
+    while (std::getline(stream, line)) {
+        // Strip comments and whitespace
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+
+        // A line of '=' separates the definitions of embedded types
+        if (line.find_first_not_of('=') == string::npos) {
+            spec = NULL;
+            continue;
+        }
+
+        if (line.compare(0, 4, "MSG:") == 0) {
+            string name = trim(line.substr(4));
+            spec = &specs[name];
+            spec->package = packageOf(name);
+            continue;
+        }
+
+        if (spec == NULL)
+            throw BagFormatException("Expected MSG: line in message definition of " + datatype_);
+
+        // Constants are not serialized
+        if (line.find('=') != string::npos)
+            continue;
+
+        std::istringstream tokens(line);
+        string type, name;
+        tokens >> type >> name;
+        if (name.empty())
+            throw BagFormatException((format("Invalid field '%1%' in message definition of %2%") % line % datatype_).str());
+
+        FieldSpec field;
+        field.name       = name;
+        field.is_array   = false;
+        field.is_dynamic = false;
+        field.length     = 0;
+
+        size_t bracket = type.find('[');
+        if (bracket != string::npos) {
+            if (type[type.size() - 1] != ']')
+                throw BagFormatException((format("Invalid array type '%1%' in message definition of %2%") % type % datatype_).str());
+
+            string length = type.substr(bracket + 1, type.size() - bracket - 2);
+            field.is_array = true;
+            if (length.empty())
+                field.is_dynamic = true;
+            else {
+                try {
+                    field.length = boost::lexical_cast<uint32_t>(length);
+                }
+                catch (boost::bad_lexical_cast const&) {
+                    throw BagFormatException((format("Invalid array type '%1%' in message definition of %2%") % type % datatype_).str());
+                }
+            }
+            type = type.substr(0, bracket);
+        }
+        field.type = type;
+
+        spec->fields.push_back(field);
+    }
+}
+
+string MessageDecoder::resolveType(map<string, MessageSpec> const& specs, string const& type, string const& package) const {
+    if (type == "Header")
+        return resolveType(specs, "std_msgs/Header", package);
+
+    if (type.find('/') != string::npos) {
+        if (specs.find(type) != specs.end())
+            return type;
+    }
+    else {
+        // Unqualified types are relative to the package of the message using them
+        if (specs.find(package + "/" + type) != specs.end())
+            return package + "/" + type;
+
+        string suffix = "/" + type;
+        for (map<string, MessageSpec>::const_iterator i = specs.begin(); i != specs.end(); i++)
+            if (i->first.size() > suffix.size() && i->first.compare(i->first.size() - suffix.size(), suffix.size(), suffix) == 0)
+                return i->first;
+    }
+
+    throw BagFormatException((format("Unknown type '%1%' in message definition of %2%") % type % datatype_).str());
+}
+
+// Compiling
+
+void MessageDecoder::compile(map<string, MessageSpec> const& specs, string const& datatype, string const& prefix, int depth) {
+    if (depth > MAX_DEPTH)
+        throw BagFormatException("Message definition of " + datatype_ + " is nested too deeply");
+
+    MessageSpec const& spec = specs.find(datatype)->second;
+
+    for (FieldSpec const& field : spec.fields) {
+        string path = prefix + field.name;
+
+        FieldType type = fieldtype::Bool;
+        bool primitive = builtinType(field.type, type);
+
+        if (!field.is_array) {
+            if (!primitive)
+                compile(specs, resolveType(specs, field.type, spec.package), path + ".", depth + 1);
+            else if (type == fieldtype::String) {
+                addOp(Op::String);
+                addLeaf(path, type, false);
+            }
+            else
+                addLeaf(path, type, true);
+            continue;
+        }
+
+        if (primitive && type != fieldtype::String) {
+            addOp(Op::PrimitiveArray, fieldSize(type), field.length, field.is_dynamic);
+            addLeaf(path, type, false);
+            continue;
+        }
+
+        // Arrays of strings and of messages loop over their element
+        uint32_t begin = ops_.size();
+        addOp(Op::ArrayBegin, 0, field.length, field.is_dynamic);
+
+        if (primitive) {
+            addOp(Op::String);
+            addLeaf(path + "[]", type, false);
+        }
+        else
+            compile(specs, resolveType(specs, field.type, spec.package), path + "[].", depth + 1);
+
+        uint32_t end = ops_.size();
+        addOp(Op::ArrayEnd);
+        ops_[end].jump = begin;
+
+        Op& op = ops_[begin];
+        op.jump      = end;
+        op.field_end = leaves_.size();
+        op.is_fixed  = computeSizes(begin + 1, end, op.size, op.min_size);
+    }
+}
+
+void MessageDecoder::addOp(Op::Code code, uint32_t size, uint32_t length, bool is_dynamic) {
+    Op op;
+    op.code       = code;
+    op.field      = leaves_.size();
+    op.field_end  = leaves_.size();
+    op.size       = size;
+    op.min_size   = 0;
+    op.length     = length;
+    op.is_dynamic = is_dynamic;
+    op.is_fixed   = false;
+    op.jump       = 0;
+    ops_.push_back(op);
+}
+
+void MessageDecoder::addLeaf(string const& name, FieldType type, bool fixed) {
+    uint32_t index = leaves_.size();
+
+    Leaf leaf;
+    leaf.type     = type;
+    leaf.offset   = 0;
+    leaf.array    = !fixed && ops_.back().code == Op::PrimitiveArray;
+    leaf.repeated = name.find("[]") != string::npos;
+
+    // Consecutive fixed-size fields are decoded as one run
+    if (fixed) {
+        if (ops_.empty() || ops_.back().code != Op::Fixed)
+            addOp(Op::Fixed);
+
+        Op& op = ops_.back();
+        leaf.offset  = op.size;
+        op.size     += fieldSize(type);
+        op.field_end = index + 1;
+    }
+    else
+        ops_.back().field_end = index + 1;
+
+    leaves_.push_back(leaf);
+    field_names_.push_back(name);
+    field_indexes_[name] = index;
+}
+
+bool MessageDecoder::computeSizes(uint32_t begin, uint32_t end, uint32_t& fixed_size, uint32_t& min_size) const {
+    bool fixed = true;
+    fixed_size = 0;
+    min_size   = 0;
+
+    for (uint32_t i = begin; i < end; i++) {
+        Op const& op = ops_[i];
+        switch (op.code) {
+        case Op::Fixed:
+            fixed_size += op.size;
+            min_size   += op.size;
+            break;
+        case Op::String:
+            fixed = false;
+            min_size += 4;
+            break;
+        case Op::PrimitiveArray:
+            if (op.is_dynamic) {
+                fixed = false;
+                min_size += 4;
+            }
+            else {
+                fixed_size += op.length * op.size;
+                min_size   += op.length * op.size;
+            }
+            break;
+        case Op::ArrayBegin:
+            if (op.is_dynamic) {
+                fixed = false;
+                min_size += 4;
+            }
+            else {
+                fixed       = fixed && op.is_fixed;
+                fixed_size += op.length * op.size;
+                min_size   += op.length * op.min_size;
+            }
+            i = op.jump;
+            break;
+        case Op::ArrayEnd:
+            break;
+        }
+    }
+
+    return fixed;
+}
+
+// Decoding
+
+static void require(uint8_t const* ptr, uint8_t const* end, uint64_t size) {
+    if (size > (uint64_t) (end - ptr))
+        throw BagFormatException("Message data is shorter than its definition");
+}
+
+static uint32_t readLength(uint8_t const*& ptr, uint8_t const* end) {
+    require(ptr, end, 4);
+    uint32_t length = load<uint32_t>(ptr);
+    ptr += 4;
+    return length;
+}
+
+bool MessageDecoder::run(uint8_t const* data, uint32_t size, uint32_t target, Visitor const* visitor, FieldValue* value) const {
+    struct Frame
+    {
+        uint32_t begin;
+        uint32_t remaining;
+    };
+    Frame frames[MAX_DEPTH + 2];
+    int depth = 0;
+
+    uint8_t const* ptr = data;
+    uint8_t const* end = data + size;
+
+    uint32_t i = 0;
+    while (i < ops_.size()) {
+        Op const& op = ops_[i];
+        switch (op.code) {
+        case Op::Fixed:
+        {
+            require(ptr, end, op.size);
+            if (target >= op.field && target < op.field_end) {
+                FieldValue v = { leaves_[target].type, ptr + leaves_[target].offset, 1, false };
+                *value = v;
+                return true;
+            }
+            if (visitor) {
+                for (uint32_t f = op.field; f < op.field_end; f++) {
+                    FieldValue v = { leaves_[f].type, ptr + leaves_[f].offset, 1, false };
+                    (*visitor)(f, v);
+                }
+            }
+            ptr += op.size;
+            i++;
+            break;
+        }
+        case Op::String:
+        {
+            uint32_t length = readLength(ptr, end);
+            require(ptr, end, length);
+            FieldValue v = { fieldtype::String, ptr, length, false };
+            if (target == op.field) {
+                *value = v;
+                return true;
+            }
+            if (visitor)
+                (*visitor)(op.field, v);
+            ptr += length;
+            i++;
+            break;
+        }
+        case Op::PrimitiveArray:
+        {
+            uint32_t length = op.is_dynamic ? readLength(ptr, end) : op.length;
+            uint64_t bytes = (uint64_t) length * op.size;
+            require(ptr, end, bytes);
+            FieldValue v = { leaves_[op.field].type, ptr, length, true };
+            if (target == op.field) {
+                *value = v;
+                return true;
+            }
+            if (visitor)
+                (*visitor)(op.field, v);
+            ptr += bytes;
+            i++;
+            break;
+        }
+        case Op::ArrayBegin:
+        {
+            uint32_t length = op.is_dynamic ? readLength(ptr, end) : op.length;
+            require(ptr, end, (uint64_t) length * op.min_size);
+
+            bool wanted = visitor != NULL || (target >= op.field && target < op.field_end);
+            if (length == 0 || op.jump == i + 1 || (!wanted && op.is_fixed)) {
+                // Skip the whole array at once
+                if (op.is_fixed)
+                    ptr += (uint64_t) length * op.size;
+                i = op.jump + 1;
+                break;
+            }
+
+            frames[depth].begin     = i;
+            frames[depth].remaining = length;
+            depth++;
+            i++;
+            break;
+        }
+        case Op::ArrayEnd:
+        {
+            Frame& frame = frames[depth - 1];
+            if (--frame.remaining > 0)
+                i = frame.begin + 1;
+            else {
+                depth--;
+                i++;
+            }
+            break;
+        }
+        }
+    }
+
+    return false;
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -47,6 +47,10 @@ string const& MessageInstance::getDataType()          const { return connection_
 string const& MessageInstance::getMD5Sum()            const { return connection_info_->md5sum;   }
 string const& MessageInstance::getMessageDefinition() const { return connection_info_->msg_def;  }
 
+ConnectionInfo const* MessageInstance::getConnectionInfo() const { return connection_info_; }
+Bag const&            MessageInstance::getBag()            const { return *bag_;            }
+IndexEntry const&     MessageInstance::getIndexEntry()     const { return index_entry_;     }
+
 shared_ptr<ros::M_string> MessageInstance::getConnectionHeader() const { return connection_info_->header; }
 
 string MessageInstance::getCallerId() const {
@@ -63,5 +67,30 @@ uint32_t MessageInstance::size() const {
     return bag_->readMessageDataSize(index_entry_);
 }
 
+shared_ptr<MessageDecoder const> MessageInstance::getDecoder() const {
+    return MessageDecoder::get(connection_info_);
+}
+
+bool MessageInstance::getField(string const& name, FieldValue& value) const {
+    shared_ptr<MessageDecoder const> decoder = getDecoder();
+    int field = decoder->getFieldIndex(name);
+    if (field < 0)
+        throw BagException("Unknown field " + name + " in message type " + getDataType());
+
+    uint8_t const* data;
+    uint32_t data_size;
+    bag_->readMessageData(index_entry_, data, data_size);
+    return decoder->getField(data, data_size, field, value);
+}
+
+void MessageInstance::decode(MessageDecoder::Visitor const& visitor) const {
+    shared_ptr<MessageDecoder const> decoder = getDecoder();
+
+    uint8_t const* data;
+    uint32_t data_size;
+    bag_->readMessageData(index_entry_, data, data_size);
+    decoder->decode(data, data_size, visitor);
+}
+
 } // namespace rosbag
 } // namespace rosbag_io
@@ -0,0 +1,205 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/playback_clock.h"
+#include "rosbag_io/rosbag/playback_scheduler.h"
+
+namespace rosbag_io {
+namespace rosbag {
+
+// PlaybackClock
+
+PlaybackClock::~PlaybackClock() { }
+
+void PlaybackClock::resume(ros::Time const& time) {
+    begin(time);
+}
+
+// SimulatedClock
+
+SimulatedClock::SimulatedClock(double rate) : rate_(rate > 0.0 ? rate : 0.0), interrupted_(false), anchor_wall_(0) { }
+
+double SimulatedClock::getRate() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return rate_;
+}
+
+void SimulatedClock::setRate(double rate) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    // Keep the current position: only the time to come is scaled
+    int64_t now = PlaybackScheduler::now();
+    if (rate_ > 0.0)
+        anchor_time_ += ros::Duration().fromNSec((int64_t) ((now - anchor_wall_) * rate_));
+    else
+        anchor_time_ = current_;
+    anchor_wall_ = now;
+    rate_ = rate > 0.0 ? rate : 0.0;
+    changed_.notify_all();
+}
+
+void SimulatedClock::begin(ros::Time const& time) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    anchor_time_ = time;
+    anchor_wall_ = PlaybackScheduler::now();
+    current_ = time;
+    ros::Time::setNow(time);
+}
+
+bool SimulatedClock::waitUntil(ros::Time const& time) {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (!interrupted_ && rate_ > 0.0) {
+        int64_t remaining = anchor_wall_ + (int64_t) ((time - anchor_time_).toNSec() / rate_) - PlaybackScheduler::now();
+        if (remaining <= 0)
+            break;
+        changed_.timed_wait(lock, boost::posix_time::microseconds(remaining / 1000 + 1));
+    }
+
+    if (interrupted_) {
+        interrupted_ = false;
+        return false;
+    }
+
+    current_ = time;
+    ros::Time::setNow(time);
+    return true;
+}
+
+void SimulatedClock::interrupt() {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    interrupted_ = true;
+    changed_.notify_all();
+}
+
+void SimulatedClock::end() {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    interrupted_ = false;
+}
+
+// LockStepClock
+
+LockStepClock::LockStepClock() : started_(false), waiting_(false), ended_(false), interrupted_(false), interruptions_(0) { }
+
+ros::Time LockStepClock::getTime() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return until_;
+}
+
+bool LockStepClock::hasEnded() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return ended_;
+}
+
+bool LockStepClock::advance(ros::Duration const& step) {
+    ros::Time until;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        until = until_ + step;
+    }
+    return advanceTo(until);
+}
+
+bool LockStepClock::advanceTo(ros::Time const& until) {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    if (until > until_)
+        until_ = until;
+    changed_.notify_all();
+
+    // Playback is there once it waits for a later message
+    uint64_t interruptions = interruptions_;
+    while (!ended_ && interruptions == interruptions_ && !(started_ && waiting_ && waiting_for_ > until))
+        changed_.wait(lock);
+
+    if (ended_ || interruptions != interruptions_)
+        return false;
+
+    ros::Time::setNow(until);
+    return true;
+}
+
+void LockStepClock::begin(ros::Time const& time) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    // Ticks given before playback starts are kept; seeks and loops start over, failing pending advances
+    if (started_ || until_ < time) {
+        until_ = time;
+        if (started_)
+            interruptions_++;
+    }
+    started_ = true;
+    ended_ = false;
+    ros::Time::setNow(time);
+    changed_.notify_all();
+}
+
+bool LockStepClock::waitUntil(ros::Time const& time) {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (!interrupted_ && time > until_) {
+        waiting_ = true;
+        waiting_for_ = time;
+        changed_.notify_all();
+        changed_.wait(lock);
+    }
+    waiting_ = false;
+
+    if (interrupted_) {
+        interrupted_ = false;
+        return false;
+    }
+
+    ros::Time::setNow(time);
+    return true;
+}
+
+void LockStepClock::resume(ros::Time const& time) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    // Ticks, not the time spent paused, let playback go on; a step may go past them
+    if (until_ < time)
+        until_ = time;
+    ros::Time::setNow(time);
+    changed_.notify_all();
+}
+
+void LockStepClock::interrupt() {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    interrupted_ = true;
+    interruptions_++;
+    changed_.notify_all();
+}
+
+void LockStepClock::end() {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    ended_ = true;
+    started_ = false;
+    waiting_ = false;
+    interrupted_ = false;
+    changed_.notify_all();
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
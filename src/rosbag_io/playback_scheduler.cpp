@@ -0,0 +1,166 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/playback_scheduler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#if defined(__linux__)
+  #include <errno.h>
+  #include <time.h>
+#else
+  #include <chrono>
+  #include <thread>
+#endif
+
+#include <boost/format.hpp>
+
+using std::string;
+using boost::format;
+
+namespace rosbag_io {
+namespace rosbag {
+
+static const int64_t NSEC_PER_SEC = 1000000000;
+
+// LatenessHistogram
+
+LatenessHistogram::LatenessHistogram() {
+    clear();
+}
+
+void LatenessHistogram::clear() {
+    memset(counts, 0, sizeof(counts));
+    count    = 0;
+    total_ns = 0;
+    max_ns   = 0;
+}
+
+void LatenessHistogram::add(int64_t lateness_ns) {
+    lateness_ns = std::max<int64_t>(lateness_ns, 0);
+
+    int bucket = 0;
+    while (bucket < BUCKET_COUNT - 1 && (uint64_t) lateness_ns >= getBucketLimit(bucket))
+        bucket++;
+
+    counts[bucket]++;
+    count++;
+    total_ns += lateness_ns;
+    max_ns    = std::max(max_ns, lateness_ns);
+}
+
+uint64_t LatenessHistogram::getBucketLimit(int bucket) const {
+    return bucket < BUCKET_COUNT - 1 ? ((uint64_t) 1000) << bucket : 0;
+}
+
+double LatenessHistogram::getMean() const {
+    return count > 0 ? (double) total_ns / count : 0.0;
+}
+
+string LatenessHistogram::toString() const {
+    std::ostringstream os;
+    os << *this;
+    return os.str();
+}
+
+std::ostream& operator<<(std::ostream& os, LatenessHistogram const& histogram) {
+    os << format("lateness: %1% messages, mean %2$.1f us, max %3$.1f us\n") % histogram.count % (histogram.getMean() / 1e3) % (histogram.max_ns / 1e3);
+
+    uint64_t lower = 0;
+    for (int i = 0; i < LatenessHistogram::BUCKET_COUNT; i++) {
+        uint64_t upper = histogram.getBucketLimit(i);
+        if (histogram.counts[i] > 0) {
+            if (upper > 0)
+                os << format("  %1$8d - %2$8d us: %3%\n") % (lower / 1000) % (upper / 1000) % histogram.counts[i];
+            else
+                os << format("  %1$8d -          us: %2%\n") % (lower / 1000) % histogram.counts[i];
+        }
+        lower = upper;
+    }
+    return os;
+}
+
+// PlaybackScheduler
+
+PlaybackScheduler::PlaybackScheduler(ros::WallDuration const& spin_tail) {
+    setSpinTail(spin_tail);
+}
+
+void PlaybackScheduler::setSpinTail(ros::WallDuration const& spin_tail) {
+    spin_tail_ns_ = std::max<int64_t>(spin_tail.toNSec(), 0);
+}
+
+ros::WallDuration PlaybackScheduler::getSpinTail() const {
+    ros::WallDuration spin_tail;
+    spin_tail.fromNSec(spin_tail_ns_);
+    return spin_tail;
+}
+
+int64_t PlaybackScheduler::now() {
+#if defined(__linux__)
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+int64_t PlaybackScheduler::waitUntil(int64_t deadline) {
+    int64_t sleep_until = deadline - spin_tail_ns_;
+    if (now() < sleep_until) {
+#if defined(__linux__)
+        timespec ts;
+        ts.tv_sec  = sleep_until / NSEC_PER_SEC;
+        ts.tv_nsec = sleep_until % NSEC_PER_SEC;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+#else
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(sleep_until)));
+#endif
+    }
+
+    // Spin through the tail
+    int64_t t = now();
+    while (t < deadline)
+        t = now();
+
+    int64_t lateness = t - deadline;
+    lateness_.add(lateness);
+    return lateness;
+}
+
+LatenessHistogram const& PlaybackScheduler::getLateness() const { return lateness_; }
+
+void PlaybackScheduler::resetLateness() {
+    lateness_.clear();
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -0,0 +1,344 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/read_pipeline.h"
+#include "rosbag_io/rosbag/chunk_reader.h"
+#include "rosbag_io/rosbag/view.h"
+
+#include <chrono>
+
+#include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
+
+using std::map;
+using std::pair;
+using std::vector;
+using boost::shared_ptr;
+
+namespace rosbag_io {
+namespace rosbag {
+
+static double seconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration<double>(end - start).count();
+}
+
+// PipelineStageStats
+
+double PipelineStageStats::getOccupancy(double seconds) const {
+    return threads > 0 && seconds > 0 ? busy_seconds / (threads * seconds) : 0.0;
+}
+
+// ReadPipeline
+
+ReadPipeline::ReadPipeline(View& view, uint32_t read_threads, uint32_t decompress_threads, uint32_t decode_threads, uint32_t capacity)
+    : capacity_(std::max(capacity, 1u)), stopping_(false), next_read_(0), next_delivery_(0)
+{
+    if (decompress_threads == 0)
+        decompress_threads = std::max(1u, boost::thread::hardware_concurrency());
+
+    threads_[READ]       = std::max(read_threads, 1u);
+    threads_[DECOMPRESS] = decompress_threads;
+    threads_[DECODE]     = std::max(decode_threads, 1u);
+    threads_[USER]       = 1;
+
+    for (MessageInstance const& m : view) {
+        IndexEntry const& index_entry = m.getIndexEntry();
+        if (runs_.empty() || runs_.back().bag != &m.getBag() || runs_.back().chunk_pos != index_entry.chunk_pos) {
+            runs_.push_back(Run());
+            runs_.back().bag       = &m.getBag();
+            runs_.back().chunk_pos = index_entry.chunk_pos;
+        }
+        runs_.back().messages.push_back(m);
+    }
+}
+
+ReadPipeline::~ReadPipeline() { }
+
+void ReadPipeline::setDecoder(Decoder const& decoder) {
+    decoder_ = decoder;
+}
+
+void ReadPipeline::stop() {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    stopping_ = true;
+    changed_.notify_all();
+}
+
+PipelineStageStats& ReadPipeline::getStageStats(Stage stage) {
+    return const_cast<PipelineStageStats&>(static_cast<ReadPipeline const*>(this)->getStageStats(stage));
+}
+
+PipelineStageStats const& ReadPipeline::getStageStats(Stage stage) const {
+    switch (stage) {
+    case READ:       return stats_.read;
+    case DECOMPRESS: return stats_.decompress;
+    case DECODE:     return stats_.decode;
+    default:         return stats_.user;
+    }
+}
+
+PipelineStats ReadPipeline::getStats() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return stats_;
+}
+
+void ReadPipeline::run(Callback const& callback) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        stopping_      = false;
+        error_         = std::exception_ptr();
+        next_read_     = 0;
+        next_delivery_ = 0;
+        for (int s = READ; s < STAGE_COUNT; s++) {
+            inputs_[s].clear();
+            remaining_[s] = runs_.size();
+            pending_[s]   = 0;
+            getStageStats((Stage) s) = PipelineStageStats();
+            getStageStats((Stage) s).threads = threads_[s];
+        }
+        stats_.seconds = 0;
+    }
+
+    boost::thread_group threads;
+    for (int s = READ; s < USER; s++)
+        for (uint32_t i = 0; i < threads_[s]; i++)
+            threads.create_thread(boost::bind(&ReadPipeline::work, this, (Stage) s));
+
+    // Deliver the runs in order
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (!stopping_ && next_delivery_ < runs_.size()) {
+        map<size_t, Run*>& input = inputs_[USER];
+        if (input.empty() || input.begin()->first != next_delivery_) {
+            stats_.user.starved++;
+            changed_.wait(lock);
+            continue;
+        }
+
+        Run& run = *input.begin()->second;
+        input.erase(input.begin());
+        pending_[DECODE]--;
+        stats_.user.queue_depth = input.size();
+        remaining_[USER]--;
+        changed_.notify_all();
+        lock.unlock();
+
+        std::chrono::steady_clock::time_point busy = std::chrono::steady_clock::now();
+        uint64_t bytes = 0;
+        size_t   count = 0;
+        try {
+            for (PipelineMessage const& m : run.decoded) {
+                callback(m);
+                bytes += m.data_size;
+                count++;
+
+                boost::lock_guard<boost::mutex> stop_lock(mutex_);
+                if (stopping_)
+                    break;
+            }
+        }
+        catch (...) {
+            boost::lock_guard<boost::mutex> error_lock(mutex_);
+            if (!error_)
+                error_ = std::current_exception();
+            stopping_ = true;
+        }
+        run.decoded.clear();
+        run.chunk.reset();
+
+        lock.lock();
+        stats_.user.items        += count;
+        stats_.user.bytes        += bytes;
+        stats_.user.busy_seconds += seconds(busy, std::chrono::steady_clock::now());
+        next_delivery_++;
+        changed_.notify_all();
+    }
+    stopping_ = true;
+    changed_.notify_all();
+    lock.unlock();
+
+    threads.join_all();
+
+    lock.lock();
+    for (Run& run : runs_) {
+        run.raw.reset();
+        run.chunk.reset();
+        run.decoded.clear();
+    }
+    for (int s = READ; s < STAGE_COUNT; s++)
+        inputs_[s].clear();
+    chunks_.clear();
+    stats_.seconds = seconds(start, std::chrono::steady_clock::now());
+
+    if (error_)
+        std::rethrow_exception(error_);
+}
+
+void ReadPipeline::work(Stage stage) {
+    PipelineStageStats& stats = getStageStats(stage);
+    ChunkReaders        readers;
+
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (true) {
+        // Take the oldest run waiting, if the next stage has room for it
+        size_t index = 0;
+        while (true) {
+            if (stopping_ || remaining_[stage] == 0)
+                return;
+
+            bool available;
+            if (stage == READ) {
+                available = true;
+                index     = next_read_;
+            }
+            else {
+                available = !inputs_[stage].empty();
+                if (available)
+                    index = inputs_[stage].begin()->first;
+            }
+
+            if (!available)
+                stats.starved++;
+            else if (pending_[stage] >= capacity_ && index != next_delivery_)
+                stats.blocked++;
+            else
+                break;
+            changed_.wait(lock);
+        }
+
+        Run* run;
+        if (stage == READ) {
+            run = &runs_[next_read_++];
+        }
+        else {
+            run = inputs_[stage].begin()->second;
+            inputs_[stage].erase(inputs_[stage].begin());
+            pending_[stage - 1]--;
+            stats.queue_depth = inputs_[stage].size();
+        }
+        remaining_[stage]--;
+        pending_[stage]++;
+        changed_.notify_all();
+        lock.unlock();
+
+        std::chrono::steady_clock::time_point busy = std::chrono::steady_clock::now();
+        uint64_t bytes = 0;
+        try {
+            bytes = process(stage, *run, readers);
+        }
+        catch (...) {
+            lock.lock();
+            if (!error_)
+                error_ = std::current_exception();
+            stopping_ = true;
+            changed_.notify_all();
+            return;
+        }
+        double busy_seconds = seconds(busy, std::chrono::steady_clock::now());
+
+        lock.lock();
+        stats.items        += stage == DECODE ? run->messages.size() : 1;
+        stats.bytes        += bytes;
+        stats.busy_seconds += busy_seconds;
+
+        map<size_t, Run*>&  output       = inputs_[stage + 1];
+        PipelineStageStats& output_stats = getStageStats((Stage) (stage + 1));
+        output[index] = run;
+        output_stats.queue_depth     = output.size();
+        output_stats.max_queue_depth = std::max<uint32_t>(output_stats.max_queue_depth, output.size());
+        changed_.notify_all();
+    }
+}
+
+uint64_t ReadPipeline::process(Stage stage, Run& run, ChunkReaders& readers) {
+    shared_ptr<ChunkReader>& reader = readers[run.bag];
+    if (!reader)
+        reader = boost::make_shared<ChunkReader>(*run.bag);
+
+    pair<Bag const*, uint64_t> key(run.bag, run.chunk_pos);
+
+    switch (stage) {
+    case READ:
+    {
+        // A chunk still held by a message of an earlier run is not read again
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            map<pair<Bag const*, uint64_t>, boost::weak_ptr<Buffer> >::const_iterator pinned = chunks_.find(key);
+            if (pinned != chunks_.end())
+                run.chunk = pinned->second.lock();
+        }
+        if (run.chunk)
+            return 0;
+
+        run.raw = boost::make_shared<Buffer>();
+        reader->readRawChunk(run.chunk_pos, run.chunk_header, *run.raw);
+        return run.raw->getSize();
+    }
+
+    case DECOMPRESS:
+    {
+        if (run.chunk)
+            return 0;
+
+        run.chunk = boost::make_shared<Buffer>();
+        reader->decompressChunk(run.chunk_header, *run.raw, *run.chunk);
+        run.raw.reset();
+
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        for (map<pair<Bag const*, uint64_t>, boost::weak_ptr<Buffer> >::iterator i = chunks_.begin(); i != chunks_.end(); ) {
+            if (i->second.expired())
+                chunks_.erase(i++);
+            else
+                ++i;
+        }
+        chunks_[key] = run.chunk;
+        return run.chunk->getSize();
+    }
+
+    default:
+    {
+        uint64_t bytes = 0;
+        run.decoded.clear();
+        run.decoded.reserve(run.messages.size());
+        for (MessageInstance const& m : run.messages) {
+            uint8_t const* data;
+            uint32_t       data_size;
+            ChunkReader::locateMessageData(run.chunk->getData(), run.chunk->getSize(), m.getIndexEntry().offset, data, data_size);
+
+            run.decoded.push_back(PipelineMessage(m, run.chunk, data, data_size));
+            if (decoder_)
+                decoder_(run.decoded.back());
+            bytes += data_size;
+        }
+        return bytes;
+    }
+    }
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -0,0 +1,101 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/record_header.h"
+
+#include <cstring>
+
+using std::string;
+using rosbag_io::ros::M_string;
+
+namespace rosbag_io {
+namespace rosbag {
+
+static uint8_t* encodeField(uint8_t* ptr, string const& name, void const* value, uint32_t size) {
+    uint32_t field_len = name.length() + 1 + size;
+    memcpy(ptr, &field_len, 4);
+    ptr += 4;
+    memcpy(ptr, name.data(), name.length());
+    ptr += name.length();
+    *ptr++ = '=';
+    if (size > 0)
+        memcpy(ptr, value, size);
+    return ptr + size;
+}
+
+RecordHeader::RecordHeader() {
+    clear();
+}
+
+void RecordHeader::clear() {
+    data_.assign(4, 0);
+}
+
+void RecordHeader::add(string const& name, ros::Time const* value) {
+    uint64_t packed_time = (((uint64_t) value->nsec) << 32) + value->sec;
+    add(name, &packed_time, sizeof(packed_time));
+}
+
+void RecordHeader::add(string const& name, string const& value) {
+    add(name, value.data(), value.length());
+}
+
+void RecordHeader::add(string const& name, void const* value, uint32_t size) {
+    size_t offset = data_.size();
+    data_.resize(offset + 4 + name.length() + 1 + size);
+    encodeField(&data_[offset], name, value, size);
+
+    uint32_t header_len = data_.size() - 4;
+    memcpy(&data_[0], &header_len, 4);
+}
+
+void RecordHeader::assign(M_string const& fields) {
+    data_.resize(getEncodedSize(fields));
+    encode(fields, &data_[0]);
+}
+
+uint8_t const* RecordHeader::getData() const { return &data_[0];    }
+uint32_t       RecordHeader::getSize() const { return data_.size(); }
+
+uint32_t RecordHeader::getEncodedSize(M_string const& fields) {
+    uint32_t size = 4;
+    for (M_string::const_iterator i = fields.begin(); i != fields.end(); i++)
+        size += 4 + i->first.length() + 1 + i->second.length();
+    return size;
+}
+
+void RecordHeader::encode(M_string const& fields, uint8_t* dest) {
+    uint8_t* ptr = dest + 4;
+    for (M_string::const_iterator i = fields.begin(); i != fields.end(); i++)
+        ptr = encodeField(ptr, i->first, i->second.data(), i->second.length());
+
+    uint32_t header_len = ptr - dest - 4;
+    memcpy(dest, &header_len, 4);
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -0,0 +1,270 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/shared_chunk_cache.h"
+#include "rosbag_io/rosbag/bag_index.h"
+#include "rosbag_io/rosbag/exceptions.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#include <boost/functional/hash.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread.hpp>
+
+using std::string;
+
+namespace ipc = boost::interprocess;
+
+namespace rosbag_io {
+namespace rosbag {
+
+static const uint32_t CACHE_MAGIC      = 0x52424343;   // "RBCC"
+static const uint64_t PAGE_SIZE        = 4096;
+static const int      OPEN_TIMEOUT_MS  = 1000;
+static const int      STORE_TIMEOUT_MS = 100;
+
+BOOST_STATIC_ASSERT(boost::atomic<uint32_t>::is_always_lock_free);
+BOOST_STATIC_ASSERT(boost::atomic<uint64_t>::is_always_lock_free);
+
+struct SharedChunkCache::Header
+{
+    Header() : ready(0), slot_count(0), slot_size(0), data_offset(0), clock(0) { }
+
+    boost::atomic<uint32_t>   ready;          //!< CACHE_MAGIC once the creator has initialized the cache
+    uint32_t                  slot_count;
+    uint32_t                  slot_size;
+    uint64_t                  data_offset;    //!< offset of the data of the first slot
+    ipc::interprocess_mutex   mutex;          //!< serializes stores
+    boost::atomic<uint64_t>   clock;          //!< incremented on every use of a slot
+};
+
+struct SharedChunkCache::Slot
+{
+    Slot() : sequence(0), size(0), file_id(0), chunk_pos(0), last_use(0) { }
+
+    boost::atomic<uint32_t> sequence;   //!< odd while the slot is being rewritten
+    boost::atomic<uint32_t> size;
+    boost::atomic<uint64_t> file_id;    //!< 0 if the slot is empty
+    boost::atomic<uint64_t> chunk_pos;
+    boost::atomic<uint64_t> last_use;
+};
+
+SharedChunkCache::SharedChunkCache(string const& name, uint64_t size, uint32_t slot_size)
+    : name_(name), header_(NULL), hits_(0), misses_(0)
+{
+    if (slot_size == 0)
+        throw BagException("Shared chunk cache slot size must be positive");
+
+    try {
+        ipc::shared_memory_object shm;
+        bool created = false;
+        try {
+            ipc::shared_memory_object(ipc::create_only, name.c_str(), ipc::read_write).swap(shm);
+            created = true;
+        }
+        catch (ipc::interprocess_exception const&) {
+            ipc::shared_memory_object(ipc::open_only, name.c_str(), ipc::read_write).swap(shm);
+        }
+
+        if (created) {
+            uint32_t slot_count  = (uint32_t) std::min<uint64_t>(std::max<uint64_t>(size / slot_size, 1), std::numeric_limits<uint32_t>::max());
+            uint64_t data_offset = (sizeof(Header) + slot_count * sizeof(Slot) + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+            shm.truncate(data_offset + (uint64_t) slot_count * slot_size);
+            region_.reset(new ipc::mapped_region(shm, ipc::read_write));
+
+            header_ = new (region_->get_address()) Header;
+            header_->slot_count  = slot_count;
+            header_->slot_size   = slot_size;
+            header_->data_offset = data_offset;
+            for (uint32_t i = 0; i < slot_count; i++)
+                new (getSlot(i)) Slot;
+
+            header_->ready.store(CACHE_MAGIC, boost::memory_order_release);
+        }
+        else {
+            map(shm);
+        }
+    }
+    catch (ipc::interprocess_exception const& ex) {
+        throw BagException("Error opening shared chunk cache " + name + ": " + ex.what());
+    }
+}
+
+SharedChunkCache::SharedChunkCache(string const& name)
+    : name_(name), header_(NULL), hits_(0), misses_(0)
+{
+    try {
+        ipc::shared_memory_object shm(ipc::open_only, name.c_str(), ipc::read_write);
+        map(shm);
+    }
+    catch (ipc::interprocess_exception const& ex) {
+        throw BagException("Error opening shared chunk cache " + name + ": " + ex.what());
+    }
+}
+
+SharedChunkCache::~SharedChunkCache() { }
+
+bool SharedChunkCache::remove(string const& name) {
+    return ipc::shared_memory_object::remove(name.c_str());
+}
+
+// Map the cache once its creator has sized and initialized it
+void SharedChunkCache::map(ipc::shared_memory_object& shm) {
+    ipc::offset_t shm_size = 0;
+    for (int i = 0; !shm.get_size(shm_size) || shm_size < (ipc::offset_t) sizeof(Header); i++) {
+        if (i >= OPEN_TIMEOUT_MS)
+            throw BagException("Shared chunk cache " + name_ + " was never sized, remove it to recreate it");
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    region_.reset(new ipc::mapped_region(shm, ipc::read_write));
+
+    header_ = static_cast<Header*>(region_->get_address());
+    for (int i = 0; header_->ready.load(boost::memory_order_acquire) != CACHE_MAGIC; i++) {
+        if (i >= OPEN_TIMEOUT_MS)
+            throw BagException("Shared chunk cache " + name_ + " was never initialized, remove it to recreate it");
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    if (region_->get_size() < header_->data_offset + (uint64_t) header_->slot_count * header_->slot_size)
+        throw BagException("Shared chunk cache " + name_ + " is truncated");
+}
+
+uint64_t SharedChunkCache::getFileId(string const& filename) {
+    BagIndexRegistry::Key key;
+    if (!BagIndexRegistry::getKey(filename, key))
+        return 0;
+
+    uint64_t file_id = 0;
+    boost::hash_combine(file_id, key.path);
+    boost::hash_combine(file_id, key.size);
+    boost::hash_combine(file_id, key.mtime);
+    return file_id != 0 ? file_id : 1;
+}
+
+SharedChunkCache::Slot* SharedChunkCache::getSlot(uint32_t i) const {
+    return reinterpret_cast<Slot*>(static_cast<uint8_t*>(region_->get_address()) + sizeof(Header)) + i;
+}
+
+uint8_t* SharedChunkCache::getSlotData(uint32_t i) const {
+    return static_cast<uint8_t*>(region_->get_address()) + header_->data_offset + (uint64_t) i * header_->slot_size;
+}
+
+bool SharedChunkCache::get(uint64_t file_id, uint64_t chunk_pos, Buffer& buffer) {
+    if (file_id != 0) {
+        for (uint32_t i = 0; i < header_->slot_count; i++) {
+            Slot* slot = getSlot(i);
+
+            uint32_t sequence = slot->sequence.load(boost::memory_order_acquire);
+            if (sequence & 1)
+                continue;
+            if (slot->file_id.load(boost::memory_order_relaxed) != file_id || slot->chunk_pos.load(boost::memory_order_relaxed) != chunk_pos)
+                continue;
+
+            uint32_t size = std::min(slot->size.load(boost::memory_order_relaxed), header_->slot_size);
+            buffer.setSize(size);
+            memcpy(buffer.getData(), getSlotData(i), size);
+
+            // The copy is only valid if no store rewrote the slot meanwhile
+            boost::atomic_thread_fence(boost::memory_order_acquire);
+            if (slot->sequence.load(boost::memory_order_relaxed) != sequence)
+                break;
+
+            slot->last_use.store(header_->clock.fetch_add(1, boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+            hits_++;
+            return true;
+        }
+    }
+
+    misses_++;
+    return false;
+}
+
+bool SharedChunkCache::contains(uint64_t file_id, uint64_t chunk_pos) const {
+    if (file_id == 0)
+        return false;
+
+    for (uint32_t i = 0; i < header_->slot_count; i++) {
+        Slot* slot = getSlot(i);
+        if (slot->file_id.load(boost::memory_order_relaxed) == file_id && slot->chunk_pos.load(boost::memory_order_relaxed) == chunk_pos)
+            return (slot->sequence.load(boost::memory_order_acquire) & 1) == 0;
+    }
+    return false;
+}
+
+void SharedChunkCache::put(uint64_t file_id, uint64_t chunk_pos, uint8_t const* data, uint32_t size) {
+    if (file_id == 0 || size > header_->slot_size)
+        return;
+
+    boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(STORE_TIMEOUT_MS);
+    ipc::scoped_lock<ipc::interprocess_mutex> lock(header_->mutex, deadline);
+    if (!lock.owns())
+        return;
+
+    // Replace the least recently used slot, unless another process stored the chunk already
+    uint32_t victim   = 0;
+    uint64_t min_used = std::numeric_limits<uint64_t>::max();
+    for (uint32_t i = 0; i < header_->slot_count; i++) {
+        Slot* slot = getSlot(i);
+        if (slot->file_id.load(boost::memory_order_relaxed) == file_id && slot->chunk_pos.load(boost::memory_order_relaxed) == chunk_pos)
+            return;
+
+        uint64_t last_use = slot->last_use.load(boost::memory_order_relaxed);
+        if (last_use < min_used) {
+            victim   = i;
+            min_used = last_use;
+        }
+    }
+
+    // Make the sequence odd while rewriting, even if a process died while rewriting the slot before
+    Slot* slot = getSlot(victim);
+    uint32_t sequence = slot->sequence.load(boost::memory_order_relaxed) | 1;
+    slot->sequence.store(sequence, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+
+    slot->file_id.store(file_id, boost::memory_order_relaxed);
+    slot->chunk_pos.store(chunk_pos, boost::memory_order_relaxed);
+    slot->size.store(size, boost::memory_order_relaxed);
+    memcpy(getSlotData(victim), data, size);
+    slot->last_use.store(header_->clock.fetch_add(1, boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+
+    slot->sequence.store(sequence + 1, boost::memory_order_release);
+}
+
+string   SharedChunkCache::getName()      const { return name_;                }
+uint32_t SharedChunkCache::getSlotCount() const { return header_->slot_count;  }
+uint32_t SharedChunkCache::getSlotSize()  const { return header_->slot_size;   }
+uint64_t SharedChunkCache::getHits()      const { return hits_;                }
+uint64_t SharedChunkCache::getMisses()    const { return misses_;              }
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -0,0 +1,477 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/snapshot_recorder.h"
+#include "rosbag_io/roslz4/lz4s.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <boost/bind/bind.hpp>
+
+using std::map;
+using std::string;
+using boost::shared_ptr;
+using rosbag_io::ros::M_string;
+
+namespace rosbag_io {
+namespace rosbag {
+
+//! A serialized message of a snapshot, written into a bag as is
+struct SnapshotMessage
+{
+    SnapshotMessage(ConnectionInfo const* connection_info, uint8_t const* data, uint32_t data_size)
+        : connection_info(connection_info), data(data), data_size(data_size) { }
+
+    ConnectionInfo const* connection_info;
+    uint8_t const*        data;
+    uint32_t              data_size;
+};
+
+} // namespace rosbag
+} // namespace rosbag_io
+
+namespace rosbag_io {
+namespace ros {
+namespace message_traits {
+
+template<>
+struct MD5Sum<rosbag::SnapshotMessage>
+{
+    static const char* value(const rosbag::SnapshotMessage& m) { return m.connection_info->md5sum.c_str(); }
+};
+
+template<>
+struct DataType<rosbag::SnapshotMessage>
+{
+    static const char* value(const rosbag::SnapshotMessage& m) { return m.connection_info->datatype.c_str(); }
+};
+
+template<>
+struct Definition<rosbag::SnapshotMessage>
+{
+    static const char* value(const rosbag::SnapshotMessage& m) { return m.connection_info->msg_def.c_str(); }
+};
+
+} // namespace message_traits
+
+namespace serialization
+{
+
+template<>
+struct Serializer<rosbag::SnapshotMessage>
+{
+    template<typename Stream>
+    inline static void write(Stream& stream, const rosbag::SnapshotMessage& m) {
+        serializeBlob(stream, m.data, m.data_size);
+    }
+
+    inline static uint32_t serializedLength(const rosbag::SnapshotMessage& m) {
+        return m.data_size;
+    }
+};
+
+} // namespace serialization
+} // namespace ros
+} // namespace rosbag_io
+
+namespace rosbag_io {
+namespace rosbag {
+
+// Each message in a block is a record header of the connection id, the time and the size of the
+// message, followed by the serialized message
+static const uint32_t RECORD_HEADER_SIZE = 4 * sizeof(uint32_t);
+
+static const int LZ4_BLOCK_SIZE_ID = 4;
+
+SnapshotRecorder::SnapshotRecorder(ros::Duration const& duration, uint64_t size, CompressionType compression, uint32_t block_size)
+    : duration_(duration), compression_(compression), block_size_(block_size),
+      head_(0), size_(0), message_count_(0), drop_count_(0), closing_(false)
+{
+    if (compression != compression::Uncompressed && compression != compression::LZ4)
+        throw BagException("Snapshots can only be compressed with LZ4");
+    if (block_size <= RECORD_HEADER_SIZE || size < block_size)
+        throw BagException("The snapshot ring must hold at least one block");
+
+    // Allocate everything up front, so that recording allocates nothing but connections
+    ring_.resize(size);
+    current_.setSize(block_size);
+    current_.setSize(0);
+    if (compression_ == compression::LZ4) {
+        compressed_.setSize(block_size);
+        compressed_.setSize(0);
+    }
+    current_block_.message_count = 0;
+}
+
+SnapshotRecorder::~SnapshotRecorder() {
+    try {
+        waitForSnapshots();
+    }
+    catch (...) { }
+}
+
+uint32_t SnapshotRecorder::getConnectionId(string const& topic, char const* datatype, char const* md5sum, char const* msg_def,
+                                           shared_ptr<M_string> const& connection_header)
+{
+    // As in Bag::doWrite, connections written with a header are told apart by their topic too, so
+    // that a header shared by several topics does not record them all under the first
+    M_string connection_header_copy;
+    if (connection_header) {
+        connection_header_copy = *connection_header;
+        connection_header_copy["topic"] = topic;
+
+        map<M_string, uint32_t>::const_iterator i = header_connection_ids_.find(connection_header_copy);
+        if (i != header_connection_ids_.end())
+            return i->second;
+    }
+    else {
+        map<string, uint32_t>::const_iterator i = topic_connection_ids_.find(topic);
+        if (i != topic_connection_ids_.end())
+            return i->second;
+    }
+
+    ConnectionInfo connection_info;
+    connection_info.id       = connections_.size();
+    connection_info.topic    = topic;
+    connection_info.datatype = datatype;
+    connection_info.md5sum   = md5sum;
+    connection_info.msg_def  = msg_def;
+    if (connection_header) {
+        connection_info.header = connection_header;
+        header_connection_ids_[connection_header_copy] = connection_info.id;
+    }
+    else {
+        connection_info.header = boost::make_shared<M_string>();
+        (*connection_info.header)["type"]               = connection_info.datatype;
+        (*connection_info.header)["md5sum"]             = connection_info.md5sum;
+        (*connection_info.header)["message_definition"] = connection_info.msg_def;
+        topic_connection_ids_[topic] = connection_info.id;
+    }
+    connections_.push_back(connection_info);
+    return connection_info.id;
+}
+
+uint8_t* SnapshotRecorder::reserve(boost::unique_lock<boost::mutex>& lock, uint32_t connection_id, ros::Time const& time, uint32_t data_size) {
+    if (data_size > block_size_ - RECORD_HEADER_SIZE) {
+        drop_count_++;
+        return NULL;
+    }
+    if (current_.getSize() + RECORD_HEADER_SIZE + data_size > block_size_)
+        seal(lock);
+
+    uint32_t offset = current_.getSize();
+    current_.setSize(offset + RECORD_HEADER_SIZE + data_size);
+
+    uint32_t header[4] = { connection_id, time.sec, time.nsec, data_size };
+    memcpy(current_.getData() + offset, header, RECORD_HEADER_SIZE);
+
+    if (current_block_.message_count == 0) {
+        current_block_.start_time = time;
+        current_block_.end_time   = time;
+    }
+    else {
+        current_block_.start_time = std::min(current_block_.start_time, time);
+        current_block_.end_time   = std::max(current_block_.end_time, time);
+    }
+    current_block_.message_count++;
+    message_count_++;
+
+    return current_.getData() + offset + RECORD_HEADER_SIZE;
+}
+
+static bool overlaps(uint64_t offset, uint64_t size, uint64_t other_offset, uint64_t other_size) {
+    return offset < other_offset + other_size && other_offset < offset + size;
+}
+
+bool SnapshotRecorder::isPinned(uint64_t offset, uint64_t size) const {
+    for (std::vector<Block> const* blocks : pinned_)
+        for (Block const& block : *blocks)
+            if (overlaps(block.offset, block.size, offset, size))
+                return true;
+    return false;
+}
+
+void SnapshotRecorder::seal(boost::unique_lock<boost::mutex>& lock) {
+    // Wait for the snapshots being copied out of where the block may go.  The block is no larger
+    // than its uncompressed size, and goes at the head or, when wrapping around, at the start.
+    while (current_block_.message_count > 0 && !pinned_.empty()) {
+        uint64_t max_size = current_.getSize();
+        bool     pinned   = head_ + max_size > ring_.size() ? isPinned(head_, ring_.size() - head_) || isPinned(0, max_size)
+                                                            : isPinned(head_, max_size);
+        if (!pinned)
+            break;
+        unpinned_.wait(lock);
+    }
+
+    if (current_block_.message_count == 0)
+        return;
+
+    Block block = current_block_;
+    block.raw_size   = current_.getSize();
+    block.size       = current_.getSize();
+    block.compressed = false;
+
+    uint8_t const* data = current_.getData();
+    if (compression_ == compression::LZ4) {
+        // Keep the block as is if it does not compress
+        compressed_.setSize(block_size_);
+        unsigned int compressed_size = block_size_;
+        int ret = roslz4_buffToBuffCompress((char*) current_.getData(), current_.getSize(), (char*) compressed_.getData(), &compressed_size, LZ4_BLOCK_SIZE_ID);
+        if (ret == ROSLZ4_OK && compressed_size < block.raw_size) {
+            data             = compressed_.getData();
+            block.size       = compressed_size;
+            block.compressed = true;
+        }
+    }
+
+    // Drop the blocks past the head when wrapping around, and the blocks the new one overlaps
+    if (head_ + block.size > ring_.size()) {
+        while (!blocks_.empty() && blocks_.front().offset >= head_) {
+            size_          -= blocks_.front().size;
+            message_count_ -= blocks_.front().message_count;
+            blocks_.pop_front();
+        }
+        head_ = 0;
+    }
+    while (!blocks_.empty() && blocks_.front().offset < head_ + block.size && blocks_.front().offset + blocks_.front().size > head_) {
+        size_          -= blocks_.front().size;
+        message_count_ -= blocks_.front().message_count;
+        blocks_.pop_front();
+    }
+
+    block.offset = head_;
+    memcpy(&ring_[head_], data, block.size);
+    blocks_.push_back(block);
+    head_ += block.size;
+    size_ += block.size;
+
+    current_.setSize(0);
+    current_block_.message_count = 0;
+
+    evict(block.end_time);
+}
+
+void SnapshotRecorder::evict(ros::Time const& end_time) {
+    if (duration_ <= ros::Duration(0, 0))
+        return;
+
+    // Keep the blocks with a message in the duration before end_time
+    while (!blocks_.empty() && blocks_.front().end_time + duration_ < end_time) {
+        size_          -= blocks_.front().size;
+        message_count_ -= blocks_.front().message_count;
+        blocks_.pop_front();
+    }
+}
+
+void SnapshotRecorder::forget() {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    blocks_.clear();
+    head_          = 0;
+    size_          = 0;
+    message_count_ = 0;
+    current_.setSize(0);
+    current_block_.message_count = 0;
+}
+
+void SnapshotRecorder::snapshot(string const& filename) {
+    rethrowError();
+
+    shared_ptr<Snapshot> snapshot = boost::make_shared<Snapshot>();
+    snapshot->filename = filename;
+
+    // Pin the blocks, then copy them without holding the lock: recording goes on meanwhile, and only
+    // waits if it wraps around onto the blocks before they are copied
+    std::vector<Block> blocks;
+    uint64_t           size;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        seal(lock);
+
+        snapshot->connections = connections_;
+        blocks.assign(blocks_.begin(), blocks_.end());
+        size = size_;
+        pinned_.push_back(&blocks);
+    }
+
+    try {
+        snapshot->data.reserve(size);
+        snapshot->blocks.reserve(blocks.size());
+        for (Block const& block : blocks) {
+            snapshot->blocks.push_back(block);
+            snapshot->blocks.back().offset = snapshot->data.size();
+            snapshot->data.insert(snapshot->data.end(), ring_.begin() + block.offset, ring_.begin() + block.offset + block.size);
+        }
+    }
+    catch (...) {
+        unpin(blocks);
+        throw;
+    }
+    unpin(blocks);
+
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if (!writer_.joinable()) {
+        closing_ = false;
+        writer_  = boost::thread(boost::bind(&SnapshotRecorder::writeSnapshots, this));
+    }
+    snapshots_.push_back(snapshot);
+    queued_.notify_all();
+}
+
+void SnapshotRecorder::unpin(std::vector<Block> const& blocks) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    pinned_.erase(std::find(pinned_.begin(), pinned_.end(), &blocks));
+    unpinned_.notify_all();
+}
+
+void SnapshotRecorder::waitForSnapshots() {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        closing_ = true;
+        queued_.notify_all();
+    }
+    if (writer_.joinable())
+        writer_.join();
+
+    rethrowError();
+}
+
+void SnapshotRecorder::rethrowError() {
+    std::exception_ptr error;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        error  = error_;
+        error_ = std::exception_ptr();
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void SnapshotRecorder::writeSnapshots() {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (true) {
+        while (snapshots_.empty() && !closing_)
+            queued_.wait(lock);
+        if (snapshots_.empty())
+            return;
+
+        shared_ptr<Snapshot> snapshot = snapshots_.front();
+        lock.unlock();
+
+        std::exception_ptr error;
+        try {
+            writeSnapshot(*snapshot);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        snapshot.reset();
+
+        lock.lock();
+        snapshots_.pop_front();
+        if (error && !error_)
+            error_ = error;
+    }
+}
+
+void SnapshotRecorder::writeSnapshot(Snapshot const& snapshot) {
+    Bag bag;
+    bag.setCompression(compression_);
+    bag.open(snapshot.filename, bagmode::Write);
+
+    Buffer raw;
+    for (Block const& block : snapshot.blocks) {
+        uint8_t const* data = &snapshot.data[block.offset];
+        if (block.compressed) {
+            raw.setSize(block.raw_size);
+            unsigned int raw_size = block.raw_size;
+            int ret = roslz4_buffToBuffDecompress((char*) data, block.size, (char*) raw.getData(), &raw_size);
+            if (ret != ROSLZ4_OK || raw_size != block.raw_size)
+                throw BagException("Error decompressing a block of snapshot " + snapshot.filename);
+            data = raw.getData();
+        }
+
+        for (uint32_t offset = 0; offset < block.raw_size; ) {
+            uint32_t header[4];
+            memcpy(header, data + offset, RECORD_HEADER_SIZE);
+            ConnectionInfo const& connection_info = snapshot.connections[header[0]];
+
+            SnapshotMessage message(&connection_info, data + offset + RECORD_HEADER_SIZE, header[3]);
+            bag.write(connection_info.topic, ros::Time(header[1], header[2]), message, connection_info.header);
+            offset += RECORD_HEADER_SIZE + header[3];
+        }
+    }
+
+    bag.close();
+}
+
+uint64_t SnapshotRecorder::getCapacity() const { return ring_.size(); }
+
+uint64_t SnapshotRecorder::getSize() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return size_;
+}
+
+uint64_t SnapshotRecorder::getMessageCount() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return message_count_;
+}
+
+uint64_t SnapshotRecorder::getDropCount() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return drop_count_;
+}
+
+ros::Time SnapshotRecorder::getBeginTime() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    ros::Time begin_time = ros::TIME_MAX;
+    for (Block const& block : blocks_)
+        begin_time = std::min(begin_time, block.start_time);
+    if (current_block_.message_count > 0)
+        begin_time = std::min(begin_time, current_block_.start_time);
+    return begin_time;
+}
+
+ros::Time SnapshotRecorder::getEndTime() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+
+    ros::Time end_time = ros::TIME_MIN;
+    for (Block const& block : blocks_)
+        end_time = std::max(end_time, block.end_time);
+    if (current_block_.message_count > 0)
+        end_time = std::max(end_time, current_block_.end_time);
+    return end_time;
+}
+
+size_t SnapshotRecorder::getPendingCount() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return snapshots_.size();
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -0,0 +1,267 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/split_bag_writer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include <boost/bind/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+using std::string;
+using std::vector;
+using boost::format;
+using boost::shared_ptr;
+
+namespace rosbag_io {
+namespace rosbag {
+
+SplitBagWriter::SplitBagWriter(string const& prefix)
+    : prefix_(prefix), max_size_(0), max_duration_(0, 0), max_messages_(0), max_files_(0), max_total_size_(0),
+      compression_(compression::Uncompressed), chunk_threshold_(768 * 1024),
+      message_count_(0), file_count_(0), next_index_(0), writing_(false), closing_(false), total_size_(0)
+{
+    if (prefix_.size() > 4 && prefix_.compare(prefix_.size() - 4, 4, ".bag") == 0)
+        prefix_.resize(prefix_.size() - 4);
+}
+
+SplitBagWriter::~SplitBagWriter() {
+    try {
+        close();
+    }
+    catch (...) { }
+}
+
+void SplitBagWriter::setMaxSize(uint64_t size)                     { max_size_        = size;     }
+void SplitBagWriter::setMaxDuration(ros::Duration const& duration) { max_duration_    = duration; }
+void SplitBagWriter::setMaxMessages(uint64_t count)                { max_messages_    = count;    }
+void SplitBagWriter::setCompression(CompressionType compression)   { compression_     = compression;     }
+void SplitBagWriter::setChunkThreshold(uint32_t chunk_threshold)   { chunk_threshold_ = chunk_threshold; }
+
+void SplitBagWriter::setMaxFiles(uint32_t count) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    max_files_ = count;
+}
+
+void SplitBagWriter::setMaxTotalSize(uint64_t size) {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    max_total_size_ = size;
+}
+
+uint64_t        SplitBagWriter::getMaxSize()        const { return max_size_;        }
+ros::Duration   SplitBagWriter::getMaxDuration()    const { return max_duration_;    }
+uint64_t        SplitBagWriter::getMaxMessages()    const { return max_messages_;    }
+CompressionType SplitBagWriter::getCompression()    const { return compression_;     }
+uint32_t        SplitBagWriter::getChunkThreshold() const { return chunk_threshold_; }
+uint32_t        SplitBagWriter::getFileCount()      const { return file_count_;      }
+
+uint32_t SplitBagWriter::getMaxFiles() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return max_files_;
+}
+
+uint64_t SplitBagWriter::getMaxTotalSize() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return max_total_size_;
+}
+
+string SplitBagWriter::getFileName() const {
+    return bag_ ? bag_->getFileName() : string();
+}
+
+size_t SplitBagWriter::getPendingCount() const {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+bool SplitBagWriter::isFull(ros::Time const& time) const {
+    if (max_size_ > 0 && bag_->getSize() >= max_size_)
+        return true;
+    if (max_messages_ > 0 && message_count_ >= max_messages_)
+        return true;
+    return max_duration_ > ros::Duration(0, 0) && time - start_time_ >= max_duration_;
+}
+
+// The index after the highest of the bags named prefix_<index>.bag already there
+static uint32_t getNextIndex(string const& prefix) {
+    boost::filesystem::path path(prefix);
+    boost::filesystem::path directory = path.parent_path().empty() ? boost::filesystem::path(".") : path.parent_path();
+    string stem = path.filename().string() + "_";
+
+    uint32_t next_index = 0;
+    boost::system::error_code error;
+    for (boost::filesystem::directory_iterator i(directory, error), end; !error && i != end; i.increment(error)) {
+        string name = i->path().filename().string();
+        if (name.size() <= stem.size() + 4 || name.compare(0, stem.size(), stem) != 0 || name.compare(name.size() - 4, 4, ".bag") != 0)
+            continue;
+
+        string digits = name.substr(stem.size(), name.size() - stem.size() - 4);
+        if (digits.size() > 9 || digits.find_first_not_of("0123456789") != string::npos)
+            continue;
+        next_index = std::max(next_index, (uint32_t) atoi(digits.c_str()) + 1);
+    }
+    return next_index;
+}
+
+void SplitBagWriter::open(ros::Time const& time) {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        if (!finalizer_.joinable()) {
+            closing_   = false;
+            finalizer_ = boost::thread(boost::bind(&SplitBagWriter::finalize, this));
+        }
+    }
+
+    // Number on from the bags of earlier runs rather than overwrite them
+    if (file_count_ == 0)
+        next_index_ = getNextIndex(prefix_);
+    string filename;
+    do
+        filename = (format("%1%_%2%.bag") % prefix_ % next_index_++).str();
+    while (boost::filesystem::exists(filename));
+
+    shared_ptr<Bag> bag = boost::make_shared<Bag>();
+    bag->setCompression(compression_);
+    bag->setChunkThreshold(chunk_threshold_);
+    bag->open(filename, bagmode::Write);
+
+    bag_           = bag;
+    start_time_    = time;
+    message_count_ = 0;
+    file_count_++;
+
+    // The new bag counts towards the maximum number of bags
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    writing_ = true;
+    prune(lock);
+}
+
+void SplitBagWriter::split() {
+    if (!bag_)
+        return;
+
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    queue_.push_back(bag_);
+    bag_.reset();
+    writing_ = false;
+    queued_.notify_all();
+}
+
+void SplitBagWriter::close() {
+    split();
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        closing_ = true;
+        queued_.notify_all();
+    }
+    if (finalizer_.joinable())
+        finalizer_.join();
+
+    rethrowError();
+}
+
+void SplitBagWriter::rethrowError() {
+    std::exception_ptr error;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        error  = error_;
+        error_ = std::exception_ptr();
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void SplitBagWriter::finalize() {
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (true) {
+        while (queue_.empty() && !closing_)
+            queued_.wait(lock);
+        if (queue_.empty())
+            return;
+
+        // Close the bag without holding the lock, so that bags can be handed over meanwhile
+        shared_ptr<Bag> bag = queue_.front();
+        lock.unlock();
+
+        string   filename = bag->getFileName();
+        uint64_t size     = 0;
+        std::exception_ptr error;
+        try {
+            bag->close();
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        bag.reset();
+
+        boost::system::error_code size_error;
+        size = boost::filesystem::file_size(filename, size_error);
+        if (size_error)
+            size = 0;
+
+        lock.lock();
+        queue_.pop_front();
+        if (error) {
+            if (!error_)
+                error_ = error;
+        }
+        else {
+            files_.push_back(std::make_pair(filename, size));
+            total_size_ += size;
+            prune(lock);
+        }
+    }
+}
+
+void SplitBagWriter::prune(boost::unique_lock<boost::mutex>& lock) {
+    // The bags being written or closed count towards the maximum number, but can not be deleted yet
+    vector<string> filenames;
+    while (!files_.empty() && ((max_files_ > 0 && files_.size() + queue_.size() + (writing_ ? 1 : 0) > max_files_) ||
+                               (max_total_size_ > 0 && total_size_ > max_total_size_))) {
+        filenames.push_back(files_.front().first);
+        total_size_ -= files_.front().second;
+        files_.pop_front();
+    }
+    if (filenames.empty())
+        return;
+
+    lock.unlock();
+    for (string const& filename : filenames) {
+        boost::system::error_code error;
+        boost::filesystem::remove(filename, error);
+    }
+    lock.lock();
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -64,6 +64,11 @@ Stream::Stream(ChunkedFile* file) : file_(file) { }
 
 Stream::~Stream() { }
 
+void Stream::writev(ros::SerializedSegment const* segments, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        write((void*) segments[i].data, segments[i].size);
+}
+
 void Stream::startWrite() { }
 void Stream::stopWrite()  { }
 void Stream::startRead()  { }
@@ -0,0 +1,183 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/sync_view.h"
+#include "rosbag_io/rosbag/query.h"
+#include "rosbag_io/rosbag/view.h"
+
+#include <cstring>
+#include <limits>
+
+using std::string;
+using std::vector;
+
+namespace rosbag_io {
+namespace rosbag {
+
+static const uint32_t NO_TUPLE = std::numeric_limits<uint32_t>::max();
+
+// SyncView::iterator
+
+SyncView::iterator::iterator() : view_(NULL), index_(0) { }
+
+SyncView::iterator::iterator(SyncView* view, uint32_t index) : view_(view), index_(index) { }
+
+bool SyncView::iterator::equal(iterator const& other) const {
+    return view_ == other.view_ && index_ == other.index_;
+}
+
+void SyncView::iterator::increment() {
+    index_++;
+}
+
+SyncView::Tuple const& SyncView::iterator::dereference() const {
+    return view_->load(index_);
+}
+
+// SyncView
+
+SyncView::SyncView(Bag const& bag, vector<string> const& topics, ros::Duration const& tolerance,
+                   ros::Time const& start_time, ros::Time const& end_time)
+    : topic_count_(topics.size()), reader_(new ChunkReader(bag)), chunk_reads_(0), current_index_(NO_TUPLE)
+{
+    if (topics.empty())
+        return;
+
+    // The messages of each topic, in time order
+    vector<vector<MessageInstance> > streams(topic_count_);
+    for (uint32_t i = 0; i < topic_count_; i++) {
+        View view(bag, TopicQuery(topics[i]), start_time, end_time);
+        for (MessageInstance const& m : view)
+            streams[i].push_back(m);
+    }
+
+    vector<size_t> heads(topic_count_, 0);
+    while (true) {
+        ros::Time latest;
+        bool      exhausted = false;
+        for (uint32_t i = 0; i < topic_count_; i++) {
+            if (heads[i] == streams[i].size()) {
+                exhausted = true;
+                break;
+            }
+            latest = std::max(latest, streams[i][heads[i]].getTime());
+        }
+        if (exhausted)
+            break;
+
+        // Move each topic to its latest message not after the latest head, which only narrows the tuple
+        uint32_t earliest = 0;
+        for (uint32_t i = 0; i < topic_count_; i++) {
+            while (heads[i] + 1 < streams[i].size() && streams[i][heads[i] + 1].getTime() <= latest)
+                heads[i]++;
+            if (streams[i][heads[i]].getTime() < streams[earliest][heads[earliest]].getTime())
+                earliest = i;
+        }
+
+        // Every later message of the topic of the latest head is further from the earliest head
+        if (latest - streams[earliest][heads[earliest]].getTime() > tolerance) {
+            heads[earliest]++;
+            continue;
+        }
+
+        for (uint32_t i = 0; i < topic_count_; i++)
+            slots_.push_back(streams[i][heads[i]++]);
+    }
+
+    // Plan the reads of the chunks
+    slot_offsets_.assign(slots_.size(), 0);
+    slot_sizes_.assign(slots_.size(), 0);
+    for (uint32_t s = 0; s < slots_.size(); s++) {
+        Chunk& chunk = chunks_[slots_[s].getIndexEntry().chunk_pos];
+        chunk.slots.push_back(s);
+        chunk.last_tuple = s / topic_count_;
+        chunk.loaded     = false;
+    }
+}
+
+SyncView::~SyncView() { }
+
+SyncView::iterator SyncView::begin() { return iterator(this, 0);      }
+SyncView::iterator SyncView::end()   { return iterator(this, size()); }
+
+uint32_t SyncView::size() const {
+    return topic_count_ > 0 ? slots_.size() / topic_count_ : 0;
+}
+
+uint32_t SyncView::getChunkReads() const { return chunk_reads_; }
+
+SyncView::Tuple const& SyncView::load(uint32_t index) {
+    if (index == current_index_)
+        return current_;
+
+    // Release the chunks no later tuple uses
+    while (!loaded_.empty() && loaded_.begin()->first < index) {
+        Chunk& chunk = chunks_[loaded_.begin()->second];
+        vector<uint8_t>().swap(chunk.data);
+        chunk.loaded = false;
+        loaded_.erase(loaded_.begin());
+    }
+
+    current_.clear();
+    for (uint32_t s = index * topic_count_; s < (index + 1) * topic_count_; s++) {
+        uint64_t chunk_pos = slots_[s].getIndexEntry().chunk_pos;
+        Chunk&   chunk     = chunks_[chunk_pos];
+        if (!chunk.loaded)
+            loadChunk(chunk_pos, chunk);
+
+        current_.push_back(SyncedMessage(slots_[s], &chunk.data[slot_offsets_[s]], slot_sizes_[s]));
+    }
+    current_index_ = index;
+
+    return current_;
+}
+
+void SyncView::loadChunk(uint64_t chunk_pos, Chunk& chunk) {
+    uint64_t size = 0;
+    for (uint32_t s : chunk.slots) {
+        uint8_t const* data;
+        reader_->readMessageData(slots_[s].getIndexEntry(), data, slot_sizes_[s]);
+        slot_offsets_[s] = size;
+        size += slot_sizes_[s];
+    }
+
+    // All the slots are in the current chunk of the reader now.  One byte more gives empty payloads an address.
+    chunk.data.resize(size + 1);
+    for (uint32_t s : chunk.slots) {
+        uint8_t const* data;
+        uint32_t       data_size;
+        reader_->readMessageData(slots_[s].getIndexEntry(), data, data_size);
+        memcpy(&chunk.data[slot_offsets_[s]], data, data_size);
+    }
+
+    chunk.loaded = true;
+    loaded_.insert(std::make_pair(chunk.last_tuple, chunk_pos));
+    chunk_reads_++;
+}
+
+} // namespace rosbag
+} // namespace rosbag_io
@@ -34,8 +34,17 @@
 
 #include "rosbag_io/rosbag/chunked_file.h"
 
+#include <algorithm>
 #include <iostream>
 #include <cstring>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 #include <boost/format.hpp>
 
@@ -60,6 +69,69 @@ void UncompressedStream::write(void* ptr, size_t size) {
     advanceOffset(size);
 }
 
+// Below this size the segments go through the stdio buffer; a flush and a writev() syscall only pay off for large payloads
+static const size_t WRITEV_MIN_SIZE = 64 * 1024;
+
+void UncompressedStream::writev(ros::SerializedSegment const* segments, size_t count) {
+#ifdef _WIN32
+    Stream::writev(segments, count);
+#else
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++)
+        total += segments[i].size;
+
+    if (total < WRITEV_MIN_SIZE) {
+        Stream::writev(segments, count);
+        return;
+    }
+
+    FILE* file = getFilePointer();
+    if (fflush(file) != 0)
+        throw BagIOException("Error flushing file before writev");
+
+    std::vector<struct iovec> iov;
+    iov.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        if (segments[i].size == 0)
+            continue;
+        struct iovec v;
+        v.iov_base = (void*) segments[i].data;
+        v.iov_len  = segments[i].size;
+        iov.push_back(v);
+    }
+
+    int fd = fileno(file);
+    size_t written = 0;
+    size_t first = 0;
+    while (first < iov.size()) {
+        int n = (int) std::min(iov.size() - first, (size_t) IOV_MAX);
+        ssize_t result = ::writev(fd, &iov[first], n);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            throw BagIOException((format("Error writing to file: writing %1% bytes, wrote %2% bytes") % total % written).str());
+        }
+        written += result;
+
+        // Skip the fully written vectors and trim a partially written one
+        size_t remaining = result;
+        while (first < iov.size() && remaining >= iov[first].iov_len)
+            remaining -= iov[first++].iov_len;
+        if (remaining > 0) {
+            iov[first].iov_base = (char*) iov[first].iov_base + remaining;
+            iov[first].iov_len -= remaining;
+        }
+    }
+
+    advanceOffset(total);
+
+    // The descriptor was moved behind stdio's back; resynchronize the FILE position with it
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0 || fseeko(file, pos, SEEK_SET) != 0)
+        throw BagIOException("Error seeking after writev");
+#endif
+}
+
 void UncompressedStream::read(void* ptr, size_t size) {
     size_t nUnused = (size_t) getUnusedLength();
     char* unused = getUnused();
@@ -224,6 +224,38 @@ View::iterator View::begin() {
 //! Default constructed iterator signifies end
 View::iterator View::end() { return iterator(this, true); }
 
+View::iterator View::seek(ros::Time const& time) {
+    update();
+
+    iterator i(this, true);
+
+    IndexEntry time_lookup_entry = { time, 0, 0 };
+    for (MessageRange const* range : ranges_) {
+        if (range->begin == range->end)
+            continue;
+
+        multiset<IndexEntry>::const_iterator start = range->begin;
+        if (start->time < time) {
+            multiset<IndexEntry>::const_iterator last = range->end;
+            last--;
+            if (last->time < time)
+                continue;
+
+            // The range covers a part of the index of its connection, which we search instead
+            Bag const* bag = range->bag_query->bag;
+            multiset<IndexEntry> const& index = bag->index_->connection_indexes.find(range->connection_info->id)->second;
+            start = index.lower_bound(time_lookup_entry);
+        }
+
+        i.iters_.push_back(ViewIterHelper(start, range));
+    }
+
+    std::sort(i.iters_.begin(), i.iters_.end(), ViewIterHelperCompare());
+    i.view_revision_ = view_revision_;
+
+    return i;
+}
+
 uint32_t View::size() { 
 
   update();
@@ -264,17 +296,17 @@ void View::addQuery(Bag const& bag, boost::function<bool(ConnectionInfo const*)>
 }
 
 void View::updateQueries(BagQuery* q) {
-    for (map<uint32_t, ConnectionInfo*>::const_iterator i = q->bag->connections_.begin(); i != q->bag->connections_.end(); i++) {
+    for (map<uint32_t, ConnectionInfo*>::const_iterator i = q->bag->index_->connections.begin(); i != q->bag->index_->connections.end(); i++) {
         ConnectionInfo const* connection = i->second;
 
         // Skip if the query doesn't evaluate to true
         if (!q->query.getQuery()(connection))
             continue;
 
-        map<uint32_t, multiset<IndexEntry> >::const_iterator j = q->bag->connection_indexes_.find(connection->id);
+        map<uint32_t, multiset<IndexEntry> >::const_iterator j = q->bag->index_->connection_indexes.find(connection->id);
 
         // Skip if the bag doesn't have the corresponding index
-        if (j == q->bag->connection_indexes_.end())
+        if (j == q->bag->index_->connection_indexes.end())
             continue;
         multiset<IndexEntry> const& index = j->second;
 
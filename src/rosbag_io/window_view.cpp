@@ -0,0 +1,188 @@
+// Copyright (c) 2009, Willow Garage, Inc.
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Willow Garage, Inc. nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "rosbag_io/rosbag/window_view.h"
+
+#include <boost/make_shared.hpp>
+
+using std::map;
+using std::string;
+using boost::shared_ptr;
+
+namespace rosbag_io {
+namespace rosbag {
+
+static const uint64_t NO_WINDOW = (uint64_t) -1;
+
+// WindowView::Window
+
+WindowView::Window::Window() : count_(0), full_at_(0) { }
+
+string const&          WindowView::Window::getTopic()            const { return topic_;        }
+size_t                 WindowView::Window::size()                const { return ring_.size();  }
+WindowView::const_iterator WindowView::Window::begin()           const { return ring_.begin(); }
+WindowView::const_iterator WindowView::Window::end()             const { return ring_.end();   }
+WindowedMessage const& WindowView::Window::operator[](size_t i)  const { return ring_[i];      }
+WindowedMessage const& WindowView::Window::front()               const { return ring_.front(); }
+WindowedMessage const& WindowView::Window::back()                const { return ring_.back();  }
+
+// WindowView::iterator
+
+WindowView::iterator::iterator() : view_(NULL), index_(NO_WINDOW) { }
+
+WindowView::iterator::iterator(WindowView* view, uint64_t index) : view_(view), index_(index) { }
+
+bool WindowView::iterator::equal(iterator const& other) const {
+    return index_ == other.index_;
+}
+
+void WindowView::iterator::increment() {
+    index_ = view_->advance() ? index_ + 1 : NO_WINDOW;
+}
+
+WindowView::Window const& WindowView::iterator::dereference() const {
+    return *view_->current_;
+}
+
+// WindowView
+
+WindowView::WindowView(View& view, uint32_t count, uint32_t stride)
+    : view_(&view), count_(std::max(count, 1u)), stride_(std::max(stride, 1u)), current_(NULL), chunk_reads_(0)
+{
+}
+
+WindowView::WindowView(View& view, ros::Duration const& span, uint32_t stride)
+    : view_(&view), count_(0), span_(span), stride_(std::max(stride, 1u)), current_(NULL), chunk_reads_(0)
+{
+}
+
+WindowView::~WindowView() { }
+
+WindowView::iterator WindowView::begin() {
+    windows_.clear();
+    connection_windows_.clear();
+    current_  = NULL;
+    position_ = view_->begin();
+
+    return iterator(this, advance() ? 0 : NO_WINDOW);
+}
+
+WindowView::iterator WindowView::end() { return iterator(this, NO_WINDOW); }
+
+uint32_t WindowView::getChunkReads() const { return chunk_reads_; }
+
+bool WindowView::advance() {
+    while (position_ != view_->end()) {
+        MessageInstance const& m = *position_;
+
+        map<ConnectionInfo const*, Window*>::const_iterator i = connection_windows_.find(m.getConnectionInfo());
+        if (i == connection_windows_.end()) {
+            Window& window = windows_[m.getTopic()];
+            window.topic_ = m.getTopic();
+            i = connection_windows_.insert(std::make_pair(m.getConnectionInfo(), &window)).first;
+        }
+        Window& window = *i->second;
+
+        read(m, window);
+        ++position_;
+
+        // Slide the window
+        if (window.count_ == 0)
+            window.first_ = window.ring_.back().message.getTime();
+        window.count_++;
+
+        bool full;
+        if (count_ > 0) {
+            if (window.ring_.size() > count_)
+                window.ring_.pop_front();
+            full = window.count_ >= count_;
+        }
+        else {
+            ros::Time newest = window.ring_.back().message.getTime();
+            while (newest - window.ring_.front().message.getTime() > span_)
+                window.ring_.pop_front();
+            full = newest - window.first_ >= span_;
+        }
+
+        // The first full window, then every stride messages
+        if (!full)
+            continue;
+        if (window.full_at_ == 0)
+            window.full_at_ = window.count_;
+        if ((window.count_ - window.full_at_) % stride_ != 0)
+            continue;
+
+        current_ = &window;
+        return true;
+    }
+
+    current_ = NULL;
+    return false;
+}
+
+void WindowView::read(MessageInstance const& m, Window& window) {
+    IndexEntry const& index_entry = m.getIndexEntry();
+    std::pair<Bag const*, uint64_t> key(&m.getBag(), index_entry.chunk_pos);
+
+    // Pin the chunk, unless a window still does
+    shared_ptr<Buffer> chunk;
+    map<std::pair<Bag const*, uint64_t>, boost::weak_ptr<Buffer> >::iterator pinned = chunks_.find(key);
+    if (pinned != chunks_.end())
+        chunk = pinned->second.lock();
+    if (!chunk) {
+        ChunkReader& reader = getReader(key.first);
+        reader.readChunk(key.second);
+        chunk = boost::make_shared<Buffer>();
+        reader.takeChunk(*chunk);
+        chunk_reads_++;
+
+        // Forget the chunks no window holds anymore
+        for (map<std::pair<Bag const*, uint64_t>, boost::weak_ptr<Buffer> >::iterator i = chunks_.begin(); i != chunks_.end(); ) {
+            if (i->second.expired())
+                chunks_.erase(i++);
+            else
+                ++i;
+        }
+        chunks_[key] = chunk;
+    }
+
+    uint8_t const* data;
+    uint32_t       data_size;
+    ChunkReader::locateMessageData(chunk->getData(), chunk->getSize(), index_entry.offset, data, data_size);
+
+    window.ring_.push_back(WindowedMessage(m, chunk, data, data_size));
+}
+
+ChunkReader& WindowView::getReader(Bag const* bag) {
+    shared_ptr<ChunkReader>& reader = readers_[bag];
+    if (!reader)
+        reader = boost::make_shared<ChunkReader>(*bag);
+    return *reader;
+}
+
+} // namespace rosbag
+} // namespace rosbag_io